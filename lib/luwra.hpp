@@ -7,11 +7,33 @@
 #ifndef LUWRA_H_
 #define LUWRA_H_
 
+#include "luwra/async.hpp"
 #include "luwra/auxiliary.hpp"
+#include "luwra/bundle.hpp"
+#include "luwra/cache.hpp"
+#include "luwra/channel.hpp"
 #include "luwra/common.hpp"
+#include "luwra/eventbatch.hpp"
+#include "luwra/eventloop.hpp"
+#include "luwra/executor.hpp"
+#include "luwra/gc.hpp"
+#include "luwra/mapping.hpp"
+#include "luwra/memory.hpp"
+#include "luwra/parallel.hpp"
+#include "luwra/pool.hpp"
+#include "luwra/sandbox.hpp"
+#include "luwra/scheduler.hpp"
+#include "luwra/serialize.hpp"
+#include "luwra/snapshot.hpp"
 #include "luwra/stack.hpp"
 #include "luwra/state.hpp"
+#include "luwra/task.hpp"
+#include "luwra/timerwheel.hpp"
+#include "luwra/transfer.hpp"
+#include "luwra/types/coroutine.hpp"
 #include "luwra/types/function.hpp"
+#include "luwra/types/json.hpp"
+#include "luwra/types/memoized.hpp"
 #include "luwra/types/pushable.hpp"
 #include "luwra/types/reference.hpp"
 #include "luwra/types/stl.hpp"
@@ -0,0 +1,286 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_ASYNC_H_
+#define LUWRA_ASYNC_H_
+
+#include "common.hpp"
+#include "values.hpp"
+#include "stack.hpp"
+#include "scheduler.hpp"
+#include "internal/indexsequence.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+LUWRA_NS_BEGIN
+
+/// Fixed set of threads which run C++ jobs. Unlike @ref ExecutorPool the workers have no Lua state.
+struct WorkerPool {
+	using Job = std::function<void ()>;
+
+	/// Start the workers.
+	///
+	/// \param size Number of threads, at least 1
+	inline
+	WorkerPool(size_t size) {
+		for (size_t i = 0; i < std::max<size_t>(size, 1); i++)
+			threads.emplace_back(&WorkerPool::work, this);
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator =(const WorkerPool&) = delete;
+
+	/// Finish the queued jobs and stop the workers.
+	inline
+	~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		signal.notify_all();
+
+		for (std::thread& thread: threads)
+			thread.join();
+	}
+
+	/// Pool which is shared by all users of @ref LUWRA_WRAP_ASYNC. It has one thread per core.
+	static inline
+	WorkerPool& shared() {
+		static WorkerPool pool(std::thread::hardware_concurrency());
+		return pool;
+	}
+
+	/// Queue a job. Exceptions must not escape from it.
+	inline
+	void submit(Job job) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+
+		signal.notify_one();
+	}
+
+	/// Number of threads
+	inline
+	size_t size() const {
+		return threads.size();
+	}
+
+private:
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable signal;
+	std::deque<Job> jobs;
+	bool stopping = false;
+
+	inline
+	void work() {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		while (true) {
+			signal.wait(lock, [this]() { return stopping || !jobs.empty(); });
+
+			if (jobs.empty())
+				return;
+
+			Job job = std::move(jobs.front());
+			jobs.pop_front();
+
+			lock.unlock();
+			job();
+			lock.lock();
+		}
+	}
+};
+
+namespace internal {
+	// How an argument is stored while the job is queued. Strings which are read as pointers are
+	// copied, because the Lua strings may be collected in the meantime.
+	template <typename Type>
+	struct AsyncArgument {
+		using Storage = typename std::decay<Type>::type;
+
+		static inline
+		Storage& get(Storage& value) {
+			return value;
+		}
+	};
+
+	template <>
+	struct AsyncArgument<const char*> {
+		using Storage = std::string;
+
+		static inline
+		const char* get(Storage& value) {
+			return value.c_str();
+		}
+	};
+
+	// Make sure the calling function runs within a scheduled coroutine. This has to happen before
+	// anything is allocated, because raising an error skips destructors.
+	inline
+	void checkScheduled(State* state) {
+		Scheduler* scheduler = Scheduler::current(state);
+
+		if (!scheduler || !scheduler->owns(state))
+			luaL_error(state, "cannot wait outside of a scheduled coroutine");
+	}
+
+	// Run a job for the coroutine which is calling a C function, then continue the coroutine with
+	// the values which the job's result pushes. The job is moved out of the given object.
+	template <typename Job> inline
+	int awaitJob(State* state, WorkerPool& pool, Job&& job) {
+		return Scheduler::current(state)->await(state, [&pool, &job](Wakeup wakeup) {
+			std::function<void ()> run = std::bind(std::move(job), wakeup);
+			pool.submit(std::move(run));
+		});
+	}
+
+	// Asynchronous function wrapper for functions with the return type Ret and the parameter
+	// types Args...
+	template <typename Ret, typename... Args>
+	struct AsyncWrapperImpl {
+		using Arguments = std::tuple<typename AsyncArgument<Args>::Storage...>;
+
+		// Implements 'invoke' for functions with a return value.
+		template <size_t... Indices>
+		struct ImplementationNonVoid {
+			template <Ret (* func)(Args...)>
+			struct Job {
+				std::shared_ptr<Arguments> arguments;
+
+				inline
+				void operator ()(const Wakeup& wakeup) const {
+					try {
+						std::shared_ptr<Ret> result = std::make_shared<Ret>(
+							func(AsyncArgument<Args>::get(std::get<Indices>(*arguments))...)
+						);
+
+						wakeup.resume([result](State* state) {
+							return static_cast<int>(pushReturn(state, std::move(*result)));
+						});
+					} catch (const std::exception& error) {
+						wakeup.fail(error.what());
+					} catch (...) {
+						wakeup.fail("asynchronous function has failed");
+					}
+				}
+			};
+
+			template <Ret (* func)(Args...)> static inline
+			int invoke(State* state) {
+				checkScheduled(state);
+
+				return awaitJob(
+					state,
+					WorkerPool::shared(),
+					Job<func> {
+						// Copy the parameters off the stack.
+						std::make_shared<Arguments>(read<Args>(state, 1 + Indices)...)
+					}
+				);
+			}
+		};
+
+		// Implements 'invoke' for functions without a return value.
+		template <size_t... Indices>
+		struct ImplementationVoid {
+			template <void (* func)(Args...)>
+			struct Job {
+				std::shared_ptr<Arguments> arguments;
+
+				inline
+				void operator ()(const Wakeup& wakeup) const {
+					try {
+						func(AsyncArgument<Args>::get(std::get<Indices>(*arguments))...);
+						wakeup.resume([](State*) { return 0; });
+					} catch (const std::exception& error) {
+						wakeup.fail(error.what());
+					} catch (...) {
+						wakeup.fail("asynchronous function has failed");
+					}
+				}
+			};
+
+			template <void (* func)(Args...)> static inline
+			int invoke(State* state) {
+				checkScheduled(state);
+
+				return awaitJob(
+					state,
+					WorkerPool::shared(),
+					Job<func> {
+						// Copy the parameters off the stack.
+						std::make_shared<Arguments>(read<Args>(state, 1 + Indices)...)
+					}
+				);
+			}
+		};
+
+		template <size_t... Indices>
+		using ImplementationPicker =
+			// Choose which implementation to use based on the return type of the function.
+			typename std::conditional<
+				std::is_same<Ret, void>::value,
+				ImplementationVoid<Indices...>,
+				ImplementationNonVoid<Indices...>
+			>::type;
+
+		using Implementation =
+			typename MakeIndexSequence<sizeof...(Args)>::template Relay<
+				ImplementationPicker
+			>;
+	};
+
+	// Catch attempts to wrap unwrappable types.
+	template <typename ToBeWrapped>
+	struct AsyncWrapper {
+		static_assert(
+			sizeof(ToBeWrapped) == -1,
+			"Template parameter to AsyncWrapper is not a function"
+		);
+	};
+
+	template <typename Ret, typename... Args>
+	struct AsyncWrapper<Ret (Args...)>:
+		AsyncWrapperImpl<Ret, Args...>::Implementation {};
+
+	template <typename Ret, typename... Args>
+	struct AsyncWrapper<Ret (*)(Args...)>:
+		AsyncWrapper<Ret (Args...)> {};
+}
+
+LUWRA_NS_END
+
+/// Generate a `lua_CFunction` wrapper for a function which runs on @ref luwra::WorkerPool::shared.
+/// The parameters are copied off the stack, then the calling coroutine waits until the function
+/// has returned and receives its result. Other coroutines of the state's @ref luwra::Scheduler
+/// continue to run in the meantime. Exceptions are raised as Lua errors.
+///
+/// The function runs on another thread, therefore its parameters must not refer to Lua values,
+/// e.g. @ref luwra::Reference or @ref luwra::Table.
+///
+/// \param entity Function that shall be wrapped
+/// \returns Wrapped function as `lua_CFunction`
+#define LUWRA_WRAP_ASYNC(entity) \
+	(&luwra::internal::AsyncWrapper<decltype(&entity)>::template invoke<&entity>)
+
+#endif
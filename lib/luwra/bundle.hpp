@@ -0,0 +1,202 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_BUNDLE_H_
+#define LUWRA_BUNDLE_H_
+
+#include "common.hpp"
+#include "auxiliary.hpp"
+#include "cache.hpp"
+#include "mapping.hpp"
+#include "usertypes.hpp"
+
+#include <cstring>
+#include <memory>
+#include <string>
+
+LUWRA_NS_BEGIN
+
+/// Compiles modules into a bundle which can be mounted using @ref mountBundle
+///
+/// A bundle is a @ref MappedArchive whose entries are named after modules and contain their
+/// bytecode. Debug information is stripped on Lua 5.3 and later.
+///
+/// Example:
+///
+/// ```
+///   BundleWriter writer;
+///   writer.addFile("app.config", "src/app/config.lua");
+///   writer.addFile("app", "src/app/init.lua");
+///   writer.write("app.luwra");
+/// ```
+struct BundleWriter {
+	/// Error message of the last failed compilation
+	std::string error;
+
+	inline
+	BundleWriter():
+		state(luaL_newstate(), lua_close)
+	{}
+
+	/// Compile a piece of code and add it as a module.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of the compilation
+	inline
+	int addString(const std::string& name, const char* code) {
+		std::string chunkname = "@" + name;
+		return add(name, luaL_loadbuffer(state.get(), code, std::strlen(code), chunkname.c_str()));
+	}
+
+	/// Compile a file and add it as a module.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of the compilation
+	inline
+	int addFile(const std::string& name, const char* path) {
+		return add(name, loadMappedFile(state.get(), path));
+	}
+
+	/// Number of modules
+	inline
+	size_t size() const {
+		return archive.size();
+	}
+
+	/// Write the bundle to a file.
+	///
+	/// \returns `true` on success
+	inline
+	bool write(const char* path) const {
+		return archive.write(path);
+	}
+
+private:
+	std::unique_ptr<State, void (*)(State*)> state;
+	ArchiveWriter archive;
+
+	inline
+	int add(const std::string& name, int status) {
+		if (status != LUA_OK) {
+			const char* message = lua_tostring(state.get(), -1);
+			error = message ? message : "";
+
+			lua_settop(state.get(), 0);
+			return status;
+		}
+
+		std::string bytecode;
+		internal::dumpFunction(state.get(), bytecode, true);
+		lua_settop(state.get(), 0);
+
+		archive.add(name, std::move(bytecode));
+		return LUA_OK;
+	}
+};
+
+namespace internal {
+	// Entry of 'package.searchers' (or 'package.loaders' in Lua 5.1). The first upvalue is the
+	// bundle, the second one its path.
+	inline
+	int searchBundle(State* state) {
+		const MappedArchive* bundle =
+			static_cast<const MappedArchive*>(lua_touserdata(state, lua_upvalueindex(1)));
+		const char* name = luaL_checkstring(state, 1);
+
+		int status = bundle->load(state, name);
+
+		if (status == LUA_ERRFILE) {
+			lua_pushfstring(
+				state,
+#if LUA_VERSION_NUM >= 504
+				// 'require' separates the messages of the searchers by itself
+				"no module '%s' in bundle '%s'",
+#else
+				"\n\tno module '%s' in bundle '%s'",
+#endif
+				name,
+				lua_tostring(state, lua_upvalueindex(2))
+			);
+			return 1;
+		} else if (status != LUA_OK) {
+			return luaL_error(
+				state,
+				"error loading module '%s' from bundle '%s':\n\t%s",
+				name,
+				lua_tostring(state, lua_upvalueindex(2)),
+				lua_tostring(state, -1)
+			);
+		}
+
+		// Passed to the loader as second argument
+		lua_pushvalue(state, lua_upvalueindex(2));
+		return 2;
+	}
+}
+
+/// Make the modules of a bundle available to `require`. The bundle is mapped into memory and stays
+/// mapped until the state is closed. Its searcher is consulted right after `package.preload`, so
+/// modules in the bundle take precedence over those in `package.path` and `package.cpath`. Each
+/// lookup is a binary search in the bundle's index and does not touch the file system.
+///
+/// Bundles are created using @ref BundleWriter and have to be compiled with the same Lua version.
+///
+/// \param state Lua state
+/// \param path  Path to the bundle
+/// \returns `false` if the bundle is invalid or the package library has not been loaded
+inline
+bool mountBundle(State* state, const char* path) {
+	using Wrapper = internal::UserTypeWrapper<MappedArchive>;
+
+	lua_getglobal(state, "package");
+	if (!lua_istable(state, -1)) {
+		lua_pop(state, 1);
+		return false;
+	}
+
+#if LUA_VERSION_NUM <= 501
+	lua_getfield(state, -1, "loaders");
+#else
+	lua_getfield(state, -1, "searchers");
+#endif
+
+	if (!lua_istable(state, -1)) {
+		lua_pop(state, 2);
+		return false;
+	}
+
+	if (luaL_newmetatable(state, Wrapper::name.c_str()))
+		setFields(state, -1, "__gc", &Wrapper::destruct);
+
+	lua_pop(state, 1);
+
+	if (!construct<MappedArchive>(state, path).isValid()) {
+		lua_pop(state, 3);
+		return false;
+	}
+
+	lua_pushstring(state, path);
+	lua_pushcclosure(state, &internal::searchBundle, 2);
+
+	// Insert behind the 'package.preload' searcher.
+#if LUA_VERSION_NUM <= 501
+	int length = static_cast<int>(lua_objlen(state, -2));
+#else
+	int length = static_cast<int>(lua_rawlen(state, -2));
+#endif
+
+	for (int i = length; i >= 2; i--) {
+		lua_rawgeti(state, -2, i);
+		lua_rawseti(state, -3, i + 1);
+	}
+
+	lua_rawseti(state, -2, length >= 1 ? 2 : 1);
+	lua_pop(state, 2);
+
+	return true;
+}
+
+LUWRA_NS_END
+
+#endif
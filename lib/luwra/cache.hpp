@@ -0,0 +1,336 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_CACHE_H_
+#define LUWRA_CACHE_H_
+
+#include "common.hpp"
+#include "mapping.hpp"
+#include "types/reference.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <sys/stat.h>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// 64-bit FNV-1a
+	inline
+	uint64_t hashBytes(const char* data, size_t length, uint64_t hash = 14695981039346656037ull) {
+		for (size_t i = 0; i < length; i++) {
+			hash ^= static_cast<unsigned char>(data[i]);
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
+	// 'lua_Writer' which appends to a 'std::string'
+	inline
+	int writeToString(State*, const void* data, size_t size, void* ud) {
+		static_cast<std::string*>(ud)->append(static_cast<const char*>(data), size);
+		return 0;
+	}
+
+	// Dump the function on top of the stack.
+	inline
+	bool dumpFunction(State* state, std::string& output, bool strip = false) {
+#if LUA_VERSION_NUM >= 503
+		return lua_dump(state, &writeToString, &output, strip ? 1 : 0) == 0;
+#else
+		(void) strip;
+		return lua_dump(state, &writeToString, &output) == 0;
+#endif
+	}
+
+	// Header of a bytecode file in a chunk cache directory
+	struct ChunkFileHeader {
+		char magic[8];
+		int32_t version;
+		int32_t reserved;
+		int64_t mtime;
+		uint64_t size;
+		uint64_t hash;
+		uint64_t length;
+		uint64_t keyLength;
+	};
+
+	// Signature of bytecode files in a chunk cache directory
+	static
+	const char chunkFileMagic[8] = {'L', 'u', 'w', 'r', 'a', 'C', 'C', 2};
+}
+
+/// Statistics of a @ref ChunkCache
+struct ChunkCacheStats {
+	/// Chunks which have been served from memory
+	size_t hits = 0;
+
+	/// Chunks which have been loaded from the cache directory
+	size_t diskHits = 0;
+
+	/// Chunks which had to be compiled
+	size_t misses = 0;
+};
+
+/// Caches compiled chunks in order to avoid lexing and parsing the same source over and over
+///
+/// Compiled chunks are kept as references to the resulting functions. Strings are identified by
+/// their contents, files by their path and validated using their modification time and
+/// size.
+///
+/// If a directory is given, compiled chunks are also written there using `lua_dump`. A later
+/// process with an empty in-memory cache picks them up instead of compiling the source. Each file
+/// records the Lua version, the source's modification time and size, a content hash and the code
+/// of the string or the path of the file, and is ignored if any of these do not match. Bytecode is
+/// loaded without further verification, therefore the directory must not be writable by untrusted
+/// parties.
+///
+/// Note that a cached chunk is the same function every time it is loaded. Changing its upvalues
+/// (e.g. its `_ENV`) affects all subsequent runs.
+struct ChunkCache {
+	/// Lua state which owns the cached functions
+	State* state;
+
+	/// Directory for bytecode files, empty if chunks shall only be cached in memory
+	std::string directory;
+
+	/// Statistics
+	ChunkCacheStats stats;
+
+	/// Create a cache for the given state.
+	inline
+	ChunkCache(State* state, const std::string& directory = std::string()):
+		state(state),
+		directory(directory)
+	{}
+
+	ChunkCache(const ChunkCache&) = delete;
+	ChunkCache& operator =(const ChunkCache&) = delete;
+
+	/// Compile a piece of code or retrieve it from the cache, and push the resulting function.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of the compilation with the error
+	///          message on top of the stack
+	inline
+	int loadString(const char* code) {
+		size_t length = std::strlen(code);
+		uint64_t hash = internal::hashBytes(code, length);
+
+		auto it = strings.find(hash);
+		if (it != strings.end() && it->second.source.compare(0, std::string::npos, code, length) == 0) {
+			stats.hits++;
+			it->second.function.life->push();
+			return LUA_OK;
+		}
+
+		std::string path = directory.empty() ? std::string() : filePath("s", hash);
+
+		std::string source(code, length);
+
+		int status = loadCompiled(path, 0, length, hash, source, code);
+		if (status == LUA_OK) {
+			if (it != strings.end())
+				strings.erase(it);
+
+			strings.emplace(hash, Entry {Reference(state, -1), 0, length, std::move(source)});
+		}
+
+		return status;
+	}
+
+	/// Compile a file or retrieve it from the cache, and push the resulting function.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of the compilation with the error
+	///          message on top of the stack
+	inline
+	int loadFile(const char* filepath) {
+		struct stat info;
+		if (stat(filepath, &info) != 0)
+			return loadMappedFile(state, filepath);
+
+		int64_t mtime = static_cast<int64_t>(info.st_mtime);
+		uint64_t size = static_cast<uint64_t>(info.st_size);
+
+		auto it = files.find(filepath);
+		if (it != files.end() && it->second.mtime == mtime && it->second.size == size) {
+			stats.hits++;
+			it->second.function.life->push();
+			return LUA_OK;
+		}
+
+		uint64_t hash = internal::hashBytes(filepath, std::strlen(filepath));
+		std::string path = directory.empty() ? std::string() : filePath("f", hash);
+
+		int status = loadCompiled(path, mtime, size, hash, filepath, nullptr, filepath);
+		if (status == LUA_OK) {
+			if (it != files.end())
+				files.erase(it);
+
+			files.emplace(filepath, Entry {Reference(state, -1), mtime, size, std::string()});
+		}
+
+		return status;
+	}
+
+	/// Forget all chunks which are cached in memory.
+	inline
+	void clear() {
+		strings.clear();
+		files.clear();
+	}
+
+private:
+	struct Entry {
+		Reference function;
+		int64_t mtime;
+		uint64_t size;
+
+		// Code of a string chunk, hash collisions must not count as hits
+		std::string source;
+	};
+
+	std::unordered_map<uint64_t, Entry> strings;
+	std::unordered_map<std::string, Entry> files;
+
+	inline
+	std::string filePath(const char* kind, uint64_t hash) const {
+		char name[32];
+		std::snprintf(name, sizeof(name), "%s%016llx.luac", kind, static_cast<unsigned long long>(hash));
+
+		return directory + "/" + name;
+	}
+
+	// Obtain the function from the cache directory or compile it. Compiled functions are written
+	// to the cache directory. The key (the code of a string or the path of a file) is stored
+	// along with the bytecode and has to match exactly.
+	inline
+	int loadCompiled(
+		const std::string& path,
+		int64_t            mtime,
+		uint64_t           size,
+		uint64_t           hash,
+		const std::string& key,
+		const char*        code,
+		const char*        filepath = nullptr
+	) {
+		if (!path.empty() && loadBytecode(path, mtime, size, hash, key)) {
+			stats.diskHits++;
+			return LUA_OK;
+		}
+
+		stats.misses++;
+
+		int status = code ? luaL_loadstring(state, code) : loadMappedFile(state, filepath);
+
+		if (status == LUA_OK && !path.empty())
+			storeBytecode(path, mtime, size, hash, key);
+
+		return status;
+	}
+
+	inline
+	bool loadBytecode(
+		const std::string& path,
+		int64_t            mtime,
+		uint64_t           size,
+		uint64_t           hash,
+		const std::string& key
+	) {
+		std::FILE* file = std::fopen(path.c_str(), "rb");
+		if (!file)
+			return false;
+
+		internal::ChunkFileHeader header;
+		std::string bytecode;
+
+		bool valid =
+			std::fread(&header, sizeof(header), 1, file) == 1
+			&& std::memcmp(header.magic, internal::chunkFileMagic, sizeof(header.magic)) == 0
+			&& header.version == LUA_VERSION_NUM
+			&& header.mtime == mtime
+			&& header.size == size
+			&& header.hash == hash
+			&& header.keyLength == key.size();
+
+		if (valid) {
+			std::string storedKey(key.size(), '\0');
+
+			valid =
+				(key.empty() || std::fread(&storedKey[0], 1, key.size(), file) == key.size())
+				&& storedKey == key;
+		}
+
+		if (valid) {
+			bytecode.resize(header.length);
+			valid =
+				header.length > 0
+				&& std::fread(&bytecode[0], 1, bytecode.size(), file) == bytecode.size();
+		}
+
+		std::fclose(file);
+
+		if (!valid)
+			return false;
+
+		if (luaL_loadbuffer(state, bytecode.data(), bytecode.size(), path.c_str()) != LUA_OK) {
+			lua_pop(state, 1);
+			return false;
+		}
+
+		return true;
+	}
+
+	inline
+	void storeBytecode(
+		const std::string& path,
+		int64_t            mtime,
+		uint64_t           size,
+		uint64_t           hash,
+		const std::string& key
+	) {
+		std::string bytecode;
+		if (!internal::dumpFunction(state, bytecode))
+			return;
+
+		internal::ChunkFileHeader header;
+		std::memcpy(header.magic, internal::chunkFileMagic, sizeof(header.magic));
+		header.version = LUA_VERSION_NUM;
+		header.reserved = 0;
+		header.mtime = mtime;
+		header.size = size;
+		header.hash = hash;
+		header.length = bytecode.size();
+		header.keyLength = key.size();
+
+		// Write to a temporary file of our own first, so other processes never observe a partial
+		// file, even if they are storing the same chunk.
+		std::string temp_path;
+
+		std::FILE* file = internal::openTemporaryFile(path, temp_path);
+		if (!file)
+			return;
+
+		bool written =
+			std::fwrite(&header, sizeof(header), 1, file) == 1
+			&& std::fwrite(key.data(), 1, key.size(), file) == key.size()
+			&& std::fwrite(bytecode.data(), 1, bytecode.size(), file) == bytecode.size();
+
+		if (std::fclose(file) == 0 && written)
+			std::rename(temp_path.c_str(), path.c_str());
+		else
+			std::remove(temp_path.c_str());
+	}
+};
+
+LUWRA_NS_END
+
+#endif
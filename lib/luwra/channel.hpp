@@ -0,0 +1,551 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_CHANNEL_H_
+#define LUWRA_CHANNEL_H_
+
+#include "common.hpp"
+#include "mapping.hpp"
+#include "serialize.hpp"
+
+#ifdef LUWRA_HAS_MMAP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <new>
+#include <string>
+
+#ifdef __linux__
+	#include <linux/futex.h>
+	#include <sys/syscall.h>
+#endif
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	static
+	const char channelMagic[8] = {'L', 'u', 'w', 'r', 'a', 'C', 'H', 1};
+
+	// Magic as it is stored in the channel header
+	inline
+	uint64_t channelMagicWord() {
+		uint64_t word;
+		std::memcpy(&word, channelMagic, sizeof(word));
+
+		return word;
+	}
+
+	// Number of milliseconds to wait for a channel which is being created by another process
+	static
+	const int channelAttachAttempts = 1000;
+
+	// Shared state at the beginning of a channel's memory; the ring buffer follows it. Producer
+	// and consumer fields live on separate cache lines.
+	struct ChannelHeader {
+		// Written last by the creator, see 'channelMagicWord'
+		std::atomic<uint64_t> magic;
+		uint64_t capacity;
+
+		// Written by the producer
+		alignas(64) std::atomic<uint64_t> head;
+		std::atomic<uint32_t> dataSignal;
+		std::atomic<uint32_t> consumerWaiting;
+
+		// Written by the consumer
+		alignas(64) std::atomic<uint64_t> tail;
+		std::atomic<uint32_t> spaceSignal;
+		std::atomic<uint32_t> producerWaiting;
+
+		inline
+		ChannelHeader(uint64_t capacity):
+			magic(0),
+			capacity(capacity),
+			head(0),
+			dataSignal(0),
+			consumerWaiting(0),
+			tail(0),
+			spaceSignal(0),
+			producerWaiting(0)
+		{}
+	};
+
+	// Block while 'signal' still has the value 'expected', at most for 'timeout' (if not null).
+	inline
+	void waitSignal(std::atomic<uint32_t>& signal, uint32_t expected, const timespec* timeout) {
+#ifdef __linux__
+		// Not FUTEX_PRIVATE_FLAG, because the word is shared between processes
+		syscall(SYS_futex, &signal, FUTEX_WAIT, expected, timeout, nullptr, 0);
+#else
+		// Fall back to polling
+		(void) signal;
+		(void) expected;
+		(void) timeout;
+
+		timespec pause {0, 50000};
+		nanosleep(&pause, nullptr);
+#endif
+	}
+
+	// Wake a process which is blocked in 'waitSignal'.
+	inline
+	void wakeSignal(std::atomic<uint32_t>& signal) {
+#ifdef __linux__
+		syscall(SYS_futex, &signal, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#else
+		(void) signal;
+#endif
+	}
+
+	// Block until 'ready' returns true or the timeout (in milliseconds, negative means none)
+	// elapses. The other side increments 'signal' and wakes us if 'waiting' is set.
+	template <typename Condition> inline
+	bool blockUntil(
+		std::atomic<uint32_t>& signal,
+		std::atomic<uint32_t>& waiting,
+		Condition ready,
+		long timeout
+	) {
+		if (ready())
+			return true;
+
+		timespec deadline;
+		if (timeout >= 0) {
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+			deadline.tv_sec += timeout / 1000;
+			deadline.tv_nsec += (timeout % 1000) * 1000000;
+
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+		}
+
+		for (;;) {
+			waiting.store(1);
+			uint32_t expected = signal.load();
+
+			if (ready()) {
+				waiting.store(0);
+				return true;
+			}
+
+			timespec remaining;
+			if (timeout >= 0) {
+				timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+
+				remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+				remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+
+				if (remaining.tv_nsec < 0) {
+					remaining.tv_sec--;
+					remaining.tv_nsec += 1000000000;
+				}
+
+				if (remaining.tv_sec < 0) {
+					waiting.store(0);
+					return ready();
+				}
+			}
+
+			waitSignal(signal, expected, timeout >= 0 ? &remaining : nullptr);
+			waiting.store(0);
+
+			if (ready())
+				return true;
+		}
+	}
+}
+
+/// Channel for Lua values between processes, backed by a ring buffer in shared memory. Values are
+/// serialized using @ref serialize, hence the same restrictions apply.
+///
+/// There must be only one sending and one receiving side at a time, e.g. a parent process and a
+/// forked child, or two processes which open the same named channel. Neither side takes a lock.
+/// A blocked side sleeps on a futex and is only woken (using a system call) when it actually
+/// sleeps; on systems other than Linux it polls instead.
+///
+/// Received values must not contain functions, because their bytecode would be loaded without
+/// verification (see @ref deserialize).
+///
+/// Example:
+///
+/// ```
+///   Channel channel(1 << 20);
+///
+///   if (fork() == 0) {
+///       channel.send(child_state, -1);
+///       _exit(0);
+///   }
+///
+///   channel.receive(parent_state);
+/// ```
+struct Channel {
+	/// Create an anonymous channel. It can be shared with child processes created using `fork`, or
+	/// with other processes by passing its file descriptor (see @ref attach).
+	///
+	/// \param capacity Size of the ring buffer in bytes; it is rounded up to a power of two
+	explicit inline
+	Channel(size_t capacity) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+		int fd = static_cast<int>(syscall(SYS_memfd_create, "luwra-channel", 0));
+#else
+		std::string name = "/luwra-channel-" + std::to_string(getpid()) + "-"
+		                   + std::to_string(uintptr_t(this));
+
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd >= 0)
+			shm_unlink(name.c_str());
+#endif
+
+		if (fd >= 0)
+			initialize(fd, capacity);
+	}
+
+	/// Create a named channel or open it if it already exists. Named channels persist until they
+	/// are removed using @ref remove.
+	///
+	/// \param name     Name of the shared memory object, e.g. `/worker-1`
+	/// \param capacity Size of the ring buffer in bytes if the channel is created
+	inline
+	Channel(const char* name, size_t capacity) {
+		int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+		if (fd >= 0)
+			initialize(fd, capacity);
+		else if (errno == EEXIST && (fd = shm_open(name, O_RDWR, 0600)) >= 0)
+			attachTo(fd);
+	}
+
+	inline
+	Channel(Channel&& other):
+		fd(other.fd),
+		header(other.header),
+		ring(other.ring),
+		mask(other.mask),
+		mappingSize(other.mappingSize),
+		buffer(std::move(other.buffer))
+	{
+		other.fd = -1;
+		other.header = nullptr;
+		other.ring = nullptr;
+	}
+
+	Channel(const Channel&) = delete;
+	Channel& operator =(const Channel&) = delete;
+
+	inline
+	~Channel() {
+		if (header)
+			munmap(header, mappingSize);
+
+		if (fd >= 0)
+			close(fd);
+	}
+
+	/// Open the channel behind a file descriptor, which has been obtained from another channel's
+	/// @ref fileDescriptor. The file descriptor is duplicated.
+	static inline
+	Channel attach(int fd) {
+		Channel channel;
+
+		int duplicate = dup(fd);
+		if (duplicate >= 0)
+			channel.attachTo(duplicate);
+
+		return channel;
+	}
+
+	/// Remove a named channel. Processes which have opened it can continue to use it.
+	static inline
+	void remove(const char* name) {
+		shm_unlink(name);
+	}
+
+	/// Check whether the channel has been set up successfully.
+	inline
+	bool isValid() const {
+		return header != nullptr;
+	}
+
+	/// File descriptor of the shared memory
+	inline
+	int fileDescriptor() const {
+		return fd;
+	}
+
+	/// Size of the ring buffer in bytes
+	inline
+	size_t capacity() const {
+		return mask + 1;
+	}
+
+	/// Serialize the value at the given index and put it into the channel. Blocks while there is
+	/// not enough space for it.
+	///
+	/// \param state Lua state
+	/// \param index Index of the value
+	/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+	///          stack
+	inline
+	int send(State* state, int index) {
+		buffer.clear();
+
+		int status = serialize(state, index, buffer);
+		if (status != LUA_OK)
+			return status;
+
+		if (buffer.size() + sizeof(uint32_t) > capacity()) {
+			lua_pushstring(state, "message is too large for the channel");
+			return LUA_ERRRUN;
+		}
+
+		uint64_t needed = sizeof(uint32_t) + buffer.size();
+		uint64_t head = header->head.load(std::memory_order_relaxed);
+
+		internal::ChannelHeader* shared = header;
+		uint64_t size = capacity();
+
+		internal::blockUntil(
+			header->spaceSignal,
+			header->producerWaiting,
+			[shared, head, needed, size]() {
+				return size - (head - shared->tail.load()) >= needed;
+			},
+			-1
+		);
+
+		uint32_t length = static_cast<uint32_t>(buffer.size());
+		copyIn(head, &length, sizeof(length));
+		copyIn(head + sizeof(length), buffer.data(), buffer.size());
+
+		header->head.store(head + needed);
+		notify(header->dataSignal, header->consumerWaiting);
+
+		return LUA_OK;
+	}
+
+	/// Check whether a value can be received without blocking.
+	inline
+	bool poll() const {
+		return header->head.load() != header->tail.load(std::memory_order_relaxed);
+	}
+
+	/// Wait until a value can be received.
+	///
+	/// \param timeout Maximum time to wait in milliseconds; negative values mean no limit
+	/// \returns `true` if a value can be received
+	inline
+	bool wait(long timeout = -1) const {
+		const Channel* self = this;
+
+		return internal::blockUntil(
+			header->dataSignal,
+			header->consumerWaiting,
+			[self]() { return self->poll(); },
+			timeout
+		);
+	}
+
+	/// Take the next value from the channel and push it. Blocks while the channel is empty.
+	///
+	/// Values which are stored contiguously in the ring buffer are deserialized straight from the
+	/// shared memory.
+	///
+	/// \param state Lua state
+	/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+	///          stack
+	inline
+	int receive(State* state) {
+		wait();
+
+		uint64_t tail = header->tail.load(std::memory_order_relaxed);
+		uint64_t available = header->head.load() - tail;
+
+		uint32_t length = 0;
+		if (available >= sizeof(length))
+			copyOut(tail, &length, sizeof(length));
+
+		// Do not trust the other side to have written a sensible length
+		if (
+			available < sizeof(length)
+			|| available > capacity()
+			|| length > available - sizeof(length)
+		) {
+			header->tail.store(tail + available);
+			notify(header->spaceSignal, header->producerWaiting);
+
+			lua_pushstring(state, "received a malformed message");
+			return LUA_ERRRUN;
+		}
+
+		size_t offset = static_cast<size_t>((tail + sizeof(length)) & mask);
+		int status;
+
+		if (offset + length <= capacity()) {
+			internal::MemorySource source(ring + offset, length);
+			status = deserialize(state, source);
+		} else {
+			buffer.resize(length);
+			copyOut(tail + sizeof(length), &buffer[0], length);
+
+			status = deserialize(state, buffer.data(), length);
+		}
+
+		header->tail.store(tail + sizeof(length) + length);
+		notify(header->spaceSignal, header->producerWaiting);
+
+		return status;
+	}
+
+private:
+	int fd = -1;
+	internal::ChannelHeader* header = nullptr;
+	char* ring = nullptr;
+	uint64_t mask = 0;
+	size_t mappingSize = 0;
+
+	// Output of 'serialize' and input for values which wrap around the end of the ring buffer
+	std::string buffer;
+
+	inline
+	Channel() {}
+
+	static inline
+	size_t headerSize() {
+		size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		return (sizeof(internal::ChannelHeader) + page - 1) / page * page;
+	}
+
+	// Map the shared memory of the given size. Takes ownership of the file descriptor.
+	inline
+	bool map(int fd, size_t size) {
+		void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+		if (mapping == MAP_FAILED) {
+			close(fd);
+			return false;
+		}
+
+		this->fd = fd;
+		header = static_cast<internal::ChannelHeader*>(mapping);
+		ring = static_cast<char*>(mapping) + headerSize();
+		mappingSize = size;
+
+		return true;
+	}
+
+	inline
+	void initialize(int fd, size_t capacity) {
+		size_t size = 4096;
+		while (size < capacity)
+			size <<= 1;
+
+		if (ftruncate(fd, static_cast<off_t>(headerSize() + size)) != 0) {
+			close(fd);
+			return;
+		}
+
+		if (map(fd, headerSize() + size)) {
+			new (header) internal::ChannelHeader(size);
+			mask = size - 1;
+
+			// Processes which open the channel in the meantime wait for this
+			header->magic.store(internal::channelMagicWord(), std::memory_order_release);
+		}
+	}
+
+	// Another process may have created the channel but not yet set its size or its header.
+	inline
+	void attachTo(int fd) {
+		timespec pause {0, 1000000};
+		struct stat info;
+
+		for (int attempt = 0;; attempt++) {
+			if (fstat(fd, &info) != 0 || attempt == internal::channelAttachAttempts) {
+				close(fd);
+				return;
+			}
+
+			if (static_cast<size_t>(info.st_size) > headerSize())
+				break;
+
+			nanosleep(&pause, nullptr);
+		}
+
+		size_t size = static_cast<size_t>(info.st_size);
+		if (!map(fd, size))
+			return;
+
+		uint64_t magic = internal::channelMagicWord();
+
+		for (int attempt = 0; header->magic.load(std::memory_order_acquire) != magic; attempt++) {
+			if (attempt == internal::channelAttachAttempts) {
+				unmap();
+				return;
+			}
+
+			nanosleep(&pause, nullptr);
+		}
+
+		uint64_t capacity = size - headerSize();
+
+		if (header->capacity != capacity || (capacity & (capacity - 1)) != 0) {
+			unmap();
+			return;
+		}
+
+		mask = capacity - 1;
+	}
+
+	inline
+	void unmap() {
+		munmap(header, mappingSize);
+		close(fd);
+
+		fd = -1;
+		header = nullptr;
+		ring = nullptr;
+	}
+
+	inline
+	void copyIn(uint64_t position, const void* data, size_t length) {
+		size_t offset = static_cast<size_t>(position & mask);
+		size_t first = std::min(length, capacity() - offset);
+
+		std::memcpy(ring + offset, data, first);
+		std::memcpy(ring, static_cast<const char*>(data) + first, length - first);
+	}
+
+	inline
+	void copyOut(uint64_t position, void* data, size_t length) const {
+		size_t offset = static_cast<size_t>(position & mask);
+		size_t first = std::min(length, capacity() - offset);
+
+		std::memcpy(data, ring + offset, first);
+		std::memcpy(static_cast<char*>(data) + first, ring, length - first);
+	}
+
+	static inline
+	void notify(std::atomic<uint32_t>& signal, std::atomic<uint32_t>& waiting) {
+		signal.fetch_add(1);
+
+		if (waiting.load())
+			internal::wakeSignal(signal);
+	}
+};
+
+LUWRA_NS_END
+
+#endif
+
+#endif
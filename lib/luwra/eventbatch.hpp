@@ -0,0 +1,219 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_EVENTBATCH_H_
+#define LUWRA_EVENTBATCH_H_
+
+#include "common.hpp"
+#include "values.hpp"
+#include "stack.hpp"
+#include "types/function.hpp"
+#include "types/stl.hpp"
+
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+LUWRA_NS_BEGIN
+
+/// How an @ref EventBatch hands its events to the handler
+enum EventDelivery {
+	/// The handler receives the number of events followed by one array per event parameter,
+	/// i.e. `handler(count, firsts, seconds, ...)`.
+	DeliverTable,
+
+	/// The handler receives an iterator and the number of events, i.e. `handler(events, count)`.
+	/// Each step of `for i, first, second, ... in events do ... end` yields the index and the
+	/// parameters of an event. No tables are created. The iterator must not be used after the
+	/// handler has returned.
+	DeliverIterator
+};
+
+/// Collects events in C++ and delivers them to a Lua handler in a single call, instead of calling
+/// the handler once per event.
+///
+/// Example:
+///
+/// ```
+///   EventBatch<std::string, double> ticks(state.get<Function<void>>("onTicks"));
+///
+///   for (const Quote& quote: quotes)
+///       ticks.add(quote.symbol, quote.price);
+///
+///   ticks.flush();
+/// ```
+///
+/// The handler in the example could look like this:
+///
+/// ```
+///   function onTicks(count, symbols, prices)
+///     for i = 1, count do
+///       record(symbols[i], prices[i])
+///     end
+///   end
+/// ```
+///
+/// The parameters are stored as their decayed types until they are delivered. Pointers, e.g.
+/// `const char*`, must remain valid until then.
+///
+/// \tparam Args Parameters of an event
+template <typename... Args>
+struct EventBatch {
+	static_assert(sizeof...(Args) > 0, "Events need at least one parameter");
+
+	/// Stored form of an event
+	using Event = std::tuple<typename std::decay<Args>::type...>;
+
+	/// Handler which receives the events
+	Function<void> handler;
+
+	/// Create a batch for a handler.
+	///
+	/// \param handler  Receives the events
+	/// \param delivery How the events are passed to the handler
+	/// \param limit    Number of events after which the batch is delivered automatically;
+	///                 0 means the batch is only delivered by @ref flush
+	inline
+	EventBatch(const Function<void>& handler, EventDelivery delivery = DeliverTable, size_t limit = 0):
+		handler(handler),
+		delivery(delivery),
+		limit(limit)
+	{
+		if (limit > 0)
+			events.reserve(limit);
+	}
+
+	/// Append an event. Delivers the batch if it has reached its limit.
+	///
+	/// \param args Parameters of the event
+	/// \returns Result of @ref flush if the batch has been delivered, otherwise `LUA_OK`
+	template <typename... Values> inline
+	int add(Values&&... args) {
+		events.emplace_back(std::forward<Values>(args)...);
+
+		if (limit > 0 && events.size() >= limit)
+			return flush();
+
+		return LUA_OK;
+	}
+
+	/// Deliver the collected events in protected mode. The batch is empty afterwards, even if the
+	/// handler fails. Nothing is called if there are no events.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of `lua_pcall` with the error object
+	///          on top of the stack
+	inline
+	int flush() {
+		if (events.empty())
+			return LUA_OK;
+
+		State* state = handler.ref.life->state;
+		int status;
+
+		handler.ref.life->push();
+
+		if (delivery == DeliverIterator)
+			status = deliverIterator(state);
+		else
+			status = deliverTable(state);
+
+		// Keep the storage for the next batch
+		events.clear();
+
+		return status;
+	}
+
+	/// Number of collected events
+	inline
+	size_t size() const {
+		return events.size();
+	}
+
+	/// Discard the collected events.
+	inline
+	void clear() {
+		events.clear();
+	}
+
+private:
+	EventDelivery delivery;
+	size_t limit;
+
+	std::vector<Event> events;
+
+	// Expects the handler on top of the stack.
+	inline
+	int deliverTable(State* state) {
+		const int columns = static_cast<int>(sizeof...(Args));
+		int count = static_cast<int>(events.size());
+
+		lua_pushinteger(state, count);
+
+		int base = lua_gettop(state);
+
+		for (int i = 0; i < columns; i++)
+			lua_createtable(state, count, 0);
+
+		for (int i = 0; i < count; i++) {
+			pushReturn(state, events[i]);
+
+			// The last parameter is on top
+			for (int column = columns; column > 0; column--)
+				lua_rawseti(state, base + column, i + 1);
+		}
+
+		return lua_pcall(state, columns + 1, 0, 0);
+	}
+
+	// Expects the handler on top of the stack.
+	inline
+	int deliverIterator(State* state) {
+		lua_pushlightuserdata(state, this);
+		lua_pushinteger(state, 0);
+		lua_pushcclosure(state, &EventBatch::iterate, 2);
+
+		// Keep the iterator, so that it can be detached from the batch afterwards
+		lua_pushvalue(state, -1);
+		lua_insert(state, -3);
+
+		lua_pushinteger(state, static_cast<lua_Integer>(events.size()));
+
+		int status = lua_pcall(state, 2, 0, 0);
+
+		// Below the error object if the call has failed
+		int iterator = status == LUA_OK ? -1 : -2;
+
+		lua_pushnil(state);
+		lua_setupvalue(state, iterator - 1, 1);
+
+		lua_remove(state, iterator);
+		return status;
+	}
+
+	static inline
+	int iterate(State* state) {
+		EventBatch* batch = static_cast<EventBatch*>(lua_touserdata(state, lua_upvalueindex(1)));
+
+		if (!batch)
+			return luaL_error(state, "events cannot be iterated after the handler has returned");
+
+		lua_Integer position = lua_tointeger(state, lua_upvalueindex(2));
+
+		if (position >= static_cast<lua_Integer>(batch->events.size()))
+			return 0;
+
+		lua_pushinteger(state, position + 1);
+		lua_pushvalue(state, -1);
+		lua_replace(state, lua_upvalueindex(2));
+
+		return 1 + static_cast<int>(pushReturn(state, batch->events[position]));
+	}
+};
+
+LUWRA_NS_END
+
+#endif
@@ -0,0 +1,475 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_EVENTLOOP_H_
+#define LUWRA_EVENTLOOP_H_
+
+#include "common.hpp"
+#include "values.hpp"
+#include "stack.hpp"
+#include "types/function.hpp"
+
+#if defined(__linux__)
+	#define LUWRA_HAS_EPOLL
+
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <sys/timerfd.h>
+	#include <unistd.h>
+#endif
+
+#ifdef LUWRA_HAS_EPOLL
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Maximum number of events which are retrieved by one call to 'epoll_wait'
+	#define LUWRA_EVENTLOOP_BATCH_SIZE 64
+}
+
+/// Readiness which an @ref EventLoop watches for
+enum EventMask {
+	EventReadable = 1,
+	EventWritable = 2
+};
+
+/// Event loop which dispatches file descriptor readiness and timers to Lua callbacks. It is built
+/// on `epoll`, `timerfd` and `eventfd` and therefore only available on Linux.
+///
+/// Callbacks are called in protected mode. All events which one `epoll_wait` returns are
+/// dispatched before the loop waits again. Only @ref wake and @ref stop may be used from other
+/// threads.
+///
+/// Example:
+///
+/// ```
+///   EventLoop loop(state);
+///   loop.pushModule();
+///   lua_setglobal(state, "events");
+///
+///   state.runString(
+///       "events.watch(fd, 'r', function (fd, readable, writable) ... end)\n"
+///       "local timer = events.every(100, function () ... end)\n"
+///       "events.after(1000, function () events.cancel(timer) end)"
+///   );
+///
+///   loop.run();
+/// ```
+struct EventLoop {
+	/// Identifies a watcher or a timer; 0 indicates failure
+	using Handle = uint64_t;
+
+	/// Create an event loop for the given state.
+	inline
+	EventLoop(State* state):
+		state(state),
+		pollFD(epoll_create1(EPOLL_CLOEXEC)),
+		wakeFD(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+	{
+		if (pollFD >= 0 && wakeFD >= 0) {
+			struct epoll_event event;
+			std::memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN;
+			event.data.u64 = 0;
+
+			epoll_ctl(pollFD, EPOLL_CTL_ADD, wakeFD, &event);
+		}
+	}
+
+	EventLoop(const EventLoop&) = delete;
+	EventLoop& operator =(const EventLoop&) = delete;
+
+	/// Release the timers and callbacks. Watched file descriptors are not closed.
+	inline
+	~EventLoop() {
+		for (auto& entry: entries) {
+			if (entry.second.timer)
+				close(entry.second.fd);
+		}
+
+		if (pollFD >= 0)
+			close(pollFD);
+
+		if (wakeFD >= 0)
+			close(wakeFD);
+	}
+
+	/// Check whether the loop could be set up.
+	inline
+	bool isValid() const {
+		return pollFD >= 0 && wakeFD >= 0;
+	}
+
+	/// Call a function whenever a file descriptor becomes ready. The callback receives the file
+	/// descriptor and whether it is readable and writable. A file descriptor can only be watched
+	/// once; watching it again replaces the previous watcher.
+	///
+	/// \param fd       File descriptor
+	/// \param events   Combination of @ref EventMask values
+	/// \param callback Callback
+	/// \returns Handle of the watcher or 0 on failure
+	inline
+	Handle watch(int fd, int events, const Function<void>& callback) {
+		unwatch(fd);
+
+		Handle handle = ++lastHandle;
+
+		struct epoll_event event;
+		std::memset(&event, 0, sizeof(event));
+		event.events = 0;
+
+		if (events & EventReadable)
+			event.events |= EPOLLIN;
+
+		if (events & EventWritable)
+			event.events |= EPOLLOUT;
+		event.data.u64 = handle;
+
+		if (epoll_ctl(pollFD, EPOLL_CTL_ADD, fd, &event) != 0)
+			return 0;
+
+		entries.emplace(handle, Entry {fd, false, false, callback});
+		watchers[fd] = handle;
+
+		return handle;
+	}
+
+	/// Stop watching a file descriptor.
+	///
+	/// \returns `true` if the file descriptor has been watched
+	inline
+	bool unwatch(int fd) {
+		std::unordered_map<int, Handle>::iterator it = watchers.find(fd);
+		if (it == watchers.end())
+			return false;
+
+		epoll_ctl(pollFD, EPOLL_CTL_DEL, fd, nullptr);
+
+		entries.erase(it->second);
+		watchers.erase(it);
+
+		return true;
+	}
+
+	/// Call a function once after the given delay, or periodically.
+	///
+	/// \param milliseconds Delay
+	/// \param callback     Callback
+	/// \param repeat       Whether the delay is also the interval
+	/// \returns Handle of the timer or 0 on failure
+	inline
+	Handle addTimer(long milliseconds, const Function<void>& callback, bool repeat = false) {
+		int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		if (fd < 0)
+			return 0;
+
+		// A zero value would disarm the timer
+		if (milliseconds <= 0)
+			milliseconds = 1;
+
+		struct itimerspec spec;
+		spec.it_value.tv_sec = milliseconds / 1000;
+		spec.it_value.tv_nsec = (milliseconds % 1000) * 1000000;
+		spec.it_interval = repeat ? spec.it_value : timespec {0, 0};
+
+		Handle handle = ++lastHandle;
+
+		struct epoll_event event;
+		std::memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.u64 = handle;
+
+		if (
+			timerfd_settime(fd, 0, &spec, nullptr) != 0
+			|| epoll_ctl(pollFD, EPOLL_CTL_ADD, fd, &event) != 0
+		) {
+			close(fd);
+			return 0;
+		}
+
+		entries.emplace(handle, Entry {fd, true, repeat, callback});
+
+		return handle;
+	}
+
+	/// Cancel a timer.
+	///
+	/// \returns `true` if the timer has been pending
+	inline
+	bool cancelTimer(Handle handle) {
+		std::unordered_map<Handle, Entry>::iterator it = entries.find(handle);
+		if (it == entries.end() || !it->second.timer)
+			return false;
+
+		// Closing the file descriptor removes it from the epoll instance
+		close(it->second.fd);
+		entries.erase(it);
+
+		return true;
+	}
+
+	/// Interrupt a blocking @ref runOnce. It may be called from any thread.
+	inline
+	void wake() {
+		uint64_t value = 1;
+		ssize_t written = ::write(wakeFD, &value, sizeof(value));
+		(void) written;
+	}
+
+	/// Make @ref run return after the current batch, or right away if it is not running. It may be
+	/// called from any thread.
+	inline
+	void stop() {
+		stopping.store(true);
+		wake();
+	}
+
+	/// Wait for events and dispatch them.
+	///
+	/// \param timeout Maximum time to wait in milliseconds, -1 waits indefinitely
+	/// \returns `LUA_OK` if all callbacks succeeded, otherwise the status of the first one which
+	///          has failed with its error message on top of the stack
+	inline
+	int runOnce(int timeout = -1) {
+		struct epoll_event events[LUWRA_EVENTLOOP_BATCH_SIZE];
+		int count = epoll_wait(pollFD, events, LUWRA_EVENTLOOP_BATCH_SIZE, timeout);
+
+		int status = LUA_OK;
+
+		for (int i = 0; i < count; i++) {
+			int result = dispatch(events[i]);
+
+			if (result == LUA_OK)
+				continue;
+
+			// Keep the first error only
+			if (status == LUA_OK)
+				status = result;
+			else
+				lua_pop(state, 1);
+		}
+
+		return status;
+	}
+
+	/// Dispatch events until @ref stop is called, a callback fails or nothing is left to watch.
+	///
+	/// \returns `LUA_OK` or the status of the callback which has failed with its error message on
+	///          top of the stack
+	inline
+	int run() {
+		// Consume the request to stop, so that the next call runs again
+		while (!stopping.exchange(false) && !entries.empty()) {
+			int status = runOnce();
+
+			if (status != LUA_OK)
+				return status;
+		}
+
+		return LUA_OK;
+	}
+
+	/// Number of watchers and timers
+	inline
+	size_t size() const {
+		return entries.size();
+	}
+
+	/// Push a table with functions which operate on this loop onto the stack. The loop must
+	/// outlive the functions.
+	///
+	/// - `watch(fd, mode, callback)` watches a file descriptor, `mode` contains `r` and/or `w`
+	/// - `unwatch(fd)` stops watching a file descriptor
+	/// - `after(milliseconds, callback)` and `every(milliseconds, callback)` return a timer
+	/// - `cancel(timer)` cancels a timer
+	/// - `stop()` makes @ref run return
+	///
+	/// \returns Number of pushed values
+	inline
+	int pushModule() {
+		lua_createtable(state, 0, 6);
+
+		pushMethod<&EventLoop::luaWatch>();
+		lua_setfield(state, -2, "watch");
+
+		pushMethod<&EventLoop::luaUnwatch>();
+		lua_setfield(state, -2, "unwatch");
+
+		pushMethod<&EventLoop::luaAfter>();
+		lua_setfield(state, -2, "after");
+
+		pushMethod<&EventLoop::luaEvery>();
+		lua_setfield(state, -2, "every");
+
+		pushMethod<&EventLoop::luaCancel>();
+		lua_setfield(state, -2, "cancel");
+
+		pushMethod<&EventLoop::luaStop>();
+		lua_setfield(state, -2, "stop");
+
+		return 1;
+	}
+
+private:
+	struct Entry {
+		int fd;
+		bool timer;
+		bool repeat;
+		Function<void> callback;
+	};
+
+	State* state;
+	int pollFD;
+	int wakeFD;
+
+	std::unordered_map<Handle, Entry> entries;
+	std::unordered_map<int, Handle> watchers;
+	Handle lastHandle = 0;
+
+	std::atomic<bool> stopping {false};
+
+	inline
+	int dispatch(const struct epoll_event& event) {
+		if (event.data.u64 == 0) {
+			uint64_t value;
+			ssize_t received = ::read(wakeFD, &value, sizeof(value));
+			(void) received;
+
+			return LUA_OK;
+		}
+
+		// Entries which a previous callback of this batch has removed are skipped
+		std::unordered_map<Handle, Entry>::iterator it = entries.find(event.data.u64);
+		if (it == entries.end())
+			return LUA_OK;
+
+		if (!it->second.timer) {
+			// Copy the callback, since it may remove its own watcher
+			Function<void> callback = it->second.callback;
+
+			return callback.pcall(
+				it->second.fd,
+				(event.events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+				(event.events & (EPOLLOUT | EPOLLERR)) != 0
+			);
+		}
+
+		uint64_t expirations;
+		if (::read(it->second.fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+			return LUA_OK;
+
+		Function<void> callback = it->second.callback;
+
+		// One-shot timers are gone before their callback runs
+		if (!it->second.repeat) {
+			close(it->second.fd);
+			entries.erase(it);
+		}
+
+		return callback.pcall();
+	}
+
+	using Method = int (EventLoop::*)(State*);
+
+	template <Method method> static inline
+	int invokeMethod(State* state) {
+		EventLoop* loop = static_cast<EventLoop*>(lua_touserdata(state, lua_upvalueindex(1)));
+		return (loop->*method)(state);
+	}
+
+	template <Method method> inline
+	void pushMethod() {
+		lua_pushlightuserdata(state, this);
+		lua_pushcclosure(state, &EventLoop::invokeMethod<method>, 1);
+	}
+
+	// Reference a callback from the loop's state, because the calling thread may be a coroutine
+	// which does not live as long as the callback.
+	inline
+	Function<void> referenceCallback(State* thread, int index) {
+		lua_pushvalue(thread, index);
+		lua_xmove(thread, state, 1);
+
+		Function<void> callback(state, -1);
+		lua_pop(state, 1);
+
+		return callback;
+	}
+
+	inline
+	int luaWatch(State* state) {
+		int fd = static_cast<int>(luaL_checkinteger(state, 1));
+		const char* mode = luaL_checkstring(state, 2);
+		luaL_checktype(state, 3, LUA_TFUNCTION);
+
+		int events = 0;
+		if (std::strchr(mode, 'r'))
+			events |= EventReadable;
+		if (std::strchr(mode, 'w'))
+			events |= EventWritable;
+
+		bool success = watch(fd, events, referenceCallback(state, 3)) != 0;
+
+		if (!success)
+			return luaL_error(state, "cannot watch file descriptor %d", fd);
+
+		return 0;
+	}
+
+	inline
+	int luaUnwatch(State* state) {
+		lua_pushboolean(state, unwatch(static_cast<int>(luaL_checkinteger(state, 1))));
+		return 1;
+	}
+
+	inline
+	int luaAddTimer(State* state, bool repeat) {
+		long milliseconds = static_cast<long>(luaL_checknumber(state, 1));
+		luaL_checktype(state, 2, LUA_TFUNCTION);
+
+		Handle handle = addTimer(milliseconds, referenceCallback(state, 2), repeat);
+
+		if (handle == 0)
+			return luaL_error(state, "cannot create timer");
+
+		lua_pushnumber(state, static_cast<lua_Number>(handle));
+		return 1;
+	}
+
+	inline
+	int luaAfter(State* state) {
+		return luaAddTimer(state, false);
+	}
+
+	inline
+	int luaEvery(State* state) {
+		return luaAddTimer(state, true);
+	}
+
+	inline
+	int luaCancel(State* state) {
+		lua_pushboolean(state, cancelTimer(static_cast<Handle>(luaL_checknumber(state, 1))));
+		return 1;
+	}
+
+	inline
+	int luaStop(State*) {
+		stop();
+		return 0;
+	}
+};
+
+LUWRA_NS_END
+
+#endif
+
+#endif
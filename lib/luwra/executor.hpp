@@ -0,0 +1,538 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_EXECUTOR_H_
+#define LUWRA_EXECUTOR_H_
+
+#include "common.hpp"
+#include "state.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+LUWRA_NS_BEGIN
+
+/// Activity of a worker in an @ref ExecutorPool
+struct WorkerStats {
+	/// Number of jobs which have been executed
+	size_t executed;
+
+	/// Number of those jobs which have been taken from another worker's queue
+	size_t stolen;
+
+	/// Number of jobs which are waiting in the worker's queue
+	size_t queued;
+
+	/// Time spent executing jobs
+	std::chrono::nanoseconds busy;
+};
+
+/// Thread pool in which every worker owns a state. Use it to spread the execution of scripts
+/// across multiple cores.
+///
+/// Every worker prepares its state once using the initializer, on its own thread. Jobs receive the
+/// state of the worker which executes them; states are not reset between jobs. Each worker has its
+/// own queue. Jobs that are submitted from within a job go to the current worker's queue; others
+/// are distributed round-robin. Idle workers steal jobs from the queues of busy workers.
+///
+/// Example:
+///
+/// ```
+///   ExecutorPool pool(std::thread::hardware_concurrency(), [](StateWrapper& state) {
+///       state.loadStandardLibrary();
+///       state.runFile("handler.lua");
+///   });
+///
+///   std::future<int> status = pool.submit([](StateWrapper& state) {
+///       return state.runString("handle()");
+///   });
+/// ```
+struct ExecutorPool {
+	/// Prepares the state of a worker
+	using Initializer = std::function<void (StateWrapper&)>;
+
+	/// Create a pool with the given number of workers.
+	inline
+	ExecutorPool(size_t size, const Initializer& init = Initializer()):
+		init(init)
+	{
+		if (size == 0)
+			size = 1;
+
+		workers.reserve(size);
+
+		for (size_t i = 0; i < size; i++)
+			workers.emplace_back(new Worker);
+
+		for (size_t i = 0; i < size; i++)
+			workers[i]->thread = std::thread(&ExecutorPool::run, this, i);
+	}
+
+	ExecutorPool(const ExecutorPool&) = delete;
+	ExecutorPool& operator =(const ExecutorPool&) = delete;
+
+	/// Wait until all submitted jobs have been executed, then stop the workers.
+	inline
+	~ExecutorPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wake.notify_all();
+
+		for (std::unique_ptr<Worker>& worker: workers)
+			worker->thread.join();
+	}
+
+	/// Queue a job. The job is invoked with the state of the worker which executes it.
+	///
+	/// \param job Callable with the signature `R (StateWrapper&)`
+	/// \returns Future which receives the job's result or the exception it has thrown
+	template <typename Callable> inline
+	std::future<typename std::result_of<Callable(StateWrapper&)>::type> submit(Callable&& job) {
+		using Result = typename std::result_of<Callable(StateWrapper&)>::type;
+
+		std::shared_ptr<std::packaged_task<Result (StateWrapper&)>> task =
+			std::make_shared<std::packaged_task<Result (StateWrapper&)>>(std::forward<Callable>(job));
+
+		std::future<Result> result = task->get_future();
+
+		// Prefer the current worker's queue, otherwise distribute evenly
+		size_t index = currentPool() == this
+			? currentWorker()
+			: next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+
+		// Count the job before it becomes visible, so that 'pending' cannot drop below zero
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			pending++;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(workers[index]->mutex);
+			workers[index]->queue.emplace_back([task](StateWrapper& state) { (*task)(state); });
+		}
+
+		wake.notify_one();
+
+		return result;
+	}
+
+	/// Number of workers
+	inline
+	size_t size() const {
+		return workers.size();
+	}
+
+	/// State of the worker which runs the calling thread, if that worker belongs to this pool.
+	/// Jobs which wait for other jobs of the same pool can use it to do the work themselves.
+	///
+	/// \returns `nullptr` if the caller is not a job of this pool
+	inline
+	StateWrapper* currentState() const {
+		return currentPool() == this ? currentWorkerState() : nullptr;
+	}
+
+	/// Retrieve the activity of a worker. A job is accounted for shortly after its future has
+	/// become ready.
+	inline
+	WorkerStats stats(size_t index) const {
+		Worker& worker = *workers[index];
+
+		size_t queued;
+		{
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			queued = worker.queue.size();
+		}
+
+		return {
+			worker.executed.load(),
+			worker.stolen.load(),
+			queued,
+			std::chrono::nanoseconds(worker.busy.load())
+		};
+	}
+
+private:
+	using Job = std::function<void (StateWrapper&)>;
+
+	struct Worker {
+		std::thread thread;
+
+		mutable std::mutex mutex;
+		std::deque<Job> queue;
+
+		std::atomic<size_t> executed {0};
+		std::atomic<size_t> stolen {0};
+		std::atomic<long long> busy {0};
+	};
+
+	Initializer init;
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<size_t> next {0};
+
+	// Guards 'pending' and 'stopping' for sleeping workers
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::atomic<size_t> pending {0};
+	bool stopping = false;
+
+	// Pool and worker index of the current thread
+	static inline
+	ExecutorPool*& currentPool() {
+		static thread_local ExecutorPool* pool = nullptr;
+		return pool;
+	}
+
+	static inline
+	size_t& currentWorker() {
+		static thread_local size_t index = 0;
+		return index;
+	}
+
+	static inline
+	StateWrapper*& currentWorkerState() {
+		static thread_local StateWrapper* state = nullptr;
+		return state;
+	}
+
+	// Take a job from the front of the worker's own queue.
+	inline
+	bool take(size_t index, Job& job) {
+		Worker& worker = *workers[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+
+		if (worker.queue.empty())
+			return false;
+
+		job = std::move(worker.queue.front());
+		worker.queue.pop_front();
+		pending--;
+
+		return true;
+	}
+
+	// Take a job from the back of another worker's queue.
+	inline
+	bool steal(size_t index, Job& job) {
+		for (size_t i = 1; i < workers.size(); i++) {
+			Worker& victim = *workers[(index + i) % workers.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+
+			if (!victim.queue.empty()) {
+				job = std::move(victim.queue.back());
+				victim.queue.pop_back();
+				pending--;
+
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	inline
+	void run(size_t index) {
+		currentPool() = this;
+		currentWorker() = index;
+
+		Worker& worker = *workers[index];
+
+		StateWrapper state;
+		currentWorkerState() = &state;
+
+		if (init)
+			init(state);
+
+		lua_settop(state, 0);
+
+		for (;;) {
+			Job job;
+
+			bool stolen = false;
+			if (!take(index, job)) {
+				if (!steal(index, job)) {
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [this]() { return stopping || pending > 0; });
+
+					if (stopping && pending == 0)
+						return;
+
+					continue;
+				}
+
+				stolen = true;
+			}
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			job(state);
+
+			worker.busy += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start
+			).count();
+
+			worker.executed++;
+
+			if (stolen)
+				worker.stolen++;
+
+			lua_settop(state, 0);
+		}
+	}
+};
+
+// Maximum number of jobs a StateExecutor runs between two garbage collection steps
+#ifndef LUWRA_EXECUTOR_BATCH_SIZE
+	#define LUWRA_EXECUTOR_BATCH_SIZE 64
+#endif
+
+/// Owner of a single state which runs on a dedicated thread. Other threads access the state by
+/// submitting jobs, which the executor runs one after another; no lock around the state is needed.
+///
+/// Submitting a job does not take a lock either: jobs go into a lock-free queue with many
+/// producers and one consumer. The executor drains the queue in batches and performs an
+/// incremental garbage collection step after each batch. It only sleeps (and needs to be woken)
+/// when the queue is empty.
+///
+/// Example:
+///
+/// ```
+///   StateExecutor executor([](StateWrapper& state) {
+///       state.loadStandardLibrary();
+///       state.runString("counter = 0");
+///   });
+///
+///   // From any thread
+///   std::future<int> value = executor.submit([](StateWrapper& state) {
+///       state.runString("counter = counter + 1 return counter");
+///       return state.read<int>(-1);
+///   });
+/// ```
+struct StateExecutor {
+	/// Prepares the state
+	using Initializer = std::function<void (StateWrapper&)>;
+
+	/// Start the executor thread.
+	///
+	/// \param init      Prepares the state, on the executor thread
+	/// \param gc_budget Time which may be spent on garbage collection after each batch; no steps
+	///                  are performed if it is zero
+	inline
+	StateExecutor(
+		const Initializer& init = Initializer(),
+		std::chrono::microseconds gc_budget = std::chrono::microseconds(500)
+	):
+		head(&stub),
+		tail(&stub),
+		gcBudget(gc_budget)
+	{
+		thread = std::thread(&StateExecutor::run, this, init);
+	}
+
+	StateExecutor(const StateExecutor&) = delete;
+	StateExecutor& operator =(const StateExecutor&) = delete;
+
+	/// Wait until all submitted jobs have been executed, then stop the executor thread.
+	inline
+	~StateExecutor() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		wake.notify_one();
+		thread.join();
+	}
+
+	/// Queue a job. It may be called from any thread, including the executor thread.
+	///
+	/// \param job Callable with the signature `R (StateWrapper&)`
+	/// \returns Future which receives the job's result or the exception it has thrown
+	template <typename Callable> inline
+	std::future<typename std::result_of<Callable(StateWrapper&)>::type> submit(Callable&& job) {
+		using Result = typename std::result_of<Callable(StateWrapper&)>::type;
+
+		std::shared_ptr<std::packaged_task<Result (StateWrapper&)>> task =
+			std::make_shared<std::packaged_task<Result (StateWrapper&)>>(std::forward<Callable>(job));
+
+		std::future<Result> result = task->get_future();
+
+		Node* node = new Node;
+		node->job = [task](StateWrapper& state) { (*task)(state); };
+
+		// Count the job before it becomes visible, so that 'pending' cannot drop below zero
+		pending++;
+		push(node);
+
+		if (sleeping.load()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				sleeping = false;
+			}
+
+			wake.notify_one();
+		}
+
+		return result;
+	}
+
+	/// Number of jobs which have been executed
+	inline
+	size_t executed() const {
+		return executedJobs.load();
+	}
+
+	/// Number of jobs which are waiting to be executed
+	inline
+	size_t queued() const {
+		return pending.load();
+	}
+
+private:
+	using Job = std::function<void (StateWrapper&)>;
+
+	struct Node {
+		std::atomic<Node*> next {nullptr};
+		Job job;
+	};
+
+	// Intrusive queue with many producers and one consumer. Producers swap themselves into 'head',
+	// the consumer follows the links starting at 'tail'. 'stub' keeps the list from becoming empty.
+	Node stub;
+	std::atomic<Node*> head;
+	Node* tail;
+
+	std::atomic<size_t> pending {0};
+	std::atomic<size_t> executedJobs {0};
+
+	std::chrono::microseconds gcBudget;
+
+	// Guards 'sleeping' and 'stopping' when the executor is about to sleep
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::atomic<bool> sleeping {false};
+	bool stopping = false;
+
+	std::thread thread;
+
+	inline
+	void push(Node* node) {
+		node->next.store(nullptr, std::memory_order_relaxed);
+
+		Node* previous = head.exchange(node, std::memory_order_acq_rel);
+		previous->next.store(node, std::memory_order_release);
+	}
+
+	// Remove the oldest node. Returns null if the queue is empty or a producer has not finished
+	// linking its node yet.
+	inline
+	Node* pop() {
+		Node* current = tail;
+		Node* next = current->next.load(std::memory_order_acquire);
+
+		if (current == &stub) {
+			if (!next)
+				return nullptr;
+
+			tail = next;
+			current = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if (next) {
+			tail = next;
+			return current;
+		}
+
+		if (current != head.load(std::memory_order_acquire))
+			return nullptr;
+
+		// 'current' is the last node; put the stub behind it, so it can be taken out.
+		push(&stub);
+
+		next = current->next.load(std::memory_order_acquire);
+		if (next) {
+			tail = next;
+			return current;
+		}
+
+		return nullptr;
+	}
+
+	inline
+	void run(Initializer init) {
+		StateWrapper state;
+		if (init)
+			init(state);
+
+		lua_settop(state, 0);
+
+		for (;;) {
+			size_t batch = 0;
+
+			while (batch < LUWRA_EXECUTOR_BATCH_SIZE) {
+				Node* node = pop();
+
+				if (!node) {
+					// A producer is in the middle of 'push'
+					if (pending.load() > 0) {
+						std::this_thread::yield();
+						continue;
+					}
+
+					break;
+				}
+
+				pending--;
+
+				node->job(state);
+				delete node;
+
+				lua_settop(state, 0);
+
+				executedJobs++;
+				batch++;
+			}
+
+			if (batch > 0 && gcBudget.count() > 0)
+				state.gc().step(gcBudget);
+
+			if (pending.load() > 0)
+				continue;
+
+			std::unique_lock<std::mutex> lock(mutex);
+
+			if (stopping)
+				return;
+
+			sleeping = true;
+
+			// Check again, a job may have been submitted before 'sleeping' became visible.
+			if (pending.load() > 0) {
+				sleeping = false;
+				continue;
+			}
+
+			wake.wait(lock, [this]() { return !sleeping.load() || stopping; });
+			sleeping = false;
+		}
+	}
+};
+
+LUWRA_NS_END
+
+#endif
@@ -0,0 +1,182 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_GC_H_
+#define LUWRA_GC_H_
+
+#include "common.hpp"
+
+#include <chrono>
+#include <cstddef>
+
+LUWRA_NS_BEGIN
+
+/// Operating mode of the garbage collector
+enum class GCMode {
+	/// Incremental mode, the default
+	Incremental,
+
+	/// Generational mode, requires Lua 5.2 or 5.4
+	Generational
+};
+
+/// Telemetry of the collections which have been driven through a @ref GarbageCollector
+struct GCStats {
+	/// Number of slots in the latency histogram
+	enum { HistogramSize = 16 };
+
+	/// Number of completed collection cycles
+	size_t cycles = 0;
+
+	/// Number of pauses, i.e. calls to @ref GarbageCollector::step and
+	/// @ref GarbageCollector::collect
+	size_t pauses = 0;
+
+	/// Accumulated duration of all pauses
+	std::chrono::nanoseconds totalPause {0};
+
+	/// Longest pause
+	std::chrono::nanoseconds maxPause {0};
+
+	/// Pauses by duration. Entry `i` counts pauses shorter than `2^i` microseconds, the last entry
+	/// also counts every longer pause.
+	size_t histogram[HistogramSize] = {};
+
+	/// Record a pause.
+	inline
+	void record(std::chrono::nanoseconds pause) {
+		pauses++;
+		totalPause += pause;
+
+		if (pause > maxPause)
+			maxPause = pause;
+
+		size_t index = 0;
+		for (
+			long long limit = 1000;
+			pause.count() >= limit && index + 1 < HistogramSize;
+			limit <<= 1
+		)
+			index++;
+
+		histogram[index]++;
+	}
+};
+
+/// Controls the garbage collector of a Lua state and records how long it pauses the state.
+///
+/// Only the work which is triggered through this interface is measured; the steps which Lua
+/// performs automatically during allocations are not visible to it.
+struct GarbageCollector {
+	using Clock = std::chrono::steady_clock;
+
+	/// Lua state
+	State* state;
+
+	/// Telemetry
+	GCStats stats;
+
+	inline
+	GarbageCollector(State* state):
+		state(state)
+	{}
+
+	/// Stop the automatic collection.
+	inline
+	void stop() {
+		lua_gc(state, LUA_GCSTOP, 0);
+	}
+
+	/// Resume the automatic collection.
+	inline
+	void restart() {
+		lua_gc(state, LUA_GCRESTART, 0);
+	}
+
+	/// Number of bytes in use by the state.
+	inline
+	size_t count() const {
+		return size_t(lua_gc(state, LUA_GCCOUNT, 0)) * 1024 + size_t(lua_gc(state, LUA_GCCOUNTB, 0));
+	}
+
+	/// Select the operating mode.
+	///
+	/// \returns `false` if the mode is not supported by the Lua version
+	inline
+	bool setMode(GCMode mode) {
+#if LUA_VERSION_NUM >= 504
+		if (mode == GCMode::Generational)
+			lua_gc(state, LUA_GCGEN, 0, 0);
+		else
+			lua_gc(state, LUA_GCINC, 0, 0, 0);
+
+		return true;
+#elif LUA_VERSION_NUM == 502
+		lua_gc(state, mode == GCMode::Generational ? LUA_GCGEN : LUA_GCINC, 0);
+		return true;
+#else
+		return mode == GCMode::Incremental;
+#endif
+	}
+
+	/// Set how long the collector waits before starting a new cycle, as a percentage of the memory
+	/// in use after the previous collection.
+	///
+	/// \returns Previous value
+	inline
+	int setPause(int pause) {
+		return lua_gc(state, LUA_GCSETPAUSE, pause);
+	}
+
+	/// Set the speed of the collector relative to memory allocation, as a percentage.
+	///
+	/// \returns Previous value
+	inline
+	int setStepMultiplier(int multiplier) {
+		return lua_gc(state, LUA_GCSETSTEPMUL, multiplier);
+	}
+
+	/// Perform incremental steps until either the budget is used up or a cycle has finished.
+	/// Intended to be called once per frame or request.
+	///
+	/// \param budget Time which may be spent collecting
+	/// \returns `true` if a collection cycle has been completed
+	template <typename Rep, typename Period> inline
+	bool step(std::chrono::duration<Rep, Period> budget) {
+		Clock::time_point start = Clock::now();
+		Clock::time_point deadline = start + budget;
+
+		bool finished = false;
+		Clock::time_point now;
+
+		do {
+			finished = lua_gc(state, LUA_GCSTEP, 0) != 0;
+			now = Clock::now();
+		} while (!finished && now < deadline);
+
+		stats.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start));
+
+		if (finished)
+			stats.cycles++;
+
+		return finished;
+	}
+
+	/// Perform a full collection cycle.
+	inline
+	void collect() {
+		Clock::time_point start = Clock::now();
+
+		lua_gc(state, LUA_GCCOLLECT, 0);
+
+		stats.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start));
+		stats.cycles++;
+	}
+};
+
+LUWRA_NS_END
+
+#endif
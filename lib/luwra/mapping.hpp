@@ -0,0 +1,439 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_MAPPING_H_
+#define LUWRA_MAPPING_H_
+
+#include "common.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+	#define LUWRA_HAS_MMAP
+
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+LUWRA_NS_BEGIN
+
+/// Read-only view of a file's contents. On POSIX systems the file is mapped into memory, elsewhere
+/// it is read into a buffer.
+struct MappedFile {
+	/// Open and map the given file.
+	inline
+	MappedFile(const char* path) {
+#ifdef LUWRA_HAS_MMAP
+		int fd = open(path, O_RDONLY);
+		if (fd < 0)
+			return;
+
+		struct stat info;
+		if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+			size_ = static_cast<size_t>(info.st_size);
+
+			if (size_ == 0) {
+				valid = true;
+			} else {
+				void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+
+				if (mapping != MAP_FAILED) {
+					data_ = static_cast<const char*>(mapping);
+					valid = true;
+				}
+			}
+		}
+
+		close(fd);
+#else
+		std::FILE* file = std::fopen(path, "rb");
+		if (!file)
+			return;
+
+		if (std::fseek(file, 0, SEEK_END) == 0) {
+			long length = std::ftell(file);
+
+			if (length >= 0 && std::fseek(file, 0, SEEK_SET) == 0) {
+				buffer.resize(static_cast<size_t>(length));
+
+				if (buffer.empty() || std::fread(&buffer[0], 1, buffer.size(), file) == buffer.size()) {
+					data_ = buffer.data();
+					size_ = buffer.size();
+					valid = true;
+				}
+			}
+		}
+
+		std::fclose(file);
+#endif
+	}
+
+	inline
+	MappedFile(MappedFile&& other):
+		data_(other.data_),
+		size_(other.size_),
+		valid(other.valid)
+#ifndef LUWRA_HAS_MMAP
+		, buffer(std::move(other.buffer))
+#endif
+	{
+#ifndef LUWRA_HAS_MMAP
+		data_ = buffer.data();
+#endif
+		other.data_ = nullptr;
+		other.size_ = 0;
+		other.valid = false;
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator =(const MappedFile&) = delete;
+
+	inline
+	~MappedFile() {
+#ifdef LUWRA_HAS_MMAP
+		if (data_)
+			munmap(const_cast<char*>(data_), size_);
+#endif
+	}
+
+	/// Check whether the file could be mapped.
+	inline
+	bool isValid() const {
+		return valid;
+	}
+
+	/// Contents of the file
+	inline
+	const char* data() const {
+		return data_;
+	}
+
+	/// Size of the file in bytes
+	inline
+	size_t size() const {
+		return size_;
+	}
+
+private:
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+	bool valid = false;
+
+#ifndef LUWRA_HAS_MMAP
+	std::string buffer;
+#endif
+};
+
+namespace internal {
+	// Skip what 'luaL_loadfile' would skip: a UTF-8 byte order mark and a leading '#' line. The
+	// line break is kept, so line numbers in error messages remain correct.
+	inline
+	size_t skipChunkPrefix(const char* data, size_t size) {
+		size_t offset = 0;
+
+		if (size >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+			offset = 3;
+
+		if (offset < size && data[offset] == '#') {
+			while (offset < size && data[offset] != '\n')
+				offset++;
+		}
+
+		return offset;
+	}
+
+	// Create a file next to 'path' which no other writer uses, so it can be renamed to 'path' once
+	// it is complete. 'temp_path' receives its name.
+	inline
+	std::FILE* openTemporaryFile(const std::string& path, std::string& temp_path) {
+#ifdef LUWRA_HAS_MMAP
+		temp_path = path + ".XXXXXX";
+
+		int fd = mkstemp(&temp_path[0]);
+		if (fd < 0)
+			return nullptr;
+
+		std::FILE* file = fdopen(fd, "wb");
+		if (!file) {
+			close(fd);
+			std::remove(temp_path.c_str());
+		}
+
+		return file;
+#else
+		temp_path = path + ".tmp";
+		return std::fopen(temp_path.c_str(), "wb");
+#endif
+	}
+}
+
+/// Load a file by mapping it into memory, and push the resulting function. This avoids the
+/// buffered reads of `luaL_loadfile` and the copies they involve. Files which cannot be mapped
+/// (e.g. pipes) are loaded using `luaL_loadfile`.
+///
+/// \returns `LUA_OK` on success, otherwise the status code of the failed load with the error
+///          message on top of the stack
+inline
+int loadMappedFile(State* state, const char* path) {
+	MappedFile file(path);
+	if (!file.isValid())
+		return luaL_loadfile(state, path);
+
+	size_t offset = internal::skipChunkPrefix(file.data(), file.size());
+	std::string chunkname = std::string("@") + path;
+
+	// 'luaL_loadbuffer' hands the whole mapping to the parser in one piece.
+	return luaL_loadbuffer(
+		state,
+		file.data() + offset,
+		file.size() - offset,
+		chunkname.c_str()
+	);
+}
+
+namespace internal {
+	struct ArchiveHeader {
+		char magic[8];
+		uint64_t count;
+	};
+
+	struct ArchiveEntry {
+		uint64_t nameOffset;
+		uint64_t nameLength;
+		uint64_t dataOffset;
+		uint64_t dataLength;
+	};
+
+	static
+	const char archiveMagic[8] = {'L', 'u', 'w', 'r', 'a', 'A', 'R', 1};
+
+	// Byte-wise ordering of names, consistent with 'std::string::compare'
+	inline
+	int compareNames(const char* a, size_t a_length, const char* b, size_t b_length) {
+		int result = std::memcmp(a, b, a_length < b_length ? a_length : b_length);
+
+		if (result != 0)
+			return result;
+
+		return a_length < b_length ? -1 : (a_length > b_length ? 1 : 0);
+	}
+}
+
+/// Collection of named chunks inside a single file, which is mapped into memory once
+///
+/// The file starts with a header followed by an index of all entries which is sorted by name, so
+/// that looking up an entry takes `O(log n)` without touching the file system. Archives are
+/// created using @ref ArchiveWriter.
+///
+/// Example:
+///
+/// ```
+///   MappedArchive archive("scripts.luwra");
+///
+///   if (archive.load(state, "config") == LUA_OK)
+///       lua_call(state, 0, 0);
+/// ```
+struct MappedArchive {
+	/// Map the given archive.
+	inline
+	MappedArchive(const char* path):
+		file(std::make_shared<MappedFile>(path))
+	{
+		valid = file->isValid() && validate();
+	}
+
+	/// Check whether the archive could be mapped and is well-formed.
+	inline
+	bool isValid() const {
+		return valid;
+	}
+
+	/// Number of entries
+	inline
+	size_t size() const {
+		return valid ? count : 0;
+	}
+
+	/// Look up an entry.
+	///
+	/// \param name   Name of the entry
+	/// \param data   Receives the entry's contents
+	/// \param length Receives the size of the entry's contents
+	/// \returns `true` if the entry exists
+	inline
+	bool find(const char* name, const char*& data, size_t& length) const {
+		if (!valid)
+			return false;
+
+		size_t name_length = std::strlen(name);
+		size_t lower = 0;
+		size_t upper = count;
+
+		while (lower < upper) {
+			size_t middle = lower + (upper - lower) / 2;
+			internal::ArchiveEntry entry = entryAt(middle);
+
+			int order = internal::compareNames(
+				file->data() + entry.nameOffset,
+				entry.nameLength,
+				name,
+				name_length
+			);
+
+			if (order < 0) {
+				lower = middle + 1;
+			} else if (order > 0) {
+				upper = middle;
+			} else {
+				data = file->data() + entry.dataOffset;
+				length = entry.dataLength;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	/// Load an entry as a chunk and push the resulting function.
+	///
+	/// \returns `LUA_OK` on success, `LUA_ERRFILE` if the entry does not exist, otherwise the
+	///          status code of the failed load; the error message is on top of the stack
+	inline
+	int load(State* state, const char* name) const {
+		const char* data;
+		size_t length;
+
+		if (!find(name, data, length)) {
+			lua_pushfstring(state, "no entry '%s' in archive", name);
+			return LUA_ERRFILE;
+		}
+
+		std::string chunkname = std::string("@") + name;
+		return luaL_loadbuffer(state, data, length, chunkname.c_str());
+	}
+
+private:
+	std::shared_ptr<MappedFile> file;
+	size_t count = 0;
+	bool valid = false;
+
+	inline
+	internal::ArchiveEntry entryAt(size_t index) const {
+		internal::ArchiveEntry entry;
+		std::memcpy(
+			&entry,
+			file->data() + sizeof(internal::ArchiveHeader) + index * sizeof(internal::ArchiveEntry),
+			sizeof(entry)
+		);
+
+		return entry;
+	}
+
+	// Make sure every offset in the index lies within the file.
+	inline
+	bool validate() {
+		size_t size = file->size();
+
+		internal::ArchiveHeader header;
+		if (size < sizeof(header))
+			return false;
+
+		std::memcpy(&header, file->data(), sizeof(header));
+		if (std::memcmp(header.magic, internal::archiveMagic, sizeof(header.magic)) != 0)
+			return false;
+
+		if (header.count > (size - sizeof(header)) / sizeof(internal::ArchiveEntry))
+			return false;
+
+		count = static_cast<size_t>(header.count);
+
+		for (size_t i = 0; i < count; i++) {
+			internal::ArchiveEntry entry = entryAt(i);
+
+			if (
+				entry.nameOffset > size || entry.nameLength > size - entry.nameOffset
+				|| entry.dataOffset > size || entry.dataLength > size - entry.dataOffset
+			)
+				return false;
+		}
+
+		return true;
+	}
+};
+
+/// Builds archives which can be read using @ref MappedArchive
+struct ArchiveWriter {
+	/// Add an entry. Existing entries with the same name are replaced.
+	inline
+	void add(const std::string& name, std::string data) {
+		entries[name] = std::move(data);
+	}
+
+	/// Number of entries
+	inline
+	size_t size() const {
+		return entries.size();
+	}
+
+	/// Write the archive to a file.
+	///
+	/// \returns `true` on success
+	inline
+	bool write(const char* path) const {
+		internal::ArchiveHeader header;
+		std::memcpy(header.magic, internal::archiveMagic, sizeof(header.magic));
+		header.count = entries.size();
+
+		// Names and contents follow the index.
+		uint64_t offset = sizeof(header) + entries.size() * sizeof(internal::ArchiveEntry);
+
+		std::string index;
+		index.reserve(entries.size() * sizeof(internal::ArchiveEntry));
+
+		for (const auto& pair: entries) {
+			internal::ArchiveEntry entry;
+			entry.nameOffset = offset;
+			entry.nameLength = pair.first.size();
+			entry.dataOffset = offset + pair.first.size();
+			entry.dataLength = pair.second.size();
+
+			offset = entry.dataOffset + entry.dataLength;
+			index.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		}
+
+		std::FILE* file = std::fopen(path, "wb");
+		if (!file)
+			return false;
+
+		bool written =
+			std::fwrite(&header, sizeof(header), 1, file) == 1
+			&& std::fwrite(index.data(), 1, index.size(), file) == index.size();
+
+		for (const auto& pair: entries) {
+			written =
+				written
+				&& std::fwrite(pair.first.data(), 1, pair.first.size(), file) == pair.first.size()
+				&& std::fwrite(pair.second.data(), 1, pair.second.size(), file) == pair.second.size();
+		}
+
+		return std::fclose(file) == 0 && written;
+	}
+
+private:
+	std::map<std::string, std::string> entries;
+};
+
+LUWRA_NS_END
+
+#endif
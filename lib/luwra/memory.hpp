@@ -0,0 +1,407 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_MEMORY_H_
+#define LUWRA_MEMORY_H_
+
+#include "common.hpp"
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+LUWRA_NS_BEGIN
+
+/// Memory usage statistics of a Lua state
+struct MemoryStats {
+	/// Number of size classes in the histogram
+	enum { HistogramSize = 16 };
+
+	/// Number of bytes currently in use
+	size_t live = 0;
+
+	/// Highest number of bytes that were in use at the same time
+	size_t peak = 0;
+
+	/// Number of successful allocation requests, this includes growing reallocations
+	size_t allocations = 0;
+
+	/// Number of allocation requests which have been refused because of a memory limit
+	size_t failures = 0;
+
+	/// Number of full collections which have been requested because of the soft limit
+	size_t emergencyCollections = 0;
+
+	/// Allocation requests per size class. Entry `i` counts requests of up to `2^(i + 4)` bytes,
+	/// the last entry also counts every larger request.
+	size_t histogram[HistogramSize] = {};
+};
+
+/// Base for allocator policies which can be used to back a Lua state
+///
+/// Implementations only have to provide the memory itself, the bookkeeping in `stats` is done for
+/// them. Allocators are used by a single Lua state and need not be thread-safe.
+struct Allocator {
+	/// Statistics of the state which uses this allocator
+	MemoryStats stats;
+
+	/// Maximum number of bytes the state may use, 0 means unlimited. Allocations which would
+	/// exceed it fail, which makes Lua raise a memory error (`LUA_ERRMEM`).
+	size_t limit = 0;
+
+	/// Number of bytes after which a full garbage collection shall be performed, 0 disables this.
+	///
+	/// Allocations are not refused because of it, since Lua cannot always collect garbage while
+	/// allocating. Crossing the soft limit requests a collection instead, which happens at the next
+	/// safe point (see @ref collectRequestedGarbage). Another collection is only requested after
+	/// the memory usage has gone back below the soft limit.
+	size_t softLimit = 0;
+
+	/// Used internally to track soft limit requests
+	bool softArmed = true;
+
+	/// Whether a collection has been requested because of the soft limit
+	bool collectionRequested = false;
+
+	/// Allocate a block of `size` bytes. `size` is never 0.
+	virtual
+	void* allocate(size_t size) = 0;
+
+	/// Resize a block. `new_size` is never 0. Return `nullptr` to indicate failure, in which case
+	/// the original block must remain valid.
+	virtual
+	void* reallocate(void* ptr, size_t old_size, size_t new_size) = 0;
+
+	/// Release a block which has been allocated with `size` bytes.
+	virtual
+	void deallocate(void* ptr, size_t size) = 0;
+
+	virtual ~Allocator() {}
+};
+
+namespace internal {
+	// Determine the histogram slot for an allocation of the given size.
+	inline
+	size_t sizeClassOf(size_t size) {
+		size_t index = 0;
+
+		for (size_t limit = 16; size > limit && index + 1 < MemoryStats::HistogramSize; limit <<= 1)
+			index++;
+
+		return index;
+	}
+
+	// Allocation function for 'lua_newstate' which forwards every request to an 'Allocator'.
+	inline
+	void* allocateFor(void* ud, void* ptr, size_t old_size, size_t new_size) {
+		Allocator& allocator = *static_cast<Allocator*>(ud);
+		MemoryStats& stats = allocator.stats;
+
+		// Lua encodes the type of the new object in 'old_size' when 'ptr' is NULL.
+		if (!ptr)
+			old_size = 0;
+
+		if (new_size == 0) {
+			if (ptr) {
+				allocator.deallocate(ptr, old_size);
+				stats.live -= old_size;
+			}
+
+			return nullptr;
+		}
+
+		if (new_size > old_size) {
+			size_t grow = new_size - old_size;
+
+			if (allocator.limit > 0 && stats.live + grow > allocator.limit) {
+				stats.failures++;
+				return nullptr;
+			}
+
+			if (allocator.softLimit > 0) {
+				if (stats.live + grow <= allocator.softLimit) {
+					allocator.softArmed = true;
+				} else if (allocator.softArmed) {
+					allocator.softArmed = false;
+					allocator.collectionRequested = true;
+					stats.emergencyCollections++;
+				}
+			}
+		}
+
+		void* block =
+			ptr ? allocator.reallocate(ptr, old_size, new_size) : allocator.allocate(new_size);
+
+		if (!block)
+			return nullptr;
+
+		stats.live = stats.live - old_size + new_size;
+
+		if (stats.live > stats.peak)
+			stats.peak = stats.live;
+
+		if (new_size > old_size) {
+			stats.allocations++;
+			stats.histogram[sizeClassOf(new_size)]++;
+		}
+
+		return block;
+	}
+
+	inline
+	int collectGarbage(State* state) {
+		lua_gc(state, LUA_GCCOLLECT, 0);
+		return 0;
+	}
+}
+
+/// Perform the full garbage collection which the @ref Allocator of a state has requested because
+/// of its soft limit, if there is one. This is a safe point; it happens automatically before
+/// @ref StateWrapper::runString, @ref StateWrapper::runFile and @ref Function::pcall. Errors in
+/// finalizers are ignored.
+///
+/// \param state Lua state
+/// \returns `true` if a collection has been performed
+inline
+bool collectRequestedGarbage(State* state) {
+	void* ud;
+	if (lua_getallocf(state, &ud) != &internal::allocateFor)
+		return false;
+
+	Allocator& allocator = *static_cast<Allocator*>(ud);
+	if (!allocator.collectionRequested)
+		return false;
+
+	allocator.collectionRequested = false;
+
+	lua_pushcfunction(state, &internal::collectGarbage);
+	if (lua_pcall(state, 0, 0, 0) != LUA_OK)
+		lua_pop(state, 1);
+
+	return true;
+}
+
+/// Passes every request through to `malloc`, `realloc` and `free`.
+struct MallocAllocator: Allocator {
+	virtual
+	void* allocate(size_t size) {
+		return std::malloc(size);
+	}
+
+	virtual
+	void* reallocate(void* ptr, size_t, size_t new_size) {
+		return std::realloc(ptr, new_size);
+	}
+
+	virtual
+	void deallocate(void* ptr, size_t) {
+		std::free(ptr);
+	}
+};
+
+/// Serves small blocks from per-size-class free lists which are carved out of large slabs. Bigger
+/// blocks are delegated to `malloc`.
+///
+/// Most allocations of a Lua state are small (strings, tables, closures), therefore this avoids
+/// the global `malloc` lock and keeps the state's objects close to each other. Slabs are only
+/// returned to the system when the allocator is destroyed.
+struct PoolAllocator: Allocator {
+	/// Size classes are multiples of this
+	static constexpr size_t Granularity = 16;
+
+	/// Number of pooled size classes; larger requests are not pooled
+	static constexpr size_t Classes = 16;
+
+	/// Create a pool which requests slabs of `slab_size` bytes.
+	inline
+	PoolAllocator(size_t slab_size = 64 * 1024):
+		slab_size(slab_size < Granularity * Classes ? Granularity * Classes : slab_size)
+	{}
+
+	PoolAllocator(const PoolAllocator&) = delete;
+	PoolAllocator& operator =(const PoolAllocator&) = delete;
+
+	virtual ~PoolAllocator() {
+		for (void* slab: slabs)
+			std::free(slab);
+	}
+
+	virtual
+	void* allocate(size_t size) {
+		if (size > Granularity * Classes)
+			return std::malloc(size);
+
+		size_t cls = (size - 1) / Granularity;
+		FreeBlock* block = free_lists[cls];
+
+		if (block) {
+			free_lists[cls] = block->next;
+			return block;
+		}
+
+		return carve((cls + 1) * Granularity);
+	}
+
+	virtual
+	void* reallocate(void* ptr, size_t old_size, size_t new_size) {
+		bool pooled_old = old_size <= Granularity * Classes;
+		bool pooled_new = new_size <= Granularity * Classes;
+
+		if (pooled_old && pooled_new && (old_size - 1) / Granularity == (new_size - 1) / Granularity)
+			return ptr;
+
+		if (!pooled_old && !pooled_new)
+			return std::realloc(ptr, new_size);
+
+		void* block = allocate(new_size);
+		if (!block)
+			return nullptr;
+
+		std::memcpy(block, ptr, old_size < new_size ? old_size : new_size);
+		deallocate(ptr, old_size);
+
+		return block;
+	}
+
+	virtual
+	void deallocate(void* ptr, size_t size) {
+		if (size > Granularity * Classes) {
+			std::free(ptr);
+			return;
+		}
+
+		FreeBlock* block = static_cast<FreeBlock*>(ptr);
+		size_t cls = (size - 1) / Granularity;
+
+		block->next = free_lists[cls];
+		free_lists[cls] = block;
+	}
+
+private:
+	struct FreeBlock {
+		FreeBlock* next;
+	};
+
+	size_t slab_size;
+	std::vector<void*> slabs;
+
+	char* cursor = nullptr;
+	size_t remaining = 0;
+
+	FreeBlock* free_lists[Classes] = {};
+
+	// Take a fresh block from the current slab, start a new slab if necessary.
+	inline
+	void* carve(size_t size) {
+		if (remaining < size) {
+			void* slab = std::malloc(slab_size);
+			if (!slab)
+				return nullptr;
+
+			slabs.push_back(slab);
+			cursor = static_cast<char*>(slab);
+			remaining = slab_size;
+		}
+
+		void* block = cursor;
+		cursor += size;
+		remaining -= size;
+
+		return block;
+	}
+};
+
+/// Bump allocator which releases all of its memory at once when it is destroyed.
+///
+/// Freed blocks are not reused, except when the most recent block is resized or released. This
+/// suits short-lived states which run a script and are then closed.
+struct ArenaAllocator: Allocator {
+	/// Blocks are aligned to this
+	enum { Alignment = 16 };
+
+	/// Create an arena which grows in chunks of `chunk_size` bytes.
+	inline
+	ArenaAllocator(size_t chunk_size = 256 * 1024):
+		chunk_size(chunk_size)
+	{}
+
+	ArenaAllocator(const ArenaAllocator&) = delete;
+	ArenaAllocator& operator =(const ArenaAllocator&) = delete;
+
+	virtual ~ArenaAllocator() {
+		for (void* chunk: chunks)
+			std::free(chunk);
+	}
+
+	virtual
+	void* allocate(size_t size) {
+		size = align(size);
+
+		if (remaining < size) {
+			size_t length = size > chunk_size ? size : chunk_size;
+
+			void* chunk = std::malloc(length);
+			if (!chunk)
+				return nullptr;
+
+			chunks.push_back(chunk);
+			cursor = static_cast<char*>(chunk);
+			remaining = length;
+		}
+
+		last = cursor;
+		cursor += size;
+		remaining -= size;
+
+		return last;
+	}
+
+	virtual
+	void* reallocate(void* ptr, size_t old_size, size_t new_size) {
+		// The most recent block can be resized in place if the current chunk has enough room left.
+		if (ptr == last && align(new_size) <= align(old_size) + remaining) {
+			remaining = remaining + align(old_size) - align(new_size);
+			cursor = last + align(new_size);
+			return ptr;
+		}
+
+		if (align(new_size) <= align(old_size))
+			return ptr;
+
+		void* block = allocate(new_size);
+		if (block)
+			std::memcpy(block, ptr, old_size);
+
+		return block;
+	}
+
+	virtual
+	void deallocate(void* ptr, size_t size) {
+		if (ptr == last) {
+			cursor = last;
+			remaining += align(size);
+			last = nullptr;
+		}
+	}
+
+private:
+	size_t chunk_size;
+	std::vector<void*> chunks;
+
+	char* cursor = nullptr;
+	char* last = nullptr;
+	size_t remaining = 0;
+
+	static inline
+	size_t align(size_t size) {
+		return (size + Alignment - 1) & ~size_t(Alignment - 1);
+	}
+};
+
+LUWRA_NS_END
+
+#endif
@@ -0,0 +1,258 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_PARALLEL_H_
+#define LUWRA_PARALLEL_H_
+
+#include "common.hpp"
+#include "values.hpp"
+#include "stack.hpp"
+#include "usertypes.hpp"
+#include "executor.hpp"
+
+#include <algorithm>
+#include <future>
+#include <string>
+#include <vector>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Registry name of the table which maps a mapping function's source to its compiled driver
+	#define LUWRA_PARALLEL_MAP_NAME LUWRA_REGISTRY_PREFIX "ParallelMap"
+
+	// Minimum number of elements per job
+	#define LUWRA_PARALLEL_MAP_MIN_CHUNK 1024
+
+	// Number of jobs per worker, so that workers which finish early can steal the rest
+	#define LUWRA_PARALLEL_MAP_JOBS_PER_WORKER 4
+
+	// Wraps the mapping function in a loop, so that a chunk costs a single call into Lua
+	static
+	const char parallelMapDriver[] =
+		"local f = ...\n"
+		"return function (t, n)\n"
+		"  for i = 1, n do t[i] = f(t[i]) end\n"
+		"end";
+
+	// Push the driver for the given mapping function, compiling it if necessary.
+	inline
+	int pushParallelMapDriver(State* state, const std::string& source) {
+		int top = lua_gettop(state);
+
+		lua_getfield(state, LUA_REGISTRYINDEX, LUWRA_PARALLEL_MAP_NAME);
+
+		if (lua_type(state, -1) != LUA_TTABLE) {
+			lua_pop(state, 1);
+			lua_newtable(state);
+			lua_pushvalue(state, -1);
+			lua_setfield(state, LUA_REGISTRYINDEX, LUWRA_PARALLEL_MAP_NAME);
+		}
+
+		lua_pushlstring(state, source.data(), source.size());
+		lua_rawget(state, -2);
+
+		if (lua_type(state, -1) == LUA_TFUNCTION) {
+			lua_remove(state, -2);
+			return LUA_OK;
+		}
+
+		lua_pop(state, 1);
+
+		// Driver and mapping function
+		int status = luaL_loadbuffer(
+			state,
+			parallelMapDriver,
+			sizeof(parallelMapDriver) - 1,
+			"=parallelMap"
+		);
+
+		if (status == LUA_OK)
+			status = luaL_loadbuffer(state, source.data(), source.size(), "=parallelMap");
+
+		if (status == LUA_OK)
+			status = lua_pcall(state, 0, 1, 0);
+
+		if (status == LUA_OK && lua_type(state, -1) != LUA_TFUNCTION) {
+			lua_pop(state, 1);
+			lua_pushliteral(state, "mapping chunk does not return a function");
+			status = LUA_ERRRUN;
+		}
+
+		if (status == LUA_OK)
+			status = lua_pcall(state, 1, 1, 0);
+
+		if (status != LUA_OK) {
+			// Leave only the error message
+			lua_replace(state, top + 1);
+			lua_settop(state, top + 1);
+			return status;
+		}
+
+		lua_pushlstring(state, source.data(), source.size());
+		lua_pushvalue(state, -2);
+		lua_rawset(state, -4);
+
+		lua_remove(state, -2);
+		return LUA_OK;
+	}
+
+	// Slice of the input which is mapped within one state
+	template <typename Input, typename Output>
+	struct ParallelMapChunk {
+		const Input* input;
+		Output* output;
+		int count;
+
+		// Invoked with the chunk and the driver as arguments
+		static inline
+		int run(State* state) {
+			ParallelMapChunk* chunk = static_cast<ParallelMapChunk*>(lua_touserdata(state, 1));
+
+			lua_createtable(state, chunk->count, 0);
+
+			for (int i = 0; i < chunk->count; i++) {
+				push(state, chunk->input[i]);
+				lua_rawseti(state, -2, i + 1);
+			}
+
+			lua_pushvalue(state, -1);
+			lua_insert(state, 2);
+
+			lua_pushinteger(state, chunk->count);
+			lua_call(state, 2, 0);
+
+			for (int i = 0; i < chunk->count; i++) {
+				lua_rawgeti(state, 2, i + 1);
+				chunk->output[i] = read<Output>(state, -1);
+				lua_pop(state, 1);
+			}
+
+			return 0;
+		}
+	};
+}
+
+/// Apply a Lua function to every element of a buffer using the states of an @ref ExecutorPool.
+/// The input is split into chunks which are mapped in parallel. Each chunk is copied into a table
+/// and mapped by a single call into Lua, which avoids a call per element. The results are written
+/// to the output buffer, which must hold at least `count` elements.
+///
+/// The function is given as a chunk which returns it. It is compiled once per worker state and
+/// cached by its source.
+///
+/// When it is called from a job of the same pool, the chunks are mapped one after another in the
+/// state of the calling worker. Waiting for the other workers could otherwise deadlock, since the
+/// chunks would be queued behind the job which waits for them.
+///
+/// Example:
+///
+/// ```
+///   std::vector<double> input = loadSamples();
+///   std::vector<double> output(input.size());
+///
+///   parallelMap(pool, "return function (x) return x * x end", input.data(), input.size(),
+///               output.data());
+/// ```
+///
+/// \param pool    Pool whose states run the function
+/// \param source  Lua chunk which returns the mapping function
+/// \param input   Elements that shall be mapped
+/// \param count   Number of elements
+/// \param output  Receives the results
+/// \param message Receives the error message, if an error occurs
+/// \returns `LUA_OK` on success, otherwise the status of the first chunk which has failed; the
+///          output of successful chunks is written regardless
+template <typename Input, typename Output> inline
+int parallelMap(
+	ExecutorPool& pool,
+	const std::string& source,
+	const Input* input,
+	size_t count,
+	Output* output,
+	std::string* message = nullptr
+) {
+	size_t jobs = pool.size() * LUWRA_PARALLEL_MAP_JOBS_PER_WORKER;
+	size_t chunkSize = std::max<size_t>((count + jobs - 1) / jobs, LUWRA_PARALLEL_MAP_MIN_CHUNK);
+
+	size_t chunks = (count + chunkSize - 1) / chunkSize;
+
+	// Present if the caller is a job of this pool
+	StateWrapper* local = pool.currentState();
+
+	std::vector<int> statuses;
+	std::vector<std::future<int>> results;
+	std::vector<std::string> messages(chunks);
+
+	for (size_t first = 0, index = 0; first < count; first += chunkSize, index++) {
+		internal::ParallelMapChunk<Input, Output> chunk {
+			input + first,
+			output + first,
+			static_cast<int>(std::min(chunkSize, count - first))
+		};
+
+		std::string& chunkMessage = messages[index];
+
+		auto job = [chunk, &source, &chunkMessage](StateWrapper& state) mutable {
+			int top = lua_gettop(state);
+			CFunction run = &internal::ParallelMapChunk<Input, Output>::run;
+
+			lua_pushcfunction(state, run);
+			lua_pushlightuserdata(state, &chunk);
+
+			int status = internal::pushParallelMapDriver(state, source);
+
+			if (status == LUA_OK)
+				status = lua_pcall(state, 2, 0, 0);
+
+			if (status != LUA_OK) {
+				const char* error = lua_tostring(state, -1);
+				chunkMessage = error ? error : "unknown error";
+			}
+
+			lua_settop(state, top);
+			return status;
+		};
+
+		if (local)
+			statuses.push_back(job(*local));
+		else
+			results.push_back(pool.submit(job));
+	}
+
+	int status = LUA_OK;
+
+	// Wait for every chunk, even if one has failed, because they refer to the buffers
+	for (size_t i = 0; i < chunks; i++) {
+		int chunkStatus = local ? statuses[i] : results[i].get();
+
+		if (status == LUA_OK && chunkStatus != LUA_OK) {
+			status = chunkStatus;
+
+			if (message)
+				*message = messages[i];
+		}
+	}
+
+	return status;
+}
+
+/// Same as @ref parallelMap, but for vectors. The output is resized to fit the input.
+template <typename Input, typename Output> inline
+int parallelMap(
+	ExecutorPool& pool,
+	const std::string& source,
+	const std::vector<Input>& input,
+	std::vector<Output>& output,
+	std::string* message = nullptr
+) {
+	output.resize(input.size());
+	return parallelMap(pool, source, input.data(), input.size(), output.data(), message);
+}
+
+LUWRA_NS_END
+
+#endif
@@ -0,0 +1,340 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_POOL_H_
+#define LUWRA_POOL_H_
+
+#include "common.hpp"
+#include "state.hpp"
+#include "types/reference.hpp"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+LUWRA_NS_BEGIN
+
+/// Shallow snapshot of a table's fields and metatable which can be restored later on
+struct TableSnapshot {
+	/// Table which is being tracked
+	Reference table;
+
+	/// Copy of the fields at the time the snapshot has been taken
+	Reference fields;
+
+	/// Metatable at the time the snapshot has been taken
+	Reference metatable;
+
+	/// Take a snapshot of the table at the given index.
+	inline
+	TableSnapshot(State* state, int index):
+		table(state, index),
+		fields(copyFields(state, index)),
+		metatable(lua_getmetatable(state, index) ? state : (lua_pushnil(state), state))
+	{}
+
+	/// Reset the table to the state it was in when the snapshot has been taken. Keys which have
+	/// been added since are removed, modified and removed keys get their original value back.
+	///
+	/// Only the table itself is restored; nested tables are not tracked.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of `lua_pcall` (e.g. `LUA_ERRMEM`
+	///          if the state has hit its memory limit) with the error object on top of the stack
+	inline
+	int restore() const {
+		State* state = table.life->state;
+
+		lua_pushcfunction(state, &TableSnapshot::restoreFields);
+		lua_pushlightuserdata(state, const_cast<TableSnapshot*>(this));
+
+		// Re-inserting keys may need to grow the table
+		return lua_pcall(state, 1, 0, 0);
+	}
+
+private:
+	// Invoked with the snapshot as argument
+	static inline
+	int restoreFields(State* state) {
+		const TableSnapshot* snapshot = static_cast<const TableSnapshot*>(lua_touserdata(state, 1));
+
+		push(state, snapshot->table);
+		push(state, snapshot->fields);
+
+		int tbl = lua_gettop(state) - 1;
+		int copy = tbl + 1;
+
+		// Remove or reset keys which differ from the snapshot. Assigning to existing fields is
+		// permitted during traversal.
+		lua_pushnil(state);
+		while (lua_next(state, tbl) != 0) {
+			lua_pushvalue(state, -2);
+			lua_rawget(state, copy);
+
+			if (!lua_rawequal(state, -1, -2)) {
+				lua_pushvalue(state, -3);
+				lua_insert(state, -2);
+				lua_rawset(state, tbl);
+			} else {
+				lua_pop(state, 1);
+			}
+
+			lua_pop(state, 1);
+		}
+
+		// Restore keys which have been removed.
+		lua_pushnil(state);
+		while (lua_next(state, copy) != 0) {
+			lua_pushvalue(state, -2);
+			lua_rawget(state, tbl);
+
+			if (lua_isnil(state, -1)) {
+				lua_pop(state, 1);
+				lua_pushvalue(state, -2);
+				lua_insert(state, -2);
+				lua_rawset(state, tbl);
+			} else {
+				lua_pop(state, 2);
+			}
+		}
+
+		push(state, snapshot->metatable);
+		lua_setmetatable(state, tbl);
+
+		return 0;
+	}
+
+	// Push a shallow copy of the table at the given index and return the state.
+	static inline
+	State* copyFields(State* state, int index) {
+		if (index < 0)
+			index = lua_gettop(state) + (index + 1);
+
+		lua_newtable(state);
+
+		lua_pushnil(state);
+		while (lua_next(state, index) != 0) {
+			lua_pushvalue(state, -2);
+			lua_insert(state, -2);
+			lua_rawset(state, -4);
+		}
+
+		return state;
+	}
+};
+
+/// Pool of fully initialised states which are reset when they are returned
+///
+/// Setting up a state (loading libraries, registering user types, running preludes) is often more
+/// expensive than the work which is done with it. The pool performs the setup once per state,
+/// takes a @ref TableSnapshot of the globals and `package.loaded` and restores them when a state
+/// is checked back in. This isolates the users of a state from each other without rebuilding it.
+///
+/// The tables in the fields of those two are tracked as well, i.e. the standard libraries and the
+/// modules which have been loaded during the setup. Changes which are nested deeper than that,
+/// e.g. `string.cache.x = 1`, are not undone.
+///
+/// The registry is left as it is, therefore references and user type metatables stay intact.
+///
+/// Example:
+///
+/// ```
+///   StatePool pool(8, [](StateWrapper& state) {
+///       state.loadStandardLibrary();
+///       state.registerUserType<Point(double, double)>("Point");
+///   });
+///
+///   {
+///       StatePool::Lease lease = pool.acquire();
+///       lease->runString("x = Point(1, 2)");
+///   }
+///
+///   // The global 'x' is gone once the state is acquired again.
+/// ```
+struct StatePool {
+	/// Prepares a new state
+	using Initializer = std::function<void (StateWrapper&)>;
+
+	/// State which has been taken out of a pool
+	struct Slot {
+		StateWrapper state;
+		std::vector<TableSnapshot> snapshots;
+
+		inline
+		Slot(const Initializer& init) {
+			if (init)
+				init(state);
+
+			lua_settop(state, 0);
+
+			// Tables which are tracked already, at index 1
+			lua_newtable(state);
+
+			push(state, static_cast<const Table&>(state));
+			trackWithFields(2);
+			lua_pop(state, 1);
+
+			lua_getglobal(state, "package");
+			if (lua_istable(state, -1)) {
+				lua_getfield(state, -1, "loaded");
+				if (lua_istable(state, -1))
+					trackWithFields(3);
+				lua_pop(state, 1);
+			}
+
+			lua_settop(state, 0);
+		}
+
+		// Undo the changes which have been made since the snapshots have been taken. Returns
+		// 'false' if that has failed.
+		inline
+		bool reset() {
+			lua_settop(state, 0);
+
+			for (const TableSnapshot& snapshot: snapshots) {
+				if (snapshot.restore() != LUA_OK)
+					return false;
+			}
+
+			return true;
+		}
+
+	private:
+		// Track the table at the given index and the tables in its fields, e.g. 'string' or the
+		// tables of modules.
+		inline
+		void trackWithFields(int index) {
+			track(index);
+
+			lua_pushnil(state);
+			while (lua_next(state, index) != 0) {
+				if (lua_istable(state, -1))
+					track(lua_gettop(state));
+
+				lua_pop(state, 1);
+			}
+		}
+
+		inline
+		void track(int index) {
+			lua_pushvalue(state, index);
+			lua_rawget(state, 1);
+
+			bool tracked = lua_toboolean(state, -1);
+			lua_pop(state, 1);
+
+			if (tracked)
+				return;
+
+			lua_pushvalue(state, index);
+			lua_pushboolean(state, true);
+			lua_rawset(state, 1);
+
+			snapshots.emplace_back(state, index);
+		}
+	};
+
+	/// Handle for a state which has been acquired from a @ref StatePool. The state is returned to
+	/// the pool when the handle is destroyed. Leases must not outlive their pool.
+	struct Lease {
+		inline
+		Lease(StatePool* pool, std::unique_ptr<Slot>&& slot):
+			pool(pool),
+			slot(std::move(slot))
+		{}
+
+		inline
+		Lease(Lease&& other):
+			pool(other.pool),
+			slot(std::move(other.slot))
+		{}
+
+		Lease(const Lease&) = delete;
+		Lease& operator =(const Lease&) = delete;
+
+		inline
+		~Lease() {
+			if (slot)
+				pool->release(std::move(slot));
+		}
+
+		inline
+		StateWrapper& operator *() const {
+			return slot->state;
+		}
+
+		inline
+		StateWrapper* operator ->() const {
+			return &slot->state;
+		}
+
+	private:
+		StatePool* pool;
+		std::unique_ptr<Slot> slot;
+	};
+
+	/// Create a pool with `size` initialised states.
+	inline
+	StatePool(size_t size, const Initializer& init = Initializer()):
+		init(init)
+	{
+		idle.reserve(size);
+
+		for (size_t i = 0; i < size; i++)
+			idle.emplace_back(new Slot(init));
+	}
+
+	StatePool(const StatePool&) = delete;
+	StatePool& operator =(const StatePool&) = delete;
+
+	/// Take a state out of the pool. A new state is initialised if none is available.
+	inline
+	Lease acquire() {
+		std::unique_ptr<Slot> slot;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (!idle.empty()) {
+				slot = std::move(idle.back());
+				idle.pop_back();
+			}
+		}
+
+		if (!slot)
+			slot.reset(new Slot(init));
+
+		return {this, std::move(slot)};
+	}
+
+	/// Number of states which are ready to be acquired.
+	inline
+	size_t available() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return idle.size();
+	}
+
+private:
+	Initializer init;
+
+	mutable std::mutex mutex;
+	std::vector<std::unique_ptr<Slot>> idle;
+
+	inline
+	void release(std::unique_ptr<Slot>&& slot) {
+		// A state which is only partially reset must not be handed out again
+		if (!slot->reset())
+			return;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		idle.push_back(std::move(slot));
+	}
+};
+
+LUWRA_NS_END
+
+#endif
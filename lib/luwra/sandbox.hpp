@@ -0,0 +1,168 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_SANDBOX_H_
+#define LUWRA_SANDBOX_H_
+
+#include "common.hpp"
+#include "mapping.hpp"
+#include "usertypes.hpp"
+#include "types/reference.hpp"
+#include "types/table.hpp"
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	inline
+	int rejectSandboxWrite(State* state) {
+		return luaL_error(state, "the shared globals are read-only");
+	}
+
+	// Push the metatable which all sandbox environments share. Its '__index' field points to a
+	// read-only view of the globals of the main state. The metatable is protected, so that a
+	// sandbox can neither reach the view nor replace it.
+	inline
+	void pushSandboxMetatable(State* state) {
+		if (luaL_newmetatable(state, LUWRA_REGISTRY_PREFIX "Sandbox")) {
+			lua_newtable(state);
+			lua_newtable(state);
+
+#if LUA_VERSION_NUM <= 501
+			lua_pushvalue(state, LUA_GLOBALSINDEX);
+#else
+			lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+#endif
+			lua_setfield(state, -2, "__index");
+
+			lua_pushcfunction(state, &rejectSandboxWrite);
+			lua_setfield(state, -2, "__newindex");
+
+			lua_pushboolean(state, false);
+			lua_setfield(state, -2, "__metatable");
+
+			lua_setmetatable(state, -2);
+			lua_setfield(state, -2, "__index");
+
+			lua_pushboolean(state, false);
+			lua_setfield(state, -2, "__metatable");
+		}
+	}
+
+	// Create the thread and environment for a sandbox.
+	inline
+	State* newSandbox(State* state) {
+		lua_newthread(state);
+
+		lua_newtable(state);
+		pushSandboxMetatable(state);
+		lua_setmetatable(state, -2);
+
+		// '_G' must not lead to the shared globals.
+		lua_pushvalue(state, -1);
+		lua_setfield(state, -2, "_G");
+
+		return state;
+	}
+}
+
+/// Isolated execution context within a state
+///
+/// A sandbox consists of a Lua thread and an environment table. Chunks which are run in the
+/// sandbox use that table for their globals; lookups which miss fall through to the globals of the
+/// state. Global assignments therefore only affect the sandbox, while the base globals and the
+/// loaded libraries are shared with every other sandbox. A sandbox costs one thread and one table,
+/// and tearing it down just means releasing both.
+///
+/// The isolation is shallow: a script can still modify the contents of shared tables, e.g.
+/// `string.foo = 1`, including `package.loaded._G`. The `debug` library bypasses it entirely.
+///
+/// Example:
+///
+/// ```
+///   StateWrapper state;
+///   state.loadStandardLibrary();
+///
+///   Sandbox sandbox = state.spawnSandbox();
+///   sandbox.runString("x = 1");      // 'x' is only visible inside the sandbox
+///   sandbox.runString("print(x)");   // 'print' comes from the shared globals
+/// ```
+struct Sandbox {
+	/// Keeps the thread alive
+	Reference thread;
+
+	/// Thread on which the sandbox runs its chunks
+	State* state;
+
+	/// Sandbox globals
+	Table env;
+
+	/// Create a sandbox within the given state.
+	inline
+	Sandbox(State* parent):
+		thread(internal::newSandbox(parent), -2),
+		state(lua_tothread(parent, -2)),
+		env(parent, -1)
+	{
+		lua_pop(parent, 2);
+	}
+
+	/// Convert to `lua_State`. This is the sandbox's own thread.
+	inline
+	operator State*() const {
+		return state;
+	}
+
+	/// Execute a piece of code inside the sandbox.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of the failed load or call with
+	///          the error object on top of the sandbox's stack
+	inline
+	int runString(const char* code) const {
+		int status = luaL_loadstring(state, code);
+		if (status != LUA_OK)
+			return status;
+
+		return run();
+	}
+
+	/// Execute a file inside the sandbox.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of the failed load or call with
+	///          the error object on top of the sandbox's stack
+	inline
+	int runFile(const char* filepath) const {
+		int status = loadMappedFile(state, filepath);
+		if (status != LUA_OK)
+			return status;
+
+		return run();
+	}
+
+	/// Assign the sandbox's environment to the function on top of the sandbox's stack.
+	inline
+	void applyEnvironment() const {
+		push(state, env);
+
+#if LUA_VERSION_NUM <= 501
+		lua_setfenv(state, -2);
+#else
+		// The first upvalue of a main chunk is its '_ENV'.
+		if (!lua_setupvalue(state, -2, 1))
+			lua_pop(state, 1);
+#endif
+	}
+
+private:
+	inline
+	int run() const {
+		applyEnvironment();
+		return lua_pcall(state, 0, LUA_MULTRET, 0);
+	}
+};
+
+LUWRA_NS_END
+
+#endif
@@ -0,0 +1,569 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_SCHEDULER_H_
+#define LUWRA_SCHEDULER_H_
+
+#include "common.hpp"
+#include "stack.hpp"
+#include "usertypes.hpp"
+#include "types/coroutine.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Registry name of the light userdata which points to a state's scheduler
+	#define LUWRA_SCHEDULER_NAME LUWRA_REGISTRY_PREFIX "Scheduler"
+
+	// Pushed after the error message to tell the continuation of a waiting function to raise it.
+	// Inline functions share their static variables across translation units.
+	inline
+	void* wakeupErrorTag() {
+		static char tag;
+		return &tag;
+	}
+
+	// Values for a coroutine which is waiting for something; may be pushed from other threads.
+	// Outstanding wakeups keep this alive, even if the scheduler is gone.
+	struct SchedulerInbox {
+		using Entry = std::pair<uint64_t, std::function<int (State*)>>;
+
+		std::mutex mutex;
+		std::condition_variable signal;
+		std::vector<Entry> entries;
+		bool closed = false;
+
+		inline
+		void post(uint64_t id, std::function<int (State*)>&& push) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (closed)
+					return;
+
+				entries.emplace_back(id, std::move(push));
+			}
+
+			signal.notify_all();
+		}
+	};
+
+	// Raise the error which 'Wakeup::fail' has delivered, or return the delivered values.
+	inline
+	int finishWaiting(State* state) {
+		if (lua_touserdata(state, -1) == wakeupErrorTag()) {
+			lua_pop(state, 1);
+			return lua_error(state);
+		}
+
+		return lua_gettop(state);
+	}
+
+#if LUA_VERSION_NUM >= 503
+	inline
+	int continueWaiting(State* state, int, lua_KContext) {
+		return finishWaiting(state);
+	}
+#elif LUA_VERSION_NUM >= 502
+	inline
+	int continueWaiting(State* state) {
+		return finishWaiting(state);
+	}
+#endif
+
+#if LUA_VERSION_NUM >= 503
+	// Number of budgets a coroutine may use up while it cannot be yielded, before an error is
+	// raised in it
+	#ifndef LUWRA_SCHEDULER_OVERRUN_LIMIT
+		#define LUWRA_SCHEDULER_OVERRUN_LIMIT 10
+	#endif
+
+	// Thread which the scheduler on this OS thread is currently resuming, its budget, whether it
+	// has been preempted and how many budgets it has used up since without being able to yield
+	struct PreemptionState {
+		State* running;
+		int budget;
+		bool preempted;
+		int overruns;
+	};
+
+	inline
+	PreemptionState& preemption() {
+		static thread_local PreemptionState current = {nullptr, 0, false, 0};
+		return current;
+	}
+
+	// Count hook which yields the running coroutine once it has used up its budget.
+	//
+	// Threads which the coroutine has resumed inherit the hook, but must not be yielded. The
+	// coroutine is preempted as soon as it continues instead, i.e. after the first instruction
+	// once the nested resume has returned. Neither can the coroutine be yielded while it is inside
+	// a C function; it is checked again after another budget. A resume or a C function which does
+	// not return in time would escape the budget, hence it is stopped after a while.
+	inline
+	void preemptHook(State* state, lua_Debug*) {
+		PreemptionState& current = preemption();
+
+		if (state == current.running) {
+			if (lua_isyieldable(state)) {
+				current.preempted = true;
+
+				// Takes effect once the hook has returned
+				lua_yield(state, 0);
+				return;
+			}
+
+			lua_sethook(state, &preemptHook, LUA_MASKCOUNT, current.budget);
+		} else if (current.running) {
+			lua_sethook(current.running, &preemptHook, LUA_MASKCOUNT, 1);
+		}
+
+		if (++current.overruns >= LUWRA_SCHEDULER_OVERRUN_LIMIT)
+			luaL_error(state, "instruction budget has been exceeded");
+	}
+#endif
+
+	// CPU time which the calling thread has used, or the time of a steady clock where that is not
+	// available
+	inline
+	std::chrono::nanoseconds threadTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+		timespec now;
+
+		if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now) == 0)
+			return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+#endif
+
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		);
+	}
+
+	// Yield from a C function, so that the values which are delivered through a wakeup become its
+	// return values.
+	inline
+	int yieldWaiting(State* state) {
+		lua_settop(state, 0);
+
+#if LUA_VERSION_NUM >= 502
+		return lua_yieldk(state, 0, 0, &continueWaiting);
+#else
+		return lua_yield(state, 0);
+#endif
+	}
+}
+
+/// Handle for a coroutine which waits for something, see @ref Scheduler::await. Wakeups may be
+/// copied and used from any thread. Only the first call to @ref resume or @ref fail has an effect.
+struct Wakeup {
+	/// Continue the coroutine. The given function is invoked on the scheduler's thread; it pushes
+	/// the values which the waiting function returns and returns their number.
+	inline
+	void resume(std::function<int (State*)> push) const {
+		if (inbox)
+			inbox->post(id, std::move(push));
+	}
+
+	/// Continue the coroutine and let the waiting function return the given values.
+	template <typename... Types> inline
+	void resumeWith(Types... values) const {
+		resume([values...](State* state) {
+			return static_cast<int>(pushReturn(state, values...));
+		});
+	}
+
+	/// Continue the coroutine by raising an error in it. On Lua 5.1 the waiting function returns
+	/// `nil` and the message instead.
+	inline
+	void fail(const std::string& message) const {
+		resume([message](State* state) {
+#if LUA_VERSION_NUM >= 502
+			lua_pushlstring(state, message.data(), message.size());
+			lua_pushlightuserdata(state, internal::wakeupErrorTag());
+#else
+			lua_pushnil(state);
+			lua_pushlstring(state, message.data(), message.size());
+#endif
+			return 2;
+		});
+	}
+
+	uint64_t id;
+	std::shared_ptr<internal::SchedulerInbox> inbox;
+};
+
+/// Drives many Lua coroutines within one state. Coroutines run until they finish, yield or wait
+/// for something. Yielding coroutines are continued in round-robin order. Waiting coroutines are
+/// continued once their @ref Wakeup has been triggered, which is how C++ functions can perform
+/// work asynchronously without blocking the other coroutines.
+///
+/// The scheduler is not thread-safe, except for @ref Wakeup and @ref wait.
+///
+/// Example:
+///
+/// ```
+///   int sleepFor(State* state) {
+///       int milliseconds = read<int>(state, 1);
+///
+///       return Scheduler::current(state)->await(state, [milliseconds](Wakeup wakeup) {
+///           timers.add(milliseconds, [wakeup]() { wakeup.resumeWith(true); });
+///       });
+///   }
+/// ```
+/// ```
+///   Scheduler scheduler(state);
+///
+///   lua_getglobal(state, "handleRequest");
+///   scheduler.spawn(0);
+///
+///   while (scheduler.run() > 0)
+///       scheduler.wait(std::chrono::milliseconds(10));
+/// ```
+struct Scheduler {
+	/// Invoked when a coroutine has finished. `status` is `LUA_OK` if it has returned normally,
+	/// in which case its results are on the coroutine's stack. Otherwise the error message is on
+	/// top of it.
+	using Completion = std::function<void (State* thread, int status)>;
+
+	/// Accounting for a coroutine
+	struct Stats {
+		/// CPU time spent running the coroutine, including the C functions it has called. Where
+		/// the CPU time of a thread cannot be measured, this is the elapsed time instead.
+		std::chrono::nanoseconds cpu {0};
+
+		/// Number of times the coroutine has been resumed
+		size_t slices = 0;
+
+		/// Number of times the coroutine has been yielded because its budget ran out
+		size_t preemptions = 0;
+	};
+
+	/// Create a scheduler for the given state. There may only be one scheduler per state.
+	inline
+	Scheduler(State* state):
+		state(state),
+		inbox(std::make_shared<internal::SchedulerInbox>())
+	{
+		lua_pushlightuserdata(state, this);
+		lua_setfield(state, LUA_REGISTRYINDEX, LUWRA_SCHEDULER_NAME);
+	}
+
+	Scheduler(const Scheduler&) = delete;
+	Scheduler& operator =(const Scheduler&) = delete;
+
+	/// Release all coroutines. Wakeups which are still outstanding have no effect.
+	inline
+	~Scheduler() {
+		{
+			std::lock_guard<std::mutex> lock(inbox->mutex);
+			inbox->closed = true;
+			inbox->entries.clear();
+		}
+
+		for (auto& entry: coroutines)
+			luaL_unref(state, LUA_REGISTRYINDEX, entry.second.ref);
+
+		lua_pushnil(state);
+		lua_setfield(state, LUA_REGISTRYINDEX, LUWRA_SCHEDULER_NAME);
+	}
+
+	/// Retrieve the scheduler of a state or one of its threads.
+	///
+	/// \returns Scheduler or `nullptr` if there is none
+	static inline
+	Scheduler* current(State* state) {
+		lua_getfield(state, LUA_REGISTRYINDEX, LUWRA_SCHEDULER_NAME);
+		Scheduler* scheduler = static_cast<Scheduler*>(lua_touserdata(state, -1));
+		lua_pop(state, 1);
+
+		return scheduler;
+	}
+
+	/// Start a coroutine. The function and its arguments have to be on top of the stack; they are
+	/// removed. The coroutine begins running during the next call to @ref runOnce or @ref run.
+	///
+	/// \param arguments Number of arguments
+	/// \param done      Invoked once the coroutine has finished
+	/// \returns Coroutine thread
+	inline
+	State* spawn(int arguments = 0, const Completion& done = Completion()) {
+		State* thread = lua_newthread(state);
+
+		lua_insert(state, -(arguments + 2));
+		lua_xmove(state, thread, arguments + 1);
+
+		Coroutine& coroutine = coroutines[thread];
+		coroutine.id = ++lastId;
+		coroutine.ref = luaL_ref(state, LUA_REGISTRYINDEX);
+		coroutine.done = done;
+
+		ready.emplace_back(thread, arguments);
+
+		return thread;
+	}
+
+	/// Check whether a thread is a coroutine of this scheduler.
+	inline
+	bool owns(State* thread) const {
+		return coroutines.find(thread) != coroutines.end();
+	}
+
+	/// Mark the coroutine which is calling a C function as waiting. The C function must return
+	/// @ref yield afterwards; the coroutine continues once the returned @ref Wakeup is triggered.
+	/// Raises a Lua error if the thread is not a coroutine of this scheduler.
+	///
+	/// \param thread Coroutine thread, i.e. the state which has been passed to the C function
+	/// \returns Wakeup for the coroutine
+	inline
+	Wakeup suspend(State* thread) {
+		std::unordered_map<State*, Coroutine>::iterator it = coroutines.find(thread);
+
+		if (it == coroutines.end())
+			luaL_error(thread, "cannot wait outside of a scheduled coroutine");
+
+		it->second.waiting = true;
+		waiting[it->second.id] = thread;
+
+		return {it->second.id, inbox};
+	}
+
+	/// Yield from a C function whose coroutine has been suspended using @ref suspend. The values
+	/// which are delivered through the wakeup become the C function's return values.
+	///
+	/// Yielding does not unwind the C function's stack on Lua 5.2 and later, therefore no objects
+	/// with non-trivial destructors may be alive at this point.
+	///
+	/// \returns Value which the C function has to return
+	static inline
+	int yield(State* thread) {
+		return internal::yieldWaiting(thread);
+	}
+
+	/// Suspend the coroutine which is calling a C function and start the work it waits for. This
+	/// combines @ref suspend and @ref yield; `start` is moved into a local copy which is destroyed
+	/// before yielding.
+	///
+	/// \param thread Coroutine thread, i.e. the state which has been passed to the C function
+	/// \param start  Callable with the signature `void (Wakeup)` which starts the work
+	/// \returns Value which the C function has to return
+	template <typename Start> inline
+	int await(State* thread, Start&& start) {
+		if (!owns(thread))
+			return luaL_error(thread, "cannot wait outside of a scheduled coroutine");
+
+		{
+			typename std::decay<Start>::type callable(std::forward<Start>(start));
+			callable(suspend(thread));
+		}
+
+		return yield(thread);
+	}
+
+	/// Continue every coroutine which is ready once.
+	///
+	/// \returns Number of coroutines which have not finished
+	inline
+	size_t runOnce() {
+		collectWakeups();
+
+		for (size_t i = ready.size(); i > 0; i--) {
+			std::pair<State*, int> next = ready.front();
+			ready.pop_front();
+
+			resume(next.first, next.second);
+		}
+
+		return coroutines.size();
+	}
+
+	/// Continue coroutines until all of them have either finished or are waiting. Coroutines which
+	/// keep yielding keep this running.
+	///
+	/// \returns Number of coroutines which are waiting
+	inline
+	size_t run() {
+		do
+			runOnce();
+		while (!ready.empty() || hasWakeups());
+
+		return coroutines.size();
+	}
+
+	/// Block until a waiting coroutine has been woken up or the timeout has elapsed. It may be
+	/// called from any thread.
+	///
+	/// \returns `true` if a coroutine has been woken up
+	template <typename Rep, typename Period> inline
+	bool wait(std::chrono::duration<Rep, Period> timeout) const {
+		std::unique_lock<std::mutex> lock(inbox->mutex);
+
+		return inbox->signal.wait_for(lock, timeout, [this]() {
+			return !inbox->entries.empty();
+		});
+	}
+
+	/// Number of coroutines which have not finished
+	inline
+	size_t size() const {
+		return coroutines.size();
+	}
+
+	/// Limit the number of VM instructions a coroutine may execute each time it is resumed. A
+	/// coroutine which exceeds it is yielded and continues after all other ready coroutines had
+	/// their turn, so that a busy loop cannot stall the others. Coroutines cannot be yielded while
+	/// they are inside a C function, a metamethod or a coroutine they have resumed; they are
+	/// preempted once they have returned. If they exceed `LUWRA_SCHEDULER_OVERRUN_LIMIT` (10)
+	/// budgets in such a place, an error is raised in them.
+	///
+	/// The budget is enforced using a count hook, which replaces other hooks on the coroutines. It
+	/// requires Lua 5.3 or later and has no effect otherwise.
+	///
+	/// \param instructions Budget per time slice, 0 disables preemption
+	inline
+	void setBudget(int instructions) {
+		budget = instructions > 0 ? instructions : 0;
+	}
+
+	/// Instruction budget per time slice, see @ref setBudget
+	inline
+	int getBudget() const {
+		return budget;
+	}
+
+	/// Retrieve the accounting for a coroutine. Within a @ref Completion it covers the entire
+	/// lifetime of the finished coroutine.
+	///
+	/// \param thread Coroutine thread
+	/// \returns Accounting, or empty statistics if the thread is not a coroutine of this scheduler
+	inline
+	Stats stats(State* thread) const {
+		std::unordered_map<State*, Coroutine>::const_iterator it = coroutines.find(thread);
+		return it == coroutines.end() ? Stats() : it->second.stats;
+	}
+
+private:
+	struct Coroutine {
+		uint64_t id = 0;
+		int ref = LUA_NOREF;
+		Completion done;
+		bool waiting = false;
+		Stats stats;
+	};
+
+	State* state;
+	std::shared_ptr<internal::SchedulerInbox> inbox;
+
+	std::unordered_map<State*, Coroutine> coroutines;
+	std::unordered_map<uint64_t, State*> waiting;
+	std::deque<std::pair<State*, int>> ready;
+	uint64_t lastId = 0;
+	int budget = 0;
+
+	inline
+	bool hasWakeups() const {
+		std::lock_guard<std::mutex> lock(inbox->mutex);
+		return !inbox->entries.empty();
+	}
+
+	// Move coroutines whose wakeups have been triggered into the ready queue.
+	inline
+	void collectWakeups() {
+		std::vector<internal::SchedulerInbox::Entry> entries;
+
+		{
+			std::lock_guard<std::mutex> lock(inbox->mutex);
+			entries.swap(inbox->entries);
+		}
+
+		for (internal::SchedulerInbox::Entry& entry: entries) {
+			std::unordered_map<uint64_t, State*>::iterator it = waiting.find(entry.first);
+
+			// Wakeups after the first one are ignored
+			if (it == waiting.end())
+				continue;
+
+			State* thread = it->second;
+			waiting.erase(it);
+
+			coroutines[thread].waiting = false;
+			ready.emplace_back(thread, entry.second(thread));
+		}
+	}
+
+	inline
+	void resume(State* thread, int arguments) {
+#if LUA_VERSION_NUM >= 503
+		// Setting the hook again also refills the budget
+		if (budget > 0)
+			lua_sethook(thread, &internal::preemptHook, LUA_MASKCOUNT, budget);
+		else if (lua_gethook(thread) == &internal::preemptHook)
+			lua_sethook(thread, nullptr, 0, 0);
+
+		internal::PreemptionState& preemption = internal::preemption();
+		internal::PreemptionState outer = preemption;
+		preemption = {thread, budget, false, 0};
+#endif
+
+		std::chrono::nanoseconds start = internal::threadTime();
+
+		int results = 0;
+		int status = internal::resumeThread(thread, state, arguments, &results);
+
+		std::unordered_map<State*, Coroutine>::iterator it = coroutines.find(thread);
+
+		Stats& stats = it->second.stats;
+		stats.cpu += internal::threadTime() - start;
+		stats.slices++;
+
+#if LUA_VERSION_NUM >= 503
+		if (preemption.preempted)
+			stats.preemptions++;
+
+		preemption = outer;
+#endif
+
+		if (status == LUA_YIELD) {
+			// Values passed to 'coroutine.yield' are discarded
+			lua_settop(thread, 0);
+
+			if (!it->second.waiting)
+				ready.emplace_back(thread, 0);
+
+			return;
+		}
+
+		// The coroutine stays registered during the completion, so that its statistics are
+		// available.
+		Completion done = std::move(it->second.done);
+
+		if (done)
+			done(thread, status);
+
+		it = coroutines.find(thread);
+		int ref = it->second.ref;
+		coroutines.erase(it);
+
+		luaL_unref(state, LUA_REGISTRYINDEX, ref);
+	}
+};
+
+LUWRA_NS_END
+
+#endif
@@ -0,0 +1,1185 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_SERIALIZE_H_
+#define LUWRA_SERIALIZE_H_
+
+#include "common.hpp"
+#include "stack.hpp"
+#include "usertypes.hpp"
+#include "cache.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Registry name of the table which holds the serialisation hooks
+	#define LUWRA_SERIALIZERS_NAME LUWRA_REGISTRY_PREFIX "Serializers"
+
+	// Strings of at least this length are written once, repeated occurrences refer to the first one
+	#ifndef LUWRA_SERIALIZE_DEDUP_LENGTH
+		#define LUWRA_SERIALIZE_DEDUP_LENGTH 4
+	#endif
+
+	// Upper bound for the size hints when creating tables. Hints are further limited by the size of
+	// the input, if the source can tell it.
+	#ifndef LUWRA_SERIALIZE_MAX_PRESIZE
+		#define LUWRA_SERIALIZE_MAX_PRESIZE (1 << 20)
+	#endif
+
+	// Nesting limit, protects the C stack
+	#ifndef LUWRA_SERIALIZE_MAX_DEPTH
+		#define LUWRA_SERIALIZE_MAX_DEPTH 1000
+	#endif
+
+	// Push the globals table.
+	inline
+	void pushGlobals(State* state) {
+#if LUA_VERSION_NUM <= 501
+		lua_pushvalue(state, LUA_GLOBALSINDEX);
+#else
+		lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+#endif
+	}
+
+	// Push the table which holds the serialisation hooks. It maps metatables of user types to
+	// their name and 'save' hook, and names to the 'load' hook.
+	inline
+	void pushSerializers(State* state) {
+		lua_getfield(state, LUA_REGISTRYINDEX, LUWRA_SERIALIZERS_NAME);
+
+		if (!lua_istable(state, -1)) {
+			lua_pop(state, 1);
+			lua_newtable(state);
+			lua_pushvalue(state, -1);
+			lua_setfield(state, LUA_REGISTRYINDEX, LUWRA_SERIALIZERS_NAME);
+		}
+	}
+
+	// Leading byte of every serialised value
+	enum SerialTag {
+		SerialNil,
+		SerialFalse,
+		SerialTrue,
+		SerialInteger,
+		SerialNumber,
+		SerialString,
+		SerialTable,
+		SerialFunction,
+		SerialUserData,
+		SerialReference,
+		SerialGlobals,
+		SerialPermanent,
+		SerialUpvalueJoin,
+		SerialStringReference
+	};
+
+	// Sink which appends to a 'std::string'
+	struct StringSink {
+		std::string& output;
+
+		inline
+		void write(const char* data, size_t length) {
+			output.append(data, length);
+		}
+	};
+
+	// Sink which writes to a file
+	struct FileSink {
+		std::FILE* file;
+		bool failed = false;
+
+		inline
+		FileSink(std::FILE* file):
+			file(file)
+		{}
+
+		inline
+		void write(const char* data, size_t length) {
+			if (!failed && std::fwrite(data, 1, length, file) != length)
+				failed = true;
+		}
+	};
+
+	// Source which reads from a contiguous piece of memory
+	struct MemorySource {
+		const char* data;
+		size_t size;
+		size_t position = 0;
+
+		inline
+		MemorySource(const char* data, size_t size):
+			data(data),
+			size(size)
+		{}
+
+		// Returns 'nullptr' if less than 'length' bytes are left.
+		inline
+		const char* read(size_t length) {
+			if (length > size - position)
+				return nullptr;
+
+			const char* result = data + position;
+			position += length;
+
+			return result;
+		}
+
+		inline
+		size_t remaining() const {
+			return size - position;
+		}
+	};
+
+	// Number of bytes which a source has left, if it provides 'remaining'
+	template <typename Source> inline
+	auto remainingInput(const Source& source, int) -> decltype(size_t(source.remaining())) {
+		return source.remaining();
+	}
+
+	template <typename Source> inline
+	size_t remainingInput(const Source&, long) {
+		return LUWRA_SERIALIZE_MAX_PRESIZE;
+	}
+
+	// Writes values into a sink. Tables, functions and user data are numbered in the order in which
+	// they are encountered, repeated occurrences only refer to that number. Objects which belong to
+	// the environment of a state (see 'collectPermanents') are written by name.
+	//
+	// Errors are raised as Lua errors, therefore encoding has to happen in protected mode.
+	template <typename Sink>
+	struct Encoder {
+		State* state;
+		Sink& sink;
+
+		// Stack indices of helper tables: object to number, string to number, object to module and
+		// object to field
+		int ids = 0;
+		int strings = 0;
+		int modules = 0;
+		int fields = 0;
+
+		size_t count = 0;
+		size_t stringCount = 0;
+		size_t depth = 0;
+
+		// Buffer for 'lua_dump'
+		std::string bytecode;
+
+#if LUA_VERSION_NUM >= 502
+		// Upvalues which have been written, and the function and upvalue index they belong to
+		std::unordered_map<void*, std::pair<size_t, int>> upvalues;
+#endif
+
+		inline
+		Encoder(State* state, Sink& sink):
+			state(state),
+			sink(sink)
+		{}
+
+		// Push the helper tables. Permanent objects are written by name if 'with_permanents' is
+		// set.
+		inline
+		void prepare(bool with_permanents) {
+			lua_newtable(state);
+			ids = lua_gettop(state);
+
+			lua_newtable(state);
+			strings = lua_gettop(state);
+
+			if (with_permanents) {
+				lua_newtable(state);
+				modules = lua_gettop(state);
+
+				lua_newtable(state);
+				fields = lua_gettop(state);
+
+				collectPermanents();
+			}
+		}
+
+		inline
+		void writeByte(unsigned char byte) {
+			sink.write(reinterpret_cast<const char*>(&byte), 1);
+		}
+
+		inline
+		void writeVarint(uint64_t value) {
+			char buffer[10];
+			size_t length = 0;
+
+			while (value >= 0x80) {
+				buffer[length++] = static_cast<char>((value & 0x7F) | 0x80);
+				value >>= 7;
+			}
+
+			buffer[length++] = static_cast<char>(value);
+			sink.write(buffer, length);
+		}
+
+		inline
+		void writeInteger(int64_t value) {
+			writeByte(SerialInteger);
+
+			// Zig-zag encoding keeps small negative numbers short
+			writeVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+		}
+
+		inline
+		void writeNumber(double value) {
+			uint64_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+
+			char buffer[8];
+			for (size_t i = 0; i < 8; i++)
+				buffer[i] = static_cast<char>((bits >> (i * 8)) & 0xFF);
+
+			writeByte(SerialNumber);
+			sink.write(buffer, 8);
+		}
+
+		inline
+		void writeString(const char* data, size_t length) {
+			writeVarint(length);
+			sink.write(data, length);
+		}
+
+		// Write the value at the given (absolute) index.
+		inline
+		void encode(int index) {
+			switch (lua_type(state, index)) {
+				case LUA_TNIL:
+					writeByte(SerialNil);
+					break;
+
+				case LUA_TBOOLEAN:
+					writeByte(lua_toboolean(state, index) ? SerialTrue : SerialFalse);
+					break;
+
+				case LUA_TNUMBER:
+					encodeNumber(index);
+					break;
+
+				case LUA_TSTRING:
+					encodeString(index);
+					break;
+
+				case LUA_TTABLE:
+				case LUA_TFUNCTION:
+				case LUA_TUSERDATA:
+					encodeObject(index);
+					break;
+
+				default:
+					luaL_error(state, "cannot serialize a %s", luaL_typename(state, index));
+			}
+		}
+
+		inline
+		void encodeNumber(int index) {
+#if LUA_VERSION_NUM >= 503
+			if (lua_isinteger(state, index)) {
+				writeInteger(lua_tointeger(state, index));
+				return;
+			}
+
+			writeNumber(lua_tonumber(state, index));
+#else
+			double value = lua_tonumber(state, index);
+
+			if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0)
+				writeInteger(static_cast<int64_t>(value));
+			else
+				writeNumber(value);
+#endif
+		}
+
+		inline
+		void encodeString(int index) {
+			size_t length;
+			const char* data = lua_tolstring(state, index, &length);
+
+			if (length >= LUWRA_SERIALIZE_DEDUP_LENGTH) {
+				lua_pushvalue(state, index);
+				lua_rawget(state, strings);
+
+				if (!lua_isnil(state, -1)) {
+					writeByte(SerialStringReference);
+					writeVarint(static_cast<uint64_t>(lua_tonumber(state, -1)));
+					lua_pop(state, 1);
+					return;
+				}
+
+				lua_pop(state, 1);
+
+				lua_pushvalue(state, index);
+				lua_pushnumber(state, static_cast<lua_Number>(stringCount++));
+				lua_rawset(state, strings);
+			}
+
+			writeByte(SerialString);
+			writeString(data, length);
+		}
+
+		// Check whether the key at the given index lies within '1..length'.
+		inline
+		bool isArrayKey(int index, size_t length) {
+			if (lua_type(state, index) != LUA_TNUMBER)
+				return false;
+
+#if LUA_VERSION_NUM >= 503
+			if (!lua_isinteger(state, index))
+				return false;
+
+			lua_Integer key = lua_tointeger(state, index);
+			return key >= 1 && static_cast<size_t>(key) <= length;
+#else
+			lua_Number key = lua_tonumber(state, index);
+			return key >= 1 && key <= static_cast<lua_Number>(length) && key == std::floor(key);
+#endif
+		}
+
+		// Write the fields of the table at the given index, without its metatable. The sequence
+		// '1..n' is written as array part, i.e. without its keys.
+		inline
+		void encodeFields(int index) {
+			size_t array_length = 0;
+
+			for (;;) {
+				lua_rawgeti(state, index, static_cast<int>(array_length + 1));
+				bool end = lua_isnil(state, -1);
+				lua_pop(state, 1);
+
+				if (end)
+					break;
+
+				array_length++;
+			}
+
+			size_t length = 0;
+
+			lua_pushnil(state);
+			while (lua_next(state, index) != 0) {
+				length++;
+				lua_pop(state, 1);
+			}
+
+			writeVarint(array_length);
+			writeVarint(length - array_length);
+
+			for (size_t i = 1; i <= array_length; i++) {
+				lua_rawgeti(state, index, static_cast<int>(i));
+				encode(lua_gettop(state));
+				lua_pop(state, 1);
+			}
+
+			lua_pushnil(state);
+			while (lua_next(state, index) != 0) {
+				int top = lua_gettop(state);
+
+				if (!isArrayKey(top - 1, array_length)) {
+					encode(top - 1);
+					encode(top);
+				}
+
+				lua_pop(state, 1);
+			}
+		}
+
+		inline
+		void encodeObject(int index) {
+			if (depth >= LUWRA_SERIALIZE_MAX_DEPTH)
+				luaL_error(state, "cannot serialize: nesting is too deep");
+
+			luaL_checkstack(state, 8, "cannot serialize: nesting is too deep");
+
+			// Globals
+			pushGlobals(state);
+			bool is_globals = lua_rawequal(state, index, -1) != 0;
+			lua_pop(state, 1);
+
+			if (is_globals && modules != 0) {
+				writeByte(SerialGlobals);
+				return;
+			}
+
+			// Objects which have been written before
+			lua_pushvalue(state, index);
+			lua_rawget(state, ids);
+
+			if (!lua_isnil(state, -1)) {
+				writeByte(SerialReference);
+				writeVarint(static_cast<uint64_t>(lua_tonumber(state, -1)));
+				lua_pop(state, 1);
+				return;
+			}
+
+			lua_pop(state, 1);
+
+			// Objects which are part of the environment
+			if (modules != 0 && encodePermanent(index))
+				return;
+
+			size_t id = count++;
+
+			lua_pushvalue(state, index);
+			lua_pushnumber(state, static_cast<lua_Number>(id));
+			lua_rawset(state, ids);
+
+			depth++;
+
+			switch (lua_type(state, index)) {
+				case LUA_TTABLE:
+					writeByte(SerialTable);
+					encodeFields(index);
+
+					if (lua_getmetatable(state, index)) {
+						encode(lua_gettop(state));
+						lua_pop(state, 1);
+					} else {
+						writeByte(SerialNil);
+					}
+
+					break;
+
+				case LUA_TFUNCTION:
+					encodeFunction(index, id);
+					break;
+
+				default:
+					encodeUserData(index);
+					break;
+			}
+
+			depth--;
+		}
+
+		inline
+		bool encodePermanent(int index) {
+			lua_pushvalue(state, index);
+			lua_rawget(state, modules);
+
+			if (lua_isnil(state, -1)) {
+				lua_pop(state, 1);
+				return false;
+			}
+
+			size_t length;
+			const char* module = lua_tolstring(state, -1, &length);
+
+			writeByte(SerialPermanent);
+			writeString(module, length);
+
+			lua_pushvalue(state, index);
+			lua_rawget(state, fields);
+
+			if (lua_isnil(state, -1)) {
+				writeByte(0);
+			} else {
+				const char* field = lua_tolstring(state, -1, &length);
+
+				writeByte(1);
+				writeString(field, length);
+			}
+
+			lua_pop(state, 2);
+			return true;
+		}
+
+		inline
+		void encodeFunction(int index, size_t id) {
+			if (lua_iscfunction(state, index))
+				luaL_error(state, "cannot serialize a C function");
+
+			lua_pushvalue(state, index);
+			bytecode.clear();
+			dumpFunction(state, bytecode);
+			lua_pop(state, 1);
+
+			writeByte(SerialFunction);
+			writeString(bytecode.data(), bytecode.size());
+
+			int upvalue_count = 0;
+			while (lua_getupvalue(state, index, upvalue_count + 1)) {
+				lua_pop(state, 1);
+				upvalue_count++;
+			}
+
+			writeVarint(static_cast<uint64_t>(upvalue_count));
+
+			for (int i = 1; i <= upvalue_count; i++) {
+#if LUA_VERSION_NUM >= 502
+				// Upvalues which are shared between closures are written once
+				void* upvalue = lua_upvalueid(state, index, i);
+				auto it = upvalues.find(upvalue);
+
+				if (it != upvalues.end()) {
+					writeByte(SerialUpvalueJoin);
+					writeVarint(it->second.first);
+					writeVarint(static_cast<uint64_t>(it->second.second));
+					continue;
+				}
+
+				upvalues.emplace(upvalue, std::make_pair(id, i));
+#else
+				(void) id;
+#endif
+
+				lua_getupvalue(state, index, i);
+				encode(lua_gettop(state));
+				lua_pop(state, 1);
+			}
+		}
+
+		inline
+		void encodeUserData(int index) {
+			pushSerializers(state);
+
+			if (!lua_getmetatable(state, index))
+				lua_pushnil(state);
+
+			lua_rawget(state, -2);
+
+			if (!lua_istable(state, -1))
+				luaL_error(state, "cannot serialize a userdata without serialization hooks");
+
+			// Name
+			lua_rawgeti(state, -1, 1);
+			size_t length;
+			const char* name = lua_tolstring(state, -1, &length);
+
+			writeByte(SerialUserData);
+			writeString(name, length);
+			lua_pop(state, 1);
+
+			// Representation
+			lua_rawgeti(state, -1, 2);
+			lua_pushvalue(state, index);
+			lua_call(state, 1, 1);
+
+			encode(lua_gettop(state));
+
+			lua_pop(state, 3);
+		}
+
+		// Collect the objects which the target state is expected to provide: modules in
+		// 'package.loaded' which consist of C functions only, all C functions in these modules and
+		// C functions in the globals.
+		inline
+		void collectPermanents() {
+			lua_getfield(state, LUA_REGISTRYINDEX, "_LOADED");
+
+			if (lua_istable(state, -1)) {
+				int loaded = lua_gettop(state);
+
+				lua_pushnil(state);
+				while (lua_next(state, loaded) != 0) {
+					if (lua_type(state, -2) == LUA_TSTRING && lua_istable(state, -1))
+						collectModule(lua_gettop(state) - 1, lua_gettop(state));
+
+					lua_pop(state, 1);
+				}
+			}
+
+			lua_pop(state, 1);
+
+			pushGlobals(state);
+			lua_pushstring(state, "_G");
+			collectFunctions(lua_gettop(state), lua_gettop(state) - 1);
+			lua_pop(state, 2);
+		}
+
+		inline
+		void collectModule(int name, int module) {
+			pushGlobals(state);
+			bool is_globals = lua_rawequal(state, module, -1) != 0;
+			lua_pop(state, 1);
+
+			if (is_globals)
+				return;
+
+			bool native = collectFunctions(name, module);
+
+			lua_pushvalue(state, module);
+			lua_rawget(state, modules);
+
+			if (native && lua_isnil(state, -1)) {
+				lua_pushvalue(state, module);
+				lua_pushvalue(state, name);
+				lua_rawset(state, modules);
+			}
+
+			lua_pop(state, 1);
+		}
+
+		// Register the C functions in the given table. Returns 'true' if it contains no Lua
+		// functions.
+		inline
+		bool collectFunctions(int name, int table) {
+			bool native = true;
+
+			lua_pushnil(state);
+			while (lua_next(state, table) != 0) {
+				if (lua_iscfunction(state, -1) && lua_type(state, -2) == LUA_TSTRING) {
+					lua_pushvalue(state, -1);
+					lua_rawget(state, modules);
+
+					if (lua_isnil(state, -1)) {
+						lua_pushvalue(state, -2);
+						lua_pushvalue(state, name);
+						lua_rawset(state, modules);
+
+						lua_pushvalue(state, -2);
+						lua_pushvalue(state, -4);
+						lua_rawset(state, fields);
+					}
+
+					lua_pop(state, 1);
+				} else if (lua_type(state, -1) == LUA_TFUNCTION) {
+					native = false;
+				}
+
+				lua_pop(state, 1);
+			}
+
+			return native;
+		}
+	};
+
+	// Reads values from a source which have been written using 'Encoder'. Errors are raised as
+	// Lua errors, therefore decoding has to happen in protected mode.
+	template <typename Source>
+	struct Decoder {
+		State* state;
+		Source& source;
+
+		// Stack indices of the tables which map numbers to objects and strings
+		int ids = 0;
+		int strings = 0;
+
+		size_t count = 0;
+		size_t stringCount = 0;
+		size_t depth = 0;
+
+		// Functions carry bytecode, which is loaded without verification
+		bool allowFunctions;
+
+		// Table slots which may still be allocated ahead of reading the fields
+		size_t presizeBudget;
+
+		inline
+		Decoder(State* state, Source& source, bool allowFunctions):
+			state(state),
+			source(source),
+			allowFunctions(allowFunctions),
+			presizeBudget(remainingInput(source, 0))
+		{}
+
+		inline
+		void prepare() {
+			lua_newtable(state);
+			ids = lua_gettop(state);
+
+			lua_newtable(state);
+			strings = lua_gettop(state);
+		}
+
+		inline
+		const char* read(size_t length) {
+			const char* data = source.read(length);
+
+			if (!data)
+				luaL_error(state, "cannot deserialize: unexpected end of data");
+
+			return data;
+		}
+
+		inline
+		unsigned char readByte() {
+			return static_cast<unsigned char>(*read(1));
+		}
+
+		inline
+		uint64_t readVarint() {
+			uint64_t value = 0;
+
+			for (unsigned shift = 0; shift < 64; shift += 7) {
+				unsigned char byte = readByte();
+				value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+
+				if ((byte & 0x80) == 0)
+					return value;
+			}
+
+			luaL_error(state, "cannot deserialize: malformed integer");
+			return 0;
+		}
+
+		inline
+		size_t pushString() {
+			size_t length = static_cast<size_t>(readVarint());
+			lua_pushlstring(state, read(length), length);
+
+			return length;
+		}
+
+		// Register the object on top of the stack.
+		inline
+		void remember(size_t id) {
+			lua_pushvalue(state, -1);
+			lua_rawseti(state, ids, static_cast<int>(id + 1));
+		}
+
+		// Read a value and push it.
+		inline
+		void decode() {
+			decode(readByte());
+		}
+
+		inline
+		void decode(unsigned char tag) {
+			luaL_checkstack(state, 8, "cannot deserialize: nesting is too deep");
+
+			switch (tag) {
+				case SerialNil:
+					lua_pushnil(state);
+					break;
+
+				case SerialFalse:
+				case SerialTrue:
+					lua_pushboolean(state, tag == SerialTrue);
+					break;
+
+				case SerialInteger: {
+					uint64_t raw = readVarint();
+					int64_t value = static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+
+#if LUA_VERSION_NUM >= 503
+					lua_pushinteger(state, static_cast<lua_Integer>(value));
+#else
+					lua_pushnumber(state, static_cast<lua_Number>(value));
+#endif
+					break;
+				}
+
+				case SerialNumber: {
+					const char* buffer = read(8);
+
+					uint64_t bits = 0;
+					for (size_t i = 0; i < 8; i++)
+						bits |= static_cast<uint64_t>(static_cast<unsigned char>(buffer[i])) << (i * 8);
+
+					double value;
+					std::memcpy(&value, &bits, sizeof(value));
+
+					lua_pushnumber(state, static_cast<lua_Number>(value));
+					break;
+				}
+
+				case SerialString:
+					if (pushString() >= LUWRA_SERIALIZE_DEDUP_LENGTH) {
+						lua_pushvalue(state, -1);
+						lua_rawseti(state, strings, static_cast<int>(++stringCount));
+					}
+
+					break;
+
+				case SerialStringReference: {
+					uint64_t id = readVarint();
+					if (id >= stringCount)
+						luaL_error(state, "cannot deserialize: invalid string reference");
+
+					lua_rawgeti(state, strings, static_cast<int>(id + 1));
+					break;
+				}
+
+				case SerialTable:
+					enter();
+					decodeTable();
+					depth--;
+					break;
+
+				case SerialFunction:
+					if (!allowFunctions)
+						luaL_error(state, "cannot deserialize: functions are not allowed");
+
+					enter();
+					decodeFunction();
+					depth--;
+					break;
+
+				case SerialUserData:
+					enter();
+					decodeUserData();
+					depth--;
+					break;
+
+				case SerialReference: {
+					uint64_t id = readVarint();
+					if (id >= count)
+						luaL_error(state, "cannot deserialize: invalid reference");
+
+					lua_rawgeti(state, ids, static_cast<int>(id + 1));
+					break;
+				}
+
+				case SerialGlobals:
+					pushGlobals(state);
+					break;
+
+				case SerialPermanent:
+					decodePermanent();
+					break;
+
+				default:
+					luaL_error(state, "cannot deserialize: unknown tag %d", int(tag));
+			}
+		}
+
+		inline
+		void enter() {
+			if (++depth > LUWRA_SERIALIZE_MAX_DEPTH)
+				luaL_error(state, "cannot deserialize: nesting is too deep");
+		}
+
+		// Size hint for a table. Every field takes at least one byte of input, therefore the hints
+		// of all tables together need not exceed the size of the input.
+		inline
+		int presize(size_t length) {
+			size_t hint = length < presizeBudget ? length : presizeBudget;
+
+			if (hint > LUWRA_SERIALIZE_MAX_PRESIZE)
+				hint = LUWRA_SERIALIZE_MAX_PRESIZE;
+
+			presizeBudget -= hint;
+			return static_cast<int>(hint);
+		}
+
+		// Read fields into the table at the given index.
+		inline
+		void decodeFields(int table, size_t array_length, size_t hash_length) {
+			for (size_t i = 1; i <= array_length; i++) {
+				decode();
+				lua_rawseti(state, table, static_cast<int>(i));
+			}
+
+			for (size_t i = 0; i < hash_length; i++) {
+				decode();
+				decode();
+
+				if (lua_isnil(state, -2))
+					luaL_error(state, "cannot deserialize: table key is nil");
+
+				lua_rawset(state, table);
+			}
+		}
+
+		inline
+		void decodeTable() {
+			size_t array_length = static_cast<size_t>(readVarint());
+			size_t hash_length = static_cast<size_t>(readVarint());
+
+			lua_createtable(state, presize(array_length), presize(hash_length));
+			remember(count++);
+
+			decodeFields(lua_gettop(state), array_length, hash_length);
+
+			decode();
+			if (lua_istable(state, -1))
+				lua_setmetatable(state, -2);
+			else
+				lua_pop(state, 1);
+		}
+
+		inline
+		void decodeFunction() {
+			size_t length = static_cast<size_t>(readVarint());
+			const char* bytecode = read(length);
+
+#if LUA_VERSION_NUM >= 502
+			if (luaL_loadbufferx(state, bytecode, length, "=deserialize", "b") != LUA_OK)
+				lua_error(state);
+#else
+			if (luaL_loadbuffer(state, bytecode, length, "=deserialize") != LUA_OK)
+				lua_error(state);
+#endif
+
+			size_t id = count++;
+			remember(id);
+
+			int function = lua_gettop(state);
+			int upvalue_count = static_cast<int>(readVarint());
+
+			for (int i = 1; i <= upvalue_count; i++) {
+				// The function must actually have this upvalue
+				if (!lua_getupvalue(state, function, i))
+					luaL_error(state, "cannot deserialize: invalid upvalue");
+
+				lua_pop(state, 1);
+
+				unsigned char tag = readByte();
+
+				if (tag == SerialUpvalueJoin) {
+#if LUA_VERSION_NUM >= 502
+					size_t other = static_cast<size_t>(readVarint());
+					int other_index = static_cast<int>(readVarint());
+
+					lua_rawgeti(state, ids, static_cast<int>(other + 1));
+					if (
+						other >= id
+						|| !lua_isfunction(state, -1)
+						|| !lua_getupvalue(state, -1, other_index)
+					)
+						luaL_error(state, "cannot deserialize: invalid shared upvalue");
+
+					lua_pop(state, 1);
+
+					lua_upvaluejoin(state, function, i, -1, other_index);
+					lua_pop(state, 1);
+#else
+					luaL_error(state, "cannot deserialize: shared upvalues are not supported");
+#endif
+				} else {
+					decode(tag);
+					lua_setupvalue(state, function, i);
+				}
+			}
+		}
+
+		inline
+		void decodeUserData() {
+			// The number is reserved now, the object is created once its representation is known.
+			size_t id = count++;
+
+			pushString();
+
+			pushSerializers(state);
+			lua_pushvalue(state, -2);
+			lua_rawget(state, -2);
+
+			if (!lua_isfunction(state, -1))
+				luaL_error(state, "cannot deserialize: no hooks for '%s'", lua_tostring(state, -3));
+
+			decode();
+			lua_call(state, 1, 1);
+
+			lua_replace(state, -3);
+			lua_pop(state, 1);
+
+			remember(id);
+		}
+
+		inline
+		void decodePermanent() {
+			pushString();
+
+			if (std::strcmp(lua_tostring(state, -1), "_G") == 0) {
+				pushGlobals(state);
+			} else {
+				lua_getfield(state, LUA_REGISTRYINDEX, "_LOADED");
+				if (lua_istable(state, -1)) {
+					lua_pushvalue(state, -2);
+					lua_rawget(state, -2);
+					lua_remove(state, -2);
+				}
+			}
+
+			if (readByte() != 0) {
+				pushString();
+
+				if (lua_istable(state, -2)) {
+					lua_pushvalue(state, -1);
+					lua_rawget(state, -3);
+				} else {
+					lua_pushnil(state);
+				}
+
+				if (lua_isnil(state, -1))
+					luaL_error(
+						state,
+						"cannot deserialize: '%s.%s' is not available",
+						lua_tostring(state, -4),
+						lua_tostring(state, -2)
+					);
+
+				lua_replace(state, -4);
+				lua_pop(state, 2);
+			} else {
+				if (lua_isnil(state, -1))
+					luaL_error(
+						state,
+						"cannot deserialize: module '%s' is not available",
+						lua_tostring(state, -2)
+					);
+
+				lua_replace(state, -2);
+			}
+		}
+	};
+}
+
+namespace internal {
+	// Protected part of 'serialize'
+	template <typename Sink>
+	int serializeValue(State* state) {
+		Encoder<Sink>* encoder = static_cast<Encoder<Sink>*>(lua_touserdata(state, 1));
+		encoder->prepare(false);
+		encoder->encode(2);
+
+		return 0;
+	}
+
+	// Protected part of 'deserialize'
+	template <typename Source>
+	int deserializeValue(State* state) {
+		Decoder<Source>* decoder = static_cast<Decoder<Source>*>(lua_touserdata(state, 1));
+		decoder->prepare();
+		decoder->decode();
+
+		return 1;
+	}
+}
+
+/// Serialize a value into a compact binary representation.
+///
+/// Booleans, numbers, strings, tables (including metatables, shared references and cycles), Lua
+/// functions with their upvalues and user types with hooks (see @ref registerSerializer) are
+/// supported. Sequences are written without their keys, and strings which occur more than once
+/// are only written once. Integers are stored as variable-length integers.
+///
+/// The output is streamed into the sink as it is produced; nothing is buffered in between.
+///
+/// \param state Lua state
+/// \param index Index of the value
+/// \param sink  Receives the output. It has to provide a method
+///              `void write(const char* data, size_t length)`.
+/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+///          stack
+template <typename Sink> inline
+int serialize(State* state, int index, Sink& sink) {
+	if (index < 0 && index > LUA_REGISTRYINDEX)
+		index = lua_gettop(state) + index + 1;
+
+	internal::Encoder<Sink> encoder(state, sink);
+
+	lua_pushcfunction(state, &internal::serializeValue<Sink>);
+	lua_pushlightuserdata(state, &encoder);
+	lua_pushvalue(state, index);
+
+	return lua_pcall(state, 2, 0, 0);
+}
+
+/// Same as @ref serialize but appends the output to a string.
+///
+/// Example:
+///
+/// ```
+///   std::string buffer;
+///   serialize(state, -1, buffer);
+///
+///   // Possibly in another process
+///   deserialize(other_state, buffer.data(), buffer.size());
+/// ```
+inline
+int serialize(State* state, int index, std::string& output) {
+	internal::StringSink sink {output};
+	return serialize(state, index, sink);
+}
+
+/// Read a value which has been written using @ref serialize and push it.
+///
+/// Functions are rejected unless they are explicitly allowed. Their bytecode is loaded without
+/// verification, therefore only allow them for data from trusted parties.
+///
+/// \param state          Lua state
+/// \param source         Provides the input. It has to provide a method
+///                       `const char* read(size_t length)` which returns a pointer to the next
+///                       `length` bytes, or `nullptr` if there are not enough bytes left. The
+///                       pointer only needs to remain valid until the next call. It may also
+///                       provide `size_t remaining() const`, which limits how much memory is
+///                       reserved for tables ahead of decoding their fields.
+/// \param allowFunctions Whether the input may contain functions
+/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+///          stack
+template <typename Source> inline
+int deserialize(State* state, Source& source, bool allowFunctions = false) {
+	internal::Decoder<Source> decoder(state, source, allowFunctions);
+
+	lua_pushcfunction(state, &internal::deserializeValue<Source>);
+	lua_pushlightuserdata(state, &decoder);
+
+	return lua_pcall(state, 1, 1, 0);
+}
+
+/// Same as @ref deserialize but reads from memory.
+inline
+int deserialize(State* state, const char* data, size_t size, bool allowFunctions = false) {
+	internal::MemorySource source(data, size);
+	return deserialize(state, source, allowFunctions);
+}
+
+/// Register hooks which (de)serialise instances of a user type.
+///
+/// \tparam UserType User type
+/// \param  state Lua state
+/// \param  name  Name which identifies the user type in serialised data; must be the same for
+///               serialising and deserialising states
+/// \param  save  Function which receives an instance and returns a serialisable representation
+/// \param  load  Function which receives the representation and returns a new instance
+///
+/// Example:
+///
+/// ```
+///   static int savePoint(State* state) {
+///       Point& point = read<Point&>(state, 1);
+///       push(state, std::to_string(point.x) + " " + std::to_string(point.y));
+///       return 1;
+///   }
+///
+///   static int loadPoint(State* state) {
+///       double x, y;
+///       std::sscanf(read<const char*>(state, 1), "%lf %lf", &x, &y);
+///       construct<Point>(state, x, y);
+///       return 1;
+///   }
+///
+///   registerSerializer<Point>(state, "Point", &savePoint, &loadPoint);
+/// ```
+template <typename UserType, typename Save, typename Load> inline
+void registerSerializer(State* state, const char* name, Save&& save, Load&& load) {
+	using Wrapper = internal::UserTypeWrapper<UserType>;
+
+	internal::pushSerializers(state);
+
+	// metatable -> {name, save}
+	luaL_newmetatable(state, Wrapper::name.c_str());
+
+	lua_createtable(state, 2, 0);
+	lua_pushstring(state, name);
+	lua_rawseti(state, -2, 1);
+	luwra::push(state, std::forward<Save>(save));
+	lua_rawseti(state, -2, 2);
+
+	lua_rawset(state, -3);
+
+	// name -> load
+	lua_pushstring(state, name);
+	luwra::push(state, std::forward<Load>(load));
+	lua_rawset(state, -3);
+
+	lua_pop(state, 1);
+}
+
+LUWRA_NS_END
+
+#endif
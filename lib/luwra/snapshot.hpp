@@ -0,0 +1,163 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_SNAPSHOT_H_
+#define LUWRA_SNAPSHOT_H_
+
+#include "common.hpp"
+#include "mapping.hpp"
+#include "serialize.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Signature of snapshot files, followed by the Lua version
+	static
+	const char snapshotHeader[12] = {
+		'L', 'u', 'w', 'r', 'a', 'S', 'N', 1,
+		char(LUA_VERSION_NUM & 0xFF), char((LUA_VERSION_NUM >> 8) & 0xFF), 0, 0
+	};
+
+	// Protected part of 'snapshot'
+	inline
+	int writeSnapshot(State* state) {
+		Encoder<FileSink>* encoder = static_cast<Encoder<FileSink>*>(lua_touserdata(state, 1));
+		encoder->prepare(true);
+
+		pushGlobals(state);
+		encoder->encodeFields(lua_gettop(state));
+
+		return 0;
+	}
+
+	// Protected part of 'restore'
+	inline
+	int readSnapshot(State* state) {
+		Decoder<MemorySource>* decoder = static_cast<Decoder<MemorySource>*>(lua_touserdata(state, 1));
+		decoder->prepare();
+
+		pushGlobals(state);
+
+		size_t array_length = static_cast<size_t>(decoder->readVarint());
+		size_t hash_length = static_cast<size_t>(decoder->readVarint());
+		decoder->decodeFields(lua_gettop(state), array_length, hash_length);
+
+		if (decoder->source.position != decoder->source.size)
+			luaL_error(state, "cannot restore snapshot: trailing data");
+
+		return 0;
+	}
+}
+
+/// Write everything which is reachable from the globals into a file, so that it can be brought
+/// back with @ref restore instead of running the code which created it.
+///
+/// Supported are tables (including metatables and cycles), strings, numbers, booleans, Lua
+/// functions with their upvalues and user types for which @ref registerSerializer has been used.
+/// Upvalues which are shared between functions stay shared (Lua 5.2 and later).
+///
+/// Modules in `package.loaded` which consist of C functions only (e.g. the standard libraries) and
+/// C functions in those modules or in the globals are not written. Instead they are referred to by
+/// name and looked up when the snapshot is restored. Everything else, such as threads or C
+/// functions which are not reachable that way, causes the snapshot to fail.
+///
+/// \param state Lua state
+/// \param path  Output file
+/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+///          stack
+///
+/// Example:
+///
+/// ```
+///   if (restore(state, "init.snapshot") != LUA_OK) {
+///       lua_pop(state, 1);
+///
+///       state.runFile("init.lua");
+///       snapshot(state, "init.snapshot");
+///   }
+/// ```
+inline
+int snapshot(State* state, const char* path) {
+	// Every writer has its own temporary file, which replaces the snapshot once it is complete
+	std::string temp_path;
+
+	std::FILE* file = internal::openTemporaryFile(path, temp_path);
+	if (!file) {
+		lua_pushfstring(state, "cannot create a temporary file for '%s'", path);
+		return LUA_ERRFILE;
+	}
+
+	internal::FileSink sink(file);
+	sink.write(internal::snapshotHeader, sizeof(internal::snapshotHeader));
+
+	internal::Encoder<internal::FileSink> encoder(state, sink);
+
+	lua_pushcfunction(state, &internal::writeSnapshot);
+	lua_pushlightuserdata(state, &encoder);
+	int status = lua_pcall(state, 1, 0, 0);
+
+	if (status != LUA_OK) {
+		std::fclose(file);
+		std::remove(temp_path.c_str());
+
+		return status;
+	}
+
+	if (std::fclose(file) != 0 || sink.failed || std::rename(temp_path.c_str(), path) != 0) {
+		std::remove(temp_path.c_str());
+
+		lua_pushfstring(state, "cannot write '%s'", path);
+		return LUA_ERRFILE;
+	}
+
+	return LUA_OK;
+}
+
+/// Restore the globals from a file which has been written using @ref snapshot. The state has to
+/// provide the same C modules and functions as the state which has written the snapshot, i.e.
+/// libraries have to be loaded and user types and their serialization hooks have to be registered
+/// beforehand. Globals which are not part of the snapshot are left as they are.
+///
+/// Snapshots contain bytecode which is loaded without verification, therefore they must come
+/// from a trusted source.
+///
+/// \param state Lua state
+/// \param path  Snapshot file
+/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+///          stack
+inline
+int restore(State* state, const char* path) {
+	MappedFile file(path);
+
+	size_t header_size = sizeof(internal::snapshotHeader);
+
+	if (
+		!file.isValid()
+		|| file.size() < header_size
+		|| std::memcmp(file.data(), internal::snapshotHeader, header_size) != 0
+	) {
+		lua_pushfstring(state, "'%s' is not a snapshot for this Lua version", path);
+		return LUA_ERRFILE;
+	}
+
+	internal::MemorySource source(file.data() + header_size, file.size() - header_size);
+	// Snapshots are trusted, see above
+	internal::Decoder<internal::MemorySource> decoder(state, source, true);
+
+	lua_pushcfunction(state, &internal::readSnapshot);
+	lua_pushlightuserdata(state, &decoder);
+
+	return lua_pcall(state, 1, 0, 0);
+}
+
+LUWRA_NS_END
+
+#endif
@@ -11,9 +11,11 @@
 #include "values.hpp"
 #include "internal/typelist.hpp"
 #include "internal/types.hpp"
+#include "internal/indexsequence.hpp"
 
 #include <utility>
 #include <numeric>
+#include <tuple>
 
 LUWRA_NS_BEGIN
 
@@ -221,6 +223,108 @@ size_t map(State* state, int pos, Callable&& func, ExtraArgs&&... args) {
 	);
 }
 
+/// View of consecutive values on the stack, e.g. the results of a call with `LUA_MULTRET`. The
+/// values are not copied; the view is only valid as long as they remain on the stack.
+struct StackRange {
+	/// Lua state
+	State* state;
+
+	/// Index of the first value
+	int first;
+
+	/// Number of values
+	int count;
+
+	/// Number of values
+	inline
+	int size() const {
+		return count;
+	}
+
+	/// Read a value of the range.
+	///
+	/// \param n Position within the range, starting at 1
+	template <typename Type = internal::InferValueType> inline
+	auto read(int n) const -> decltype(Value<Type>::read(state, n)) {
+		return Value<Type>::read(state, first + n - 1);
+	}
+
+	/// Remove the values from the stack. They must be on top of the stack.
+	inline
+	void pop() {
+		lua_settop(state, first - 1);
+		count = 0;
+	}
+};
+
+namespace internal {
+	// Determines how many results a call produces and how they are taken off the stack.
+	template <typename Ret>
+	struct CallResults {
+		static constexpr int count = 1;
+
+		// Read the results which have been placed above 'base' and remove them.
+		static inline
+		Ret take(State* state, int base) {
+			Ret returnValue = luwra::read<Ret>(state, base + 1);
+
+			lua_settop(state, base);
+			return returnValue;
+		}
+	};
+
+	template <typename... Contents>
+	struct _TupleCallResults {
+		template <size_t... Indices>
+		struct Reader {
+			static constexpr int count = static_cast<int>(sizeof...(Contents));
+
+			static inline
+			std::tuple<Contents...> take(State* state, int base) {
+				std::tuple<Contents...> returnValue(
+					luwra::read<Contents>(state, base + 1 + static_cast<int>(Indices))...
+				);
+
+				lua_settop(state, base);
+				return returnValue;
+			}
+		};
+	};
+
+	template <typename... Contents>
+	struct CallResults<std::tuple<Contents...>>:
+		MakeIndexSequence<sizeof...(Contents)>::template Relay<
+			_TupleCallResults<Contents...>::template Reader
+		> {};
+
+	template <typename First, typename Second>
+	struct CallResults<std::pair<First, Second>> {
+		static constexpr int count = 2;
+
+		static inline
+		std::pair<First, Second> take(State* state, int base) {
+			std::pair<First, Second> returnValue(
+				luwra::read<First>(state, base + 1),
+				luwra::read<Second>(state, base + 2)
+			);
+
+			lua_settop(state, base);
+			return returnValue;
+		}
+	};
+
+	// The results stay on the stack
+	template <>
+	struct CallResults<StackRange> {
+		static constexpr int count = LUA_MULTRET;
+
+		static inline
+		StackRange take(State* state, int base) {
+			return {state, base + 1, lua_gettop(state) - base};
+		}
+	};
+}
+
 LUWRA_NS_END
 
 #endif
@@ -11,16 +11,54 @@
 #include "auxiliary.hpp"
 #include "stack.hpp"
 #include "usertypes.hpp"
+#include "memory.hpp"
+#include "gc.hpp"
+#include "sandbox.hpp"
+#include "snapshot.hpp"
+#include "bundle.hpp"
+#include "cache.hpp"
+#include "mapping.hpp"
 #include "types/table.hpp"
 
 #include <utility>
 #include <memory>
+#include <cstdio>
+#include <string>
 
 LUWRA_NS_BEGIN
 
 namespace internal {
+	// Mimics the panic handler which 'luaL_newstate' installs.
+	inline
+	int panicHandler(State* state) {
+		const char* message = lua_tostring(state, -1);
+
+		std::fprintf(
+			stderr,
+			"PANIC: unprotected error in call to Lua API (%s)\n",
+			message ? message : "error object is not a string"
+		);
+
+		return 0;
+	}
+
+	// Creates a state which is backed by the given allocator.
+	inline
+	State* newState(Allocator* allocator) {
+		State* state = lua_newstate(&allocateFor, allocator);
+
+		if (state)
+			lua_atpanic(state, &panicHandler);
+
+		return state;
+	}
+
 	struct StateBundle {
+		std::shared_ptr<Allocator> allocator;
 		std::shared_ptr<State> state;
+		// Created on first use
+		mutable std::shared_ptr<GarbageCollector> collector;
+		std::shared_ptr<ChunkCache> cache;
 
 		inline
 		StateBundle():
@@ -31,16 +69,27 @@ namespace internal {
 		StateBundle(State* other):
 			state(other, [](State*) {})
 		{}
+
+		inline
+		StateBundle(const std::shared_ptr<Allocator>& allocator):
+			allocator(allocator),
+			// The deleter holds on to the allocator because it is needed until the state is closed.
+			state(newState(allocator.get()), [allocator](State* state) {
+				if (state)
+					lua_close(state);
+			})
+		{}
 	};
 
-#if LUA_VERSION_NUM > 501
 	inline
 	Reference getGlobalsTable(State* state) {
+#if LUA_VERSION_NUM <= 501
+		return {state, LUA_GLOBALSINDEX};
+#else
 		lua_rawgeti(state, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
 		return {state};
-	}
 #endif
-
+	}
 }
 
 /// Wrapper for a Lua state
@@ -49,26 +98,27 @@ struct StateWrapper: internal::StateBundle, Table {
 	inline
 	StateWrapper():
 		internal::StateBundle(),
-
-#if LUA_VERSION_NUM <= 501
-		Table(state.get(), LUA_GLOBALSINDEX)
-#else
 		Table(internal::getGlobalsTable(state.get()))
-#endif
-
 	{}
 
 	/// Operate on a foreign state instance.
 	inline
 	StateWrapper(State* other):
 		internal::StateBundle(other),
-
-#if LUA_VERSION_NUM <= 501
-		Table(state.get(), LUA_GLOBALSINDEX)
-#else
 		Table(internal::getGlobalsTable(state.get()))
-#endif
+	{}
 
+	/// Create a new Lua state which obtains its memory from the given allocator.
+	///
+	/// Example:
+	///
+	/// ```
+	///   StateWrapper state(std::make_shared<PoolAllocator>());
+	/// ```
+	inline
+	StateWrapper(const std::shared_ptr<Allocator>& allocator):
+		internal::StateBundle(allocator),
+		Table(internal::getGlobalsTable(state.get()))
 	{}
 
 	/// Convert to `lua_State`.
@@ -77,6 +127,106 @@ struct StateWrapper: internal::StateBundle, Table {
 		return state.get();
 	}
 
+	/// Retrieve the memory statistics of this state. States which have not been created with an
+	/// @ref Allocator only report the number of bytes in use.
+	inline
+	MemoryStats memoryStats() const {
+		if (allocator)
+			return allocator->stats;
+
+		MemoryStats stats;
+		stats.live =
+			size_t(lua_gc(state.get(), LUA_GCCOUNT, 0)) * 1024
+			+ size_t(lua_gc(state.get(), LUA_GCCOUNTB, 0));
+
+		return stats;
+	}
+
+	/// Limit the memory usage of this state. See @ref Allocator::limit and
+	/// @ref Allocator::softLimit.
+	///
+	/// \param limit      Maximum number of bytes, 0 for no limit
+	/// \param soft_limit Number of bytes after which a full collection is requested, 0 to disable
+	/// \returns `false` if the state has not been created with an @ref Allocator
+	///
+	/// Scripts which exceed the limit fail with `LUA_ERRMEM`, which is the status that
+	/// @ref runString, @ref runFile and @ref Function::pcall will report.
+	inline
+	bool setMemoryLimit(size_t limit, size_t soft_limit = 0) const {
+		if (!allocator)
+			return false;
+
+		allocator->limit = limit;
+		allocator->softLimit = soft_limit;
+		allocator->softArmed = true;
+		allocator->collectionRequested = false;
+
+		return true;
+	}
+
+	/// Access the garbage collector. It is created on first use; copies of this wrapper which are
+	/// made afterwards share the collector and its telemetry.
+	///
+	/// Example:
+	///
+	/// ```
+	///   state.gc().setMode(GCMode::Generational);
+	///
+	///   // Once per frame
+	///   state.gc().step(std::chrono::microseconds(500));
+	/// ```
+	inline
+	GarbageCollector& gc() const {
+		if (!collector)
+			collector = std::make_shared<GarbageCollector>(state.get());
+
+		return *collector;
+	}
+
+	/// Create a @ref Sandbox which runs on its own thread with its own globals.
+	inline
+	Sandbox spawnSandbox() const {
+		return {state.get()};
+	}
+
+	/// Cache the compiled chunks of @ref runString and @ref runFile. Copies of this wrapper which
+	/// are made afterwards share the cache.
+	///
+	/// \param directory Directory in which compiled chunks are persisted, empty to only keep them
+	///                  in memory
+	///
+	/// Example:
+	///
+	/// ```
+	///   state.enableChunkCache("/var/cache/myapp");
+	///
+	///   state.runFile("init.lua"); // Compiled once, loaded from the cache later on
+	///   state.runFile("init.lua");
+	/// ```
+	inline
+	ChunkCache& enableChunkCache(const std::string& directory = std::string()) {
+		cache = std::make_shared<ChunkCache>(state.get(), directory);
+		return *cache;
+	}
+
+	/// See [luwra::mountBundle](@ref luwra::mountBundle).
+	inline
+	bool mountBundle(const char* path) const {
+		return luwra::mountBundle(state.get(), path);
+	}
+
+	/// See [luwra::snapshot](@ref luwra::snapshot).
+	inline
+	int snapshot(const char* path) const {
+		return luwra::snapshot(state.get(), path);
+	}
+
+	/// See [luwra::restore](@ref luwra::restore).
+	inline
+	int restore(const char* path) const {
+		return luwra::restore(state.get(), path);
+	}
+
 	/// Load all built-in libraries.
 	inline
 	void loadStandardLibrary() const {
@@ -169,15 +319,31 @@ struct StateWrapper: internal::StateBundle, Table {
 	}
 
 	/// Execute a piece of code.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of the failed load or call with
+	///          the error object on top of the stack
 	inline
 	int runString(const char* code) const {
-		return luaL_dostring(state.get(), code);
+		int status = cache ? cache->loadString(code) : luaL_loadstring(state.get(), code);
+		if (status != LUA_OK)
+			return status;
+
+		collectRequestedGarbage(state.get());
+		return lua_pcall(state.get(), 0, LUA_MULTRET, 0);
 	}
 
 	/// Execute a file.
+	///
+	/// \returns `LUA_OK` on success, otherwise the status code of the failed load or call with
+	///          the error object on top of the stack
 	inline
 	int runFile(const char* filepath) const {
-		return luaL_dofile(state.get(), filepath);
+		int status = cache ? cache->loadFile(filepath) : loadMappedFile(state.get(), filepath);
+		if (status != LUA_OK)
+			return status;
+
+		collectRequestedGarbage(state.get());
+		return lua_pcall(state.get(), 0, LUA_MULTRET, 0);
 	}
 };
 
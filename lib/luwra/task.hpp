@@ -0,0 +1,358 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_TASK_H_
+#define LUWRA_TASK_H_
+
+#include "common.hpp"
+#include "scheduler.hpp"
+#include "stack.hpp"
+#include "internal/indexsequence.hpp"
+
+// C++20 coroutines
+#if __cplusplus >= 202002L && defined(__has_include)
+	#if __has_include(<coroutine>)
+		#include <coroutine>
+
+		#ifdef __cpp_impl_coroutine
+			#define LUWRA_HAS_COROUTINES
+		#endif
+	#endif
+#endif
+
+#ifdef LUWRA_HAS_COROUTINES
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+LUWRA_NS_BEGIN
+
+template <typename Type>
+struct Task;
+
+namespace internal {
+	// Parts of the promise which do not depend on the result type
+	struct TaskPromiseBase {
+		// Coroutine which awaits the task
+		std::coroutine_handle<> continuation;
+
+		// Invoked once the task has finished
+		std::function<void ()> callback;
+
+		std::exception_ptr error;
+		bool done = false;
+
+		// The task may finish on another thread while the callback is being installed.
+		std::mutex mutex;
+
+		// Tasks start running immediately.
+		inline
+		std::suspend_never initial_suspend() noexcept {
+			return {};
+		}
+
+		struct FinalAwaiter {
+			inline
+			bool await_ready() noexcept {
+				return false;
+			}
+
+			template <typename Promise> inline
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+				TaskPromiseBase& promise = handle.promise();
+				std::function<void ()> callback;
+				std::coroutine_handle<> continuation;
+
+				{
+					std::lock_guard<std::mutex> lock(promise.mutex);
+					promise.done = true;
+					callback.swap(promise.callback);
+					continuation = promise.continuation;
+				}
+
+				// The task may be destroyed as soon as the lock has been released, therefore
+				// the promise must not be touched anymore.
+				if (callback)
+					callback();
+
+				return continuation ? continuation : std::noop_coroutine();
+			}
+
+			inline
+			void await_resume() noexcept {}
+		};
+
+		inline
+		FinalAwaiter final_suspend() noexcept {
+			return {};
+		}
+
+		inline
+		void unhandled_exception() {
+			error = std::current_exception();
+		}
+	};
+
+	template <typename Type>
+	struct TaskPromise: TaskPromiseBase {
+		std::optional<Type> value;
+
+		inline
+		Task<Type> get_return_object();
+
+		template <typename Source> inline
+		void return_value(Source&& source) {
+			value.emplace(std::forward<Source>(source));
+		}
+	};
+
+	template <>
+	struct TaskPromise<void>: TaskPromiseBase {
+		inline
+		Task<void> get_return_object();
+
+		inline
+		void return_void() {}
+	};
+}
+
+/// Result of a C++20 coroutine which can be awaited by Lua code. Tasks start running when they are
+/// created and can `co_await` other tasks. Wrap functions which return a task using
+/// @ref LUWRA_WRAP_TASK.
+///
+/// Example:
+///
+/// ```
+///   Task<std::string> fetch(std::string url) {
+///       Response response = co_await http.get(url);
+///       co_return response.body;
+///   }
+/// ```
+template <typename Type>
+struct Task {
+	using promise_type = internal::TaskPromise<Type>;
+
+	inline
+	Task(std::coroutine_handle<promise_type> handle):
+		handle(handle)
+	{}
+
+	inline
+	Task(Task&& other):
+		handle(std::exchange(other.handle, nullptr))
+	{}
+
+	Task(const Task&) = delete;
+	Task& operator =(const Task&) = delete;
+
+	inline
+	~Task() {
+		if (handle)
+			handle.destroy();
+	}
+
+	/// Check whether the task has finished.
+	inline
+	bool isReady() const {
+		std::lock_guard<std::mutex> lock(handle.promise().mutex);
+		return handle.promise().done;
+	}
+
+	/// Invoke a callable once the task has finished, or right away if it has already finished. The
+	/// callable runs on the thread which finishes the task.
+	inline
+	void then(std::function<void ()> callback) {
+		{
+			std::lock_guard<std::mutex> lock(handle.promise().mutex);
+
+			if (!handle.promise().done) {
+				handle.promise().callback = std::move(callback);
+				return;
+			}
+		}
+
+		callback();
+	}
+
+	/// Retrieve the result of a finished task. Rethrows the exception which the task has thrown.
+	inline
+	Type get() {
+		promise_type& promise = handle.promise();
+
+		if (promise.error)
+			std::rethrow_exception(promise.error);
+
+		if constexpr (!std::is_void<Type>::value)
+			return std::move(*promise.value);
+	}
+
+	// Awaitable interface
+	inline
+	bool await_ready() const {
+		return isReady();
+	}
+
+	inline
+	bool await_suspend(std::coroutine_handle<> continuation) {
+		promise_type& promise = handle.promise();
+		std::lock_guard<std::mutex> lock(promise.mutex);
+
+		// The task may have finished on another thread since 'await_ready'; the awaiting
+		// coroutine continues right away in that case.
+		if (promise.done)
+			return false;
+
+		promise.continuation = continuation;
+		return true;
+	}
+
+	inline
+	Type await_resume() {
+		return get();
+	}
+
+private:
+	std::coroutine_handle<promise_type> handle;
+};
+
+namespace internal {
+	template <typename Type> inline
+	Task<Type> TaskPromise<Type>::get_return_object() {
+		return {std::coroutine_handle<TaskPromise<Type>>::from_promise(*this)};
+	}
+
+	inline
+	Task<void> TaskPromise<void>::get_return_object() {
+		return {std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+	}
+
+	// Push the result of a finished task. Exceptions are turned into Lua errors.
+	template <typename Type> inline
+	int pushTaskResult(State* state, Task<Type>& task) {
+		try {
+			if constexpr (std::is_void<Type>::value) {
+				task.get();
+				return 0;
+			} else {
+				return static_cast<int>(pushReturn(state, task.get()));
+			}
+		} catch (const std::exception& error) {
+			lua_pushstring(state, error.what());
+		} catch (...) {
+			lua_pushstring(state, "task has failed");
+		}
+
+		// Raising the error here would skip destructors
+		return -1;
+	}
+
+	// Deliver the result of a task to the coroutine which waits for it.
+	template <typename Type> inline
+	void deliverTaskResult(const Wakeup& wakeup, Task<Type>& task) {
+		std::string message;
+
+		try {
+			if constexpr (std::is_void<Type>::value) {
+				task.get();
+				wakeup.resume([](State*) { return 0; });
+			} else {
+				std::shared_ptr<Type> value = std::make_shared<Type>(task.get());
+
+				wakeup.resume([value](State* state) {
+					return static_cast<int>(pushReturn(state, std::move(*value)));
+				});
+			}
+
+			return;
+		} catch (const std::exception& error) {
+			message = error.what();
+		} catch (...) {
+			message = "task has failed";
+		}
+
+		wakeup.fail(message);
+	}
+
+	template <typename Type>
+	struct TaskWrapper {
+		static_assert(
+			sizeof(Type) == -1,
+			"Template parameter to TaskWrapper is not a function which returns a Task"
+		);
+	};
+
+	template <typename Type, typename... Args>
+	struct TaskWrapper<Task<Type> (Args...)> {
+		template <size_t... Indices>
+		struct Implementation {
+			template <Task<Type> (* func)(Args...)> static inline
+			int invoke(State* state) {
+				Scheduler* scheduler = Scheduler::current(state);
+
+				if (!scheduler || !scheduler->owns(state))
+					return luaL_error(state, "cannot wait outside of a scheduled coroutine");
+
+				int results = 0;
+				bool waiting = false;
+
+				{
+					std::shared_ptr<Task<Type>> task =
+						std::make_shared<Task<Type>>(func(read<Args>(state, 1 + Indices)...));
+
+					if (task->isReady()) {
+						results = pushTaskResult(state, *task);
+					} else {
+						Wakeup wakeup = scheduler->suspend(state);
+						waiting = true;
+
+						// The callback keeps the task alive until it has finished.
+						task->then([task, wakeup]() {
+							deliverTaskResult(wakeup, *task);
+						});
+					}
+				}
+
+				// Yielding and raising errors skip destructors, hence they happen out here.
+				if (waiting)
+					return Scheduler::yield(state);
+
+				return results < 0 ? lua_error(state) : results;
+			}
+		};
+	};
+
+	template <typename Function>
+	struct TaskWrapperFor;
+
+	template <typename Type, typename... Args>
+	struct TaskWrapperFor<Task<Type> (*)(Args...)> {
+		using Implementation =
+			typename MakeIndexSequence<sizeof...(Args)>::template Relay<
+				TaskWrapper<Task<Type> (Args...)>::template Implementation
+			>;
+	};
+}
+
+LUWRA_NS_END
+
+/// Generate a `lua_CFunction` wrapper for a function which returns a @ref luwra::Task. The calling
+/// Lua coroutine waits until the task has finished and receives its result; other coroutines of
+/// the state's @ref luwra::Scheduler continue to run in the meantime. Exceptions thrown by the task
+/// are raised as Lua errors.
+///
+/// \param entity Function that shall be wrapped
+/// \returns Wrapped function as `lua_CFunction`
+#define LUWRA_WRAP_TASK(entity) \
+	(&luwra::internal::TaskWrapperFor<decltype(&entity)>::Implementation::template invoke<&entity>)
+
+#endif
+
+#endif
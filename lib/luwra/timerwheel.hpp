@@ -0,0 +1,474 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_TIMERWHEEL_H_
+#define LUWRA_TIMERWHEEL_H_
+
+#include "common.hpp"
+#include "values.hpp"
+#include "stack.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Each level of the wheel has 2^LUWRA_TIMERWHEEL_BITS slots
+	#define LUWRA_TIMERWHEEL_BITS 8
+	#define LUWRA_TIMERWHEEL_LEVELS 4
+}
+
+/// Hierarchical timer wheel which calls Lua functions after a delay or periodically. Adding and
+/// cancelling a timer take constant time, regardless of how many timers are pending. Delays are
+/// measured in ticks of a fixed resolution and can be up to 2^32 ticks long.
+///
+/// The wheel does not keep time by itself; call @ref update regularly, e.g. from a periodic timer
+/// of an @ref EventLoop, or @ref advance with the elapsed time. All timers which expire during one
+/// of these calls are dispatched in a single pass.
+///
+/// Callbacks live in one table, indexed by the timer's slot, instead of taking a registry
+/// reference each.
+///
+/// Example:
+///
+/// ```
+///   TimerWheel timers(state);
+///   timers.pushModule();
+///   lua_setglobal(state, "timers");
+///
+///   state.runString(
+///       "local retry = timers.every(50, function () ... end)\n"
+///       "timers.after(1000, function () timers.cancel(retry) end)"
+///   );
+///
+///   while (timers.size() > 0) {
+///       std::this_thread::sleep_for(std::chrono::milliseconds(1));
+///       timers.update();
+///   }
+/// ```
+struct TimerWheel {
+	/// Identifies a timer; 0 is never used
+	using Handle = uint64_t;
+
+	/// Create a timer wheel for the given state.
+	///
+	/// \param state      Lua state
+	/// \param resolution Length of a tick
+	inline
+	TimerWheel(State* state, std::chrono::milliseconds resolution = std::chrono::milliseconds(1)):
+		state(state),
+		resolution(resolution.count() > 0 ? resolution : std::chrono::milliseconds(1)),
+		slots(LUWRA_TIMERWHEEL_LEVELS << LUWRA_TIMERWHEEL_BITS, None),
+		lastUpdate(std::chrono::steady_clock::now())
+	{
+		lua_newtable(state);
+		callbacks = luaL_ref(state, LUA_REGISTRYINDEX);
+	}
+
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator =(const TimerWheel&) = delete;
+
+	inline
+	~TimerWheel() {
+		luaL_unref(state, LUA_REGISTRYINDEX, callbacks);
+	}
+
+	/// Call the function at the given stack index after a delay, or periodically.
+	///
+	/// \param index  Index of the function
+	/// \param delay  Delay, rounded up to full ticks
+	/// \param repeat Whether the delay is also the interval
+	/// \returns Handle of the timer
+	inline
+	Handle add(int index, std::chrono::milliseconds delay, bool repeat = false) {
+		// Timers expire at the next tick at the earliest
+		uint64_t ticks = delay.count() <= resolution.count()
+			? 1
+			: static_cast<uint64_t>((delay.count() + resolution.count() - 1) / resolution.count());
+
+		int32_t id = allocate();
+		timers[id].interval = repeat ? ticks : 0;
+
+		schedule(id, current + ticks);
+
+		// Store the callback in the slot of the timer
+		lua_pushvalue(state, index);
+		lua_rawgeti(state, LUA_REGISTRYINDEX, callbacks);
+		lua_insert(state, -2);
+		lua_rawseti(state, -2, id + 1);
+		lua_pop(state, 1);
+
+		return makeHandle(id);
+	}
+
+	/// Cancel a timer. It may be called from within a callback.
+	///
+	/// \returns `true` if the timer has been pending
+	inline
+	bool cancel(Handle handle) {
+		int32_t id = resolve(handle);
+		if (id == None)
+			return false;
+
+		release(id);
+		return true;
+	}
+
+	/// Advance by the time which has passed since the last update and dispatch the expired timers.
+	///
+	/// \returns `LUA_OK` if all callbacks succeeded, otherwise the status of the first one which
+	///          has failed with its error message on top of the stack
+	inline
+	int update() {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		std::chrono::milliseconds elapsed =
+			std::chrono::duration_cast<std::chrono::milliseconds>(now - lastUpdate);
+
+		// Keep the fraction of a millisecond for the next update
+		lastUpdate += elapsed;
+
+		return advance(elapsed);
+	}
+
+	/// Advance by the given time and dispatch the expired timers.
+	///
+	/// \returns `LUA_OK` if all callbacks succeeded, otherwise the status of the first one which
+	///          has failed with its error message on top of the stack
+	inline
+	int advance(std::chrono::milliseconds elapsed) {
+		remainder += elapsed;
+
+		uint64_t ticks = static_cast<uint64_t>(remainder.count() / resolution.count());
+		remainder -= resolution * static_cast<long>(ticks);
+
+		for (; ticks > 0 && scheduled > 0; ticks--)
+			tick();
+
+		// Without scheduled timers there is nothing to collect on the way
+		current += ticks;
+
+		return dispatch();
+	}
+
+	/// Number of pending timers
+	inline
+	size_t size() const {
+		return pending;
+	}
+
+	/// Push a table with the functions `after(milliseconds, callback)` and
+	/// `every(milliseconds, callback)`, which return a timer, and `cancel(timer)`. The wheel must
+	/// outlive the functions.
+	///
+	/// \returns Number of pushed values
+	inline
+	int pushModule() {
+		lua_createtable(state, 0, 3);
+
+		lua_pushlightuserdata(state, this);
+		lua_pushboolean(state, false);
+		lua_pushcclosure(state, &TimerWheel::luaAdd, 2);
+		lua_setfield(state, -2, "after");
+
+		lua_pushlightuserdata(state, this);
+		lua_pushboolean(state, true);
+		lua_pushcclosure(state, &TimerWheel::luaAdd, 2);
+		lua_setfield(state, -2, "every");
+
+		lua_pushlightuserdata(state, this);
+		lua_pushcclosure(state, &TimerWheel::luaCancel, 1);
+		lua_setfield(state, -2, "cancel");
+
+		return 1;
+	}
+
+private:
+	enum: int32_t {
+		// Marks the end of a list or a timer which is in no slot
+		None = -1,
+
+		// Slot of timers which have expired and wait for dispatch
+		Expired = -2
+	};
+
+	static constexpr uint64_t SlotMask = (1 << LUWRA_TIMERWHEEL_BITS) - 1;
+
+	struct Timer {
+		uint64_t expiry = 0;
+		uint64_t interval = 0;
+
+		// Incremented whenever the timer is released, invalidating old handles
+		uint32_t generation = 1;
+
+		// Slot the timer is linked into, or one of the markers above
+		int32_t slot = None;
+		int32_t previous = None;
+		int32_t next = None;
+	};
+
+	State* state;
+	std::chrono::milliseconds resolution;
+
+	// Registry reference of the callback table
+	int callbacks;
+
+	std::vector<Timer> timers;
+	std::vector<int32_t> slots;
+	std::vector<int32_t> freeTimers;
+	std::vector<int32_t> expired;
+
+	// Number of timers which have not been released, and how many of them are linked into a slot
+	size_t pending = 0;
+	size_t scheduled = 0;
+
+	// Number of ticks which have passed
+	uint64_t current = 0;
+
+	std::chrono::steady_clock::time_point lastUpdate;
+	std::chrono::milliseconds remainder {0};
+
+	inline
+	Handle makeHandle(int32_t id) const {
+		// Generations are limited to 20 bits, so that handles are exact as Lua numbers
+		return (static_cast<uint64_t>(timers[id].generation) << 32) | static_cast<uint32_t>(id);
+	}
+
+	inline
+	int32_t resolve(Handle handle) const {
+		int32_t id = static_cast<int32_t>(handle & 0xFFFFFFFF);
+
+		if (
+			id < 0
+			|| static_cast<size_t>(id) >= timers.size()
+			|| timers[id].generation != (handle >> 32)
+			|| timers[id].slot == None
+		)
+			return None;
+
+		return id;
+	}
+
+	inline
+	int32_t allocate() {
+		pending++;
+
+		if (!freeTimers.empty()) {
+			int32_t id = freeTimers.back();
+			freeTimers.pop_back();
+			return id;
+		}
+
+		timers.emplace_back();
+		return static_cast<int32_t>(timers.size() - 1);
+	}
+
+	// Unlink the timer, drop its callback and make its slot available again
+	inline
+	void release(int32_t id) {
+		Timer& timer = timers[id];
+
+		if (timer.slot >= 0)
+			unlink(id);
+
+		timer.slot = None;
+		timer.generation = (timer.generation & 0xFFFFF) + 1;
+
+		lua_rawgeti(state, LUA_REGISTRYINDEX, callbacks);
+		lua_pushnil(state);
+		lua_rawseti(state, -2, id + 1);
+		lua_pop(state, 1);
+
+		freeTimers.push_back(id);
+		pending--;
+	}
+
+	// Link the timer into the slot which corresponds to its expiry
+	inline
+	void schedule(int32_t id, uint64_t expiry) {
+		Timer& timer = timers[id];
+
+		uint64_t delta = expiry - current;
+		uint64_t limit = uint64_t(1) << (LUWRA_TIMERWHEEL_BITS * LUWRA_TIMERWHEEL_LEVELS);
+
+		if (delta >= limit) {
+			delta = limit - 1;
+			expiry = current + delta;
+		}
+
+		timer.expiry = expiry;
+
+		int level = 0;
+		while (level < LUWRA_TIMERWHEEL_LEVELS - 1 && delta >> (LUWRA_TIMERWHEEL_BITS * (level + 1)))
+			level++;
+
+		int32_t slot = static_cast<int32_t>(
+			(level << LUWRA_TIMERWHEEL_BITS)
+			+ ((expiry >> (LUWRA_TIMERWHEEL_BITS * level)) & SlotMask)
+		);
+
+		timer.slot = slot;
+		timer.previous = None;
+		timer.next = slots[slot];
+		scheduled++;
+
+		if (timer.next != None)
+			timers[timer.next].previous = id;
+
+		slots[slot] = id;
+	}
+
+	inline
+	void unlink(int32_t id) {
+		Timer& timer = timers[id];
+
+		if (timer.previous != None)
+			timers[timer.previous].next = timer.next;
+		else
+			slots[timer.slot] = timer.next;
+
+		if (timer.next != None)
+			timers[timer.next].previous = timer.previous;
+
+		timer.previous = None;
+		timer.next = None;
+		scheduled--;
+	}
+
+	// Redistribute the timers of a slot of a higher level. Returns the slot's index.
+	inline
+	uint64_t cascade(int level) {
+		uint64_t index = (current >> (LUWRA_TIMERWHEEL_BITS * level)) & SlotMask;
+		int32_t slot = static_cast<int32_t>((level << LUWRA_TIMERWHEEL_BITS) + index);
+
+		int32_t id = slots[slot];
+		slots[slot] = None;
+
+		while (id != None) {
+			int32_t next = timers[id].next;
+
+			scheduled--;
+			schedule(id, timers[id].expiry);
+
+			id = next;
+		}
+
+		return index;
+	}
+
+	// Move on by one tick and collect the timers which expire
+	inline
+	void tick() {
+		current++;
+
+		uint64_t index = current & SlotMask;
+
+		if (index == 0) {
+			for (int level = 1; level < LUWRA_TIMERWHEEL_LEVELS && cascade(level) == 0; level++);
+		}
+
+		int32_t id = slots[index];
+		slots[index] = None;
+
+		while (id != None) {
+			int32_t next = timers[id].next;
+
+			timers[id].slot = Expired;
+			timers[id].previous = None;
+			timers[id].next = None;
+			expired.push_back(id);
+			scheduled--;
+
+			id = next;
+		}
+	}
+
+	inline
+	int dispatch() {
+		if (expired.empty())
+			return LUA_OK;
+
+		int status = LUA_OK;
+
+		lua_rawgeti(state, LUA_REGISTRYINDEX, callbacks);
+		int table = lua_gettop(state);
+
+		// Callbacks may add timers, which must not end up in this batch
+		std::vector<int32_t> batch;
+		batch.swap(expired);
+
+		for (int32_t id: batch) {
+			// Cancelled by a previous callback
+			if (timers[id].slot != Expired)
+				continue;
+
+			lua_rawgeti(state, table, id + 1);
+
+			if (timers[id].interval > 0)
+				schedule(id, current + timers[id].interval);
+			else
+				release(id);
+
+			int result = lua_pcall(state, 0, 0, 0);
+
+			if (result != LUA_OK) {
+				// Keep the first error only, below the callback table
+				if (status == LUA_OK) {
+					status = result;
+					lua_insert(state, table);
+					table++;
+				} else {
+					lua_pop(state, 1);
+				}
+			}
+		}
+
+		lua_remove(state, table);
+
+		// Reuse the buffer
+		batch.clear();
+		if (expired.empty())
+			expired.swap(batch);
+
+		return status;
+	}
+
+	static inline
+	int luaAdd(State* thread) {
+		TimerWheel* wheel = static_cast<TimerWheel*>(lua_touserdata(thread, lua_upvalueindex(1)));
+		bool repeat = lua_toboolean(thread, lua_upvalueindex(2)) != 0;
+
+		lua_Number milliseconds = luaL_checknumber(thread, 1);
+		luaL_checktype(thread, 2, LUA_TFUNCTION);
+
+		// The callback has to be referenced from the wheel's state
+		lua_pushvalue(thread, 2);
+		lua_xmove(thread, wheel->state, 1);
+
+		Handle handle = wheel->add(
+			-1,
+			std::chrono::milliseconds(static_cast<long>(milliseconds)),
+			repeat
+		);
+
+		lua_pop(wheel->state, 1);
+
+		lua_pushnumber(thread, static_cast<lua_Number>(handle));
+		return 1;
+	}
+
+	static inline
+	int luaCancel(State* thread) {
+		TimerWheel* wheel = static_cast<TimerWheel*>(lua_touserdata(thread, lua_upvalueindex(1)));
+		lua_pushboolean(thread, wheel->cancel(static_cast<Handle>(luaL_checknumber(thread, 1))));
+		return 1;
+	}
+};
+
+LUWRA_NS_END
+
+#endif
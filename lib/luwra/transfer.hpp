@@ -0,0 +1,346 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_TRANSFER_H_
+#define LUWRA_TRANSFER_H_
+
+#include "common.hpp"
+#include "usertypes.hpp"
+
+#include <utility>
+
+LUWRA_NS_BEGIN
+
+/// How user type values are handed to another state by @ref transfer
+enum TransferMode {
+	/// Invoke the copy constructor, the original remains untouched
+	TransferCopy,
+
+	/// Invoke the move constructor, the original is left in a moved-from state
+	TransferMove
+};
+
+namespace internal {
+	// Registry name of the table which maps user type metatables to their transfer functions
+	#define LUWRA_TRANSFERERS_NAME LUWRA_REGISTRY_PREFIX "Transferers"
+
+	// Maximum nesting of tables
+	#ifndef LUWRA_TRANSFER_MAX_DEPTH
+		#define LUWRA_TRANSFER_MAX_DEPTH 1000
+	#endif
+
+	// Constructs a copy of the user type value at 'value' in the target state
+	using TransferFunction = void (*)(void* value, State* target);
+
+	template <typename Type>
+	inline
+	void checkTransferTarget(State* target) {
+		luaL_getmetatable(target, UserTypeReg<Type>::name.c_str());
+
+		if (!lua_istable(target, -1))
+			luaL_error(target, "cannot transfer a user type which is not registered in the target state");
+
+		lua_pop(target, 1);
+	}
+
+	template <typename Type, TransferMode Mode>
+	struct UserTypeTransfer;
+
+	template <typename Type>
+	struct UserTypeTransfer<Type, TransferCopy> {
+		static inline
+		void transfer(void* value, State* target) {
+			checkTransferTarget<Type>(target);
+			construct<Type>(target, *static_cast<Type*>(value));
+		}
+
+		// Pushed as light userdata, because function pointers cannot be
+		static
+		const TransferFunction function;
+	};
+
+	template <typename Type>
+	const TransferFunction UserTypeTransfer<Type, TransferCopy>::function =
+		&UserTypeTransfer<Type, TransferCopy>::transfer;
+
+	template <typename Type>
+	struct UserTypeTransfer<Type, TransferMove> {
+		static inline
+		void transfer(void* value, State* target) {
+			checkTransferTarget<Type>(target);
+			construct<Type>(target, std::move(*static_cast<Type*>(value)));
+		}
+
+		static
+		const TransferFunction function;
+	};
+
+	template <typename Type>
+	const TransferFunction UserTypeTransfer<Type, TransferMove>::function =
+		&UserTypeTransfer<Type, TransferMove>::transfer;
+
+	// Walks a value in one state and rebuilds it in the other.
+	//
+	// Everything that may fail happens in the target state, which runs this in protected mode. The
+	// source state is only read from, using functions which do not allocate; its stack is restored
+	// by the caller.
+	struct Transferer {
+		State* from;
+		int index;
+		State* to;
+
+		// Index of the table with the transfer functions in the source state, 0 if there is none
+		int transferers;
+
+		// Index of the table which maps source objects to their copies in the target state
+		int copies = 0;
+
+		size_t depth = 0;
+
+		inline
+		Transferer(State* from, int index, State* to, int transferers):
+			from(from),
+			index(index),
+			to(to),
+			transferers(transferers)
+		{}
+
+		// Push the copy of an object if it has been transferred before.
+		inline
+		bool pushKnown(int index) {
+			lua_pushlightuserdata(to, const_cast<void*>(lua_topointer(from, index)));
+			lua_rawget(to, copies);
+
+			if (lua_isnil(to, -1)) {
+				lua_pop(to, 1);
+				return false;
+			}
+
+			return true;
+		}
+
+		// Remember the value on top of the target stack as the copy of the given object.
+		inline
+		void remember(int index) {
+			lua_pushlightuserdata(to, const_cast<void*>(lua_topointer(from, index)));
+			lua_pushvalue(to, -2);
+			lua_rawset(to, copies);
+		}
+
+		inline
+		void transfer(int index) {
+			switch (lua_type(from, index)) {
+				case LUA_TNIL:
+					lua_pushnil(to);
+					break;
+
+				case LUA_TBOOLEAN:
+					lua_pushboolean(to, lua_toboolean(from, index));
+					break;
+
+				case LUA_TNUMBER:
+#if LUA_VERSION_NUM >= 503
+					if (lua_isinteger(from, index)) {
+						lua_pushinteger(to, lua_tointeger(from, index));
+						break;
+					}
+#endif
+
+					lua_pushnumber(to, lua_tonumber(from, index));
+					break;
+
+				case LUA_TSTRING: {
+					size_t length;
+					const char* data = lua_tolstring(from, index, &length);
+
+					lua_pushlstring(to, data, length);
+					break;
+				}
+
+				case LUA_TLIGHTUSERDATA:
+					lua_pushlightuserdata(to, lua_touserdata(from, index));
+					break;
+
+				case LUA_TTABLE:
+					if (!pushKnown(index))
+						transferTable(index);
+
+					break;
+
+				case LUA_TUSERDATA:
+					if (!pushKnown(index))
+						transferUserData(index);
+
+					break;
+
+				default:
+					luaL_error(to, "cannot transfer a %s", luaL_typename(from, index));
+			}
+		}
+
+		inline
+		void transferTable(int index) {
+			if (++depth > LUWRA_TRANSFER_MAX_DEPTH)
+				luaL_error(to, "cannot transfer: nesting is too deep");
+
+			if (!lua_checkstack(from, 2))
+				luaL_error(to, "cannot transfer: stack overflow");
+
+			luaL_checkstack(to, 4, "cannot transfer: stack overflow");
+
+#if LUA_VERSION_NUM <= 501
+			int array_length = static_cast<int>(lua_objlen(from, index));
+#else
+			int array_length = static_cast<int>(lua_rawlen(from, index));
+#endif
+
+			lua_createtable(to, array_length, 0);
+			remember(index);
+
+			int table = lua_gettop(to);
+
+			lua_pushnil(from);
+			while (lua_next(from, index) != 0) {
+				int top = lua_gettop(from);
+
+				transfer(top - 1);
+				transfer(top);
+				lua_rawset(to, table);
+
+				lua_pop(from, 1);
+			}
+
+			depth--;
+		}
+
+		inline
+		void transferUserData(int index) {
+			TransferFunction function = nullptr;
+
+			if (transferers != 0 && lua_getmetatable(from, index)) {
+				lua_rawget(from, transferers);
+
+				if (lua_islightuserdata(from, -1))
+					function = *static_cast<const TransferFunction*>(lua_touserdata(from, -1));
+
+				lua_pop(from, 1);
+			}
+
+			if (!function)
+				luaL_error(to, "cannot transfer a userdata without transfer hook");
+
+			function(lua_touserdata(from, index), to);
+			remember(index);
+		}
+	};
+
+	// Protected part of 'transfer', runs in the target state
+	inline
+	int transferValue(State* state) {
+		Transferer* transferer = static_cast<Transferer*>(lua_touserdata(state, 1));
+
+		lua_newtable(state);
+		transferer->copies = lua_gettop(state);
+
+		transferer->transfer(transferer->index);
+		return 1;
+	}
+}
+
+/// Copy a value from one state onto the stack of another, independent state.
+///
+/// Tables are copied deeply; cycles and tables which are referenced more than once are preserved.
+/// Besides tables, strings, numbers, booleans and light userdata are supported, as well as user
+/// types for which @ref registerTransfer has been used. Metatables of tables are not copied. Other
+/// values such as functions cause the transfer to fail.
+///
+/// Values are copied directly, without going through a serialized representation.
+///
+/// \param from  Source state
+/// \param index Index of the value in the source state
+/// \param to    Target state
+/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+///          target stack
+///
+/// Example:
+///
+/// ```
+///   lua_getglobal(worker, "request");
+///   transfer(worker, -1, other_worker);
+/// ```
+inline
+int transfer(State* from, int index, State* to) {
+	if (index < 0 && index > LUA_REGISTRYINDEX)
+		index = lua_gettop(from) + index + 1;
+
+	// Values which can be pushed without allocating need no protection. Strings have to be
+	// copied in protected mode, because the target state may run out of memory.
+	switch (lua_type(from, index)) {
+		case LUA_TTABLE:
+		case LUA_TUSERDATA:
+		case LUA_TSTRING:
+			break;
+
+		case LUA_TNIL:
+		case LUA_TBOOLEAN:
+		case LUA_TNUMBER:
+		case LUA_TLIGHTUSERDATA: {
+			internal::Transferer transferer(from, index, to, 0);
+			transferer.transfer(index);
+
+			return LUA_OK;
+		}
+
+		default:
+			lua_pushfstring(to, "cannot transfer a %s", luaL_typename(from, index));
+			return LUA_ERRRUN;
+	}
+
+	int base = lua_gettop(from);
+
+	lua_getfield(from, LUA_REGISTRYINDEX, LUWRA_TRANSFERERS_NAME);
+	internal::Transferer transferer(from, index, to, lua_istable(from, -1) ? base + 1 : 0);
+
+	lua_pushcfunction(to, &internal::transferValue);
+	lua_pushlightuserdata(to, &transferer);
+
+	int status = lua_pcall(to, 1, 1, 0);
+	lua_settop(from, base);
+
+	return status;
+}
+
+/// Allow values of a user type to be copied to other states using @ref transfer. This has to be
+/// done in the source state. The user type has to be registered in the target state, so that the
+/// copy receives the right metatable.
+///
+/// \tparam UserType User type
+/// \tparam Mode     Whether values are copied or moved
+///
+/// \param state Lua state
+///
+/// Example:
+///
+/// ```
+///   registerTransfer<Point>(state);
+///   registerTransfer<Connection, TransferMove>(state);
+/// ```
+template <typename UserType, TransferMode Mode = TransferCopy> inline
+void registerTransfer(State* state) {
+	using Wrapper = internal::UserTypeWrapper<UserType>;
+	using Transfer = internal::UserTypeTransfer<typename Wrapper::Type, Mode>;
+
+	luaL_newmetatable(state, LUWRA_TRANSFERERS_NAME);
+	luaL_newmetatable(state, Wrapper::name.c_str());
+	lua_pushlightuserdata(state, const_cast<internal::TransferFunction*>(&Transfer::function));
+	lua_rawset(state, -3);
+
+	lua_pop(state, 1);
+}
+
+LUWRA_NS_END
+
+#endif
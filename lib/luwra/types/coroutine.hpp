@@ -0,0 +1,157 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_TYPES_COROUTINE_H_
+#define LUWRA_TYPES_COROUTINE_H_
+
+#include "../common.hpp"
+#include "../values.hpp"
+#include "../stack.hpp"
+#include "reference.hpp"
+
+#include <utility>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Push call arguments, unlike 'push' this accepts an empty argument list.
+	inline
+	void pushArguments(State*) {}
+
+	template <typename... Args> inline
+	void pushArguments(State* state, Args&&... args) {
+		push(state, std::forward<Args>(args)...);
+	}
+
+	// Resume a thread. 'results' receives the number of values which have been yielded or
+	// returned.
+	inline
+	int resumeThread(State* thread, State* from, int arguments, int* results) {
+#if LUA_VERSION_NUM >= 504
+		return lua_resume(thread, from, arguments, results);
+#elif LUA_VERSION_NUM >= 502
+		int status = lua_resume(thread, from, arguments);
+		*results = lua_gettop(thread);
+		return status;
+#else
+		(void) from;
+
+		int status = lua_resume(thread, arguments);
+		*results = lua_gettop(thread);
+		return status;
+#endif
+	}
+}
+
+/// Lua function which runs in its own thread, so that it can yield back to C++. Create it using
+/// @ref Function::startCoroutine.
+///
+/// Example:
+///
+/// ```
+///   Function<int> generator = state.get<Function<int>>("countTo");
+///   Coroutine<int> coroutine = generator.startCoroutine(10);
+///
+///   while (coroutine.resume() == LUA_YIELD)
+///       std::cout << coroutine.value() << std::endl;
+/// ```
+///
+/// \tparam Ret Type of the values which are yielded or returned
+template <typename Ret>
+struct Coroutine {
+	/// Create using a callable and its arguments on top of the stack. They are moved into a new
+	/// thread. The callable does not run until the first call to @ref resume.
+	///
+	/// \param state     Lua state
+	/// \param arguments Number of arguments
+	inline
+	Coroutine(State* state, int arguments):
+		thread(lua_newthread(state)),
+		ref(state),
+		pending(arguments)
+	{
+		// The reference has consumed the thread
+		lua_xmove(state, thread, arguments + 1);
+	}
+
+	Coroutine(const Coroutine&) = delete;
+	Coroutine& operator =(const Coroutine&) = delete;
+
+	Coroutine(Coroutine&&) = default;
+	Coroutine& operator =(Coroutine&&) = default;
+
+	/// Continue the coroutine until it yields, returns or fails. The given arguments become the
+	/// results of the `coroutine.yield` call; on the first call they are appended to the arguments
+	/// given to @ref Function::startCoroutine.
+	///
+	/// \returns `LUA_YIELD` if the coroutine has yielded, `LUA_OK` if it has returned, otherwise
+	///          the error status with the error object on top of @ref thread's stack
+	template <typename... Args> inline
+	int resume(Args&&... args) {
+		if (current != LUA_YIELD)
+			return current;
+
+		// Values from the previous yield
+		lua_pop(thread, results);
+
+		internal::pushArguments(thread, std::forward<Args>(args)...);
+
+		results = 0;
+		current = internal::resumeThread(
+			thread,
+			ref.life->state,
+			pending + static_cast<int>(sizeof...(Args)),
+			&results
+		);
+		pending = 0;
+
+		return current;
+	}
+
+	/// Status of the coroutine. It is `LUA_YIELD` as long as it can be resumed.
+	inline
+	int status() const {
+		return current;
+	}
+
+	/// Check whether the coroutine can be resumed.
+	inline
+	bool isSuspended() const {
+		return current == LUA_YIELD;
+	}
+
+	/// Number of values which the coroutine has yielded or returned most recently
+	inline
+	int size() const {
+		return current == LUA_YIELD || current == LUA_OK ? results : 0;
+	}
+
+	/// Retrieve a value which the coroutine has yielded or returned most recently.
+	///
+	/// \param n Position of the value, starting at 1
+	/// \returns Value at the given position
+	template <typename Type = Ret> inline
+	Type value(int n = 1) const {
+		return read<Type>(thread, lua_gettop(thread) - results + n);
+	}
+
+	/// Thread in which the coroutine runs
+	State* thread;
+
+private:
+	// Keeps the thread alive
+	Reference ref;
+
+	int current = LUA_YIELD;
+	int results = 0;
+
+	// Arguments which are waiting for the first resume
+	int pending;
+};
+
+LUWRA_NS_END
+
+#endif
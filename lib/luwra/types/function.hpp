@@ -10,7 +10,10 @@
 #include "../common.hpp"
 #include "../values.hpp"
 #include "../stack.hpp"
+#include "../memory.hpp"
 #include "reference.hpp"
+#include "coroutine.hpp"
+#include "memoized.hpp"
 
 #include <utility>
 #include <functional>
@@ -19,6 +22,22 @@ LUWRA_NS_BEGIN
 
 /// A callable Lua value.
 ///
+/// Functions which return several values can be called with `std::tuple` or `std::pair` as `Ret`.
+/// Each result is then read directly off the stack. With @ref StackRange as `Ret`, all results are
+/// left on the stack and the caller has to remove them.
+///
+/// Example:
+///
+/// ```
+///   using Lookup = Function<std::tuple<int, std::string>>;
+///   std::tuple<int, std::string> entry = state.get<Lookup>("lookup")("key");
+///
+///   StackRange results = state.get<Function<StackRange>>("unpack")();
+///   for (int i = 1; i <= results.size(); i++)
+///       consume(results.read<double>(i));
+///   results.pop();
+/// ```
+///
 /// \tparam Ret Expected return type
 template <typename Ret>
 struct Function {
@@ -50,30 +69,72 @@ struct Function {
 	/// Invoke the callable without arguments.
 	inline
 	Ret operator ()() const {
-		auto life = *ref.life;
+		const RefLifecycle& life = *ref.life;
+		int base = lua_gettop(life.state);
 
 		life.push();
 
-		lua_call(life.state, 0, 1);
-		Ret returnValue = read<Ret>(life.state, -1);
-
-		lua_pop(life.state, 1);
-		return returnValue;
+		lua_call(life.state, 0, internal::CallResults<Ret>::count);
+		return internal::CallResults<Ret>::take(life.state, base);
 	}
 
 	/// Invoke the callable with arguments.
 	template <typename... Args> inline
 	Ret operator ()(Args&&... args) const {
-		auto life = *ref.life;
+		const RefLifecycle& life = *ref.life;
+		int base = lua_gettop(life.state);
 
 		life.push();
 		push(life.state, std::forward<Args>(args)...);
 
-		lua_call(life.state, sizeof...(Args), 1);
-		Ret returnValue = read<Ret>(life.state, -1);
+		lua_call(life.state, sizeof...(Args), internal::CallResults<Ret>::count);
+		return internal::CallResults<Ret>::take(life.state, base);
+	}
+
+	/// Invoke the callable in protected mode.
+	///
+	/// \param result Receives the return value if the call succeeds
+	/// \param args   Arguments
+	/// \returns `LUA_OK` on success, otherwise the status code of `lua_pcall` (e.g. `LUA_ERRMEM`)
+	///          with the error object on top of the stack
+	template <typename... Args> inline
+	int pcall(Ret& result, Args&&... args) const {
+		const RefLifecycle& life = *ref.life;
+		collectRequestedGarbage(life.state);
+		int base = lua_gettop(life.state);
+
+		life.push();
+		internal::pushArguments(life.state, std::forward<Args>(args)...);
+
+		int status = lua_pcall(life.state, sizeof...(Args), internal::CallResults<Ret>::count, 0);
+		if (status != LUA_OK)
+			return status;
+
+		result = internal::CallResults<Ret>::take(life.state, base);
+		return LUA_OK;
+	}
+
+	/// Run the callable in a new thread, so that it can yield. See @ref Coroutine.
+	///
+	/// \param args Arguments
+	/// \returns Coroutine which begins running when it is resumed for the first time
+	template <typename... Args> inline
+	Coroutine<Ret> startCoroutine(Args&&... args) const {
+		const RefLifecycle& life = *ref.life;
+
+		life.push();
+		internal::pushArguments(life.state, std::forward<Args>(args)...);
+
+		return {life.state, static_cast<int>(sizeof...(Args))};
+	}
 
-		lua_pop(life.state, 1);
-		return returnValue;
+	/// Cache the results of the callable. See @ref MemoizedFunction.
+	///
+	/// \param capacity Maximum number of cached results
+	/// \returns Callable which only invokes this one for arguments it has no result for
+	inline
+	MemoizedFunction<Ret> memoized(size_t capacity) const {
+		return {ref, capacity};
 	}
 };
 
@@ -108,7 +169,7 @@ struct Function<void> {
 	/// Invoke the callable without arguments.
 	inline
 	void operator ()() const {
-		auto life = *ref.life;
+		const RefLifecycle& life = *ref.life;
 
 		life.push();
 		lua_call(life.state, 0, 0);
@@ -117,13 +178,43 @@ struct Function<void> {
 	/// Invoke the callable with arguments.
 	template <typename... Args> inline
 	void operator ()(Args&&... args) const {
-		auto life = *ref.life;
+		const RefLifecycle& life = *ref.life;
 
 		life.push();
 		push(life.state, std::forward<Args>(args)...);
 
 		lua_call(life.state, sizeof...(Args), 0);
 	}
+
+	/// Invoke the callable in protected mode.
+	///
+	/// \param args Arguments
+	/// \returns `LUA_OK` on success, otherwise the status code of `lua_pcall` (e.g. `LUA_ERRMEM`)
+	///          with the error object on top of the stack
+	template <typename... Args> inline
+	int pcall(Args&&... args) const {
+		const RefLifecycle& life = *ref.life;
+
+		collectRequestedGarbage(life.state);
+		life.push();
+		internal::pushArguments(life.state, std::forward<Args>(args)...);
+
+		return lua_pcall(life.state, sizeof...(Args), 0, 0);
+	}
+
+	/// Run the callable in a new thread, so that it can yield. See @ref Coroutine.
+	///
+	/// \param args Arguments
+	/// \returns Coroutine which begins running when it is resumed for the first time
+	template <typename... Args> inline
+	Coroutine<void> startCoroutine(Args&&... args) const {
+		const RefLifecycle& life = *ref.life;
+
+		life.push();
+		internal::pushArguments(life.state, std::forward<Args>(args)...);
+
+		return {life.state, static_cast<int>(sizeof...(Args))};
+	}
 };
 
 /// Enables reading/pushing Lua functions
@@ -0,0 +1,988 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_TYPES_JSON_H_
+#define LUWRA_TYPES_JSON_H_
+
+#include "../common.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <string>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+	#if __has_include(<charconv>)
+		#include <charconv>
+	#endif
+#endif
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Nesting limit for encoding and decoding; also catches cycles during encoding
+	#ifndef LUWRA_JSON_MAX_DEPTH
+		#define LUWRA_JSON_MAX_DEPTH 1000
+	#endif
+
+	// Number of values which are collected on the stack before they are moved into their table
+	#ifndef LUWRA_JSON_BATCH_SIZE
+		#define LUWRA_JSON_BATCH_SIZE 64
+	#endif
+
+	// Parses JSON and pushes the resulting values. Syntax errors are raised as Lua errors.
+	//
+	// Elements of arrays and objects are collected on the stack first, so that the table can be
+	// created with the right size. Large tables are filled in batches.
+	struct JSONDecoder {
+		State* state;
+		const char* begin;
+		const char* current;
+		const char* end;
+		size_t depth = 0;
+
+		inline
+		JSONDecoder(State* state, const char* data, size_t length):
+			state(state),
+			begin(data),
+			current(data),
+			end(data + length)
+		{}
+
+		inline
+		void fail(const char* message) {
+			luaL_error(
+				state,
+				"cannot decode JSON: %s at position %d",
+				message,
+				int(current - begin)
+			);
+		}
+
+		inline
+		void skipWhitespace() {
+			while (
+				current < end
+				&& (*current == ' ' || *current == '\t' || *current == '\n' || *current == '\r')
+			)
+				current++;
+		}
+
+		// Decode the whole input, which must contain exactly one value.
+		inline
+		void decodeDocument() {
+			decodeValue();
+			skipWhitespace();
+
+			if (current != end)
+				fail("unexpected trailing characters");
+		}
+
+		inline
+		void expectLiteral(const char* literal, size_t length) {
+			if (size_t(end - current) < length || std::memcmp(current, literal, length) != 0)
+				fail("invalid literal");
+
+			current += length;
+		}
+
+		inline
+		void decodeValue() {
+			skipWhitespace();
+
+			if (current == end)
+				fail("unexpected end of input");
+
+			switch (*current) {
+				case '{':
+					decodeObject();
+					break;
+
+				case '[':
+					decodeArray();
+					break;
+
+				case '"':
+					decodeString();
+					break;
+
+				case 't':
+					expectLiteral("true", 4);
+					lua_pushboolean(state, 1);
+					break;
+
+				case 'f':
+					expectLiteral("false", 5);
+					lua_pushboolean(state, 0);
+					break;
+
+				case 'n':
+					expectLiteral("null", 4);
+					lua_pushlightuserdata(state, nullptr);
+					break;
+
+				default:
+					decodeNumber();
+					break;
+			}
+		}
+
+		inline
+		void enter() {
+			if (++depth > LUWRA_JSON_MAX_DEPTH)
+				fail("nesting is too deep");
+		}
+
+		// Move 'pending' values from the top of the stack into the array. Creates the array if
+		// 'table' is 0.
+		inline
+		void flushArray(int& table, int base, size_t& length, int& pending) {
+			if (table == 0) {
+				lua_createtable(state, pending, 0);
+				lua_insert(state, base + 1);
+				table = base + 1;
+			}
+
+			for (int i = pending; i > 0; i--)
+				lua_rawseti(state, table, static_cast<int>(length) + i);
+
+			length += static_cast<size_t>(pending);
+			pending = 0;
+		}
+
+		inline
+		void decodeArray() {
+			enter();
+			current++;
+
+			int base = lua_gettop(state);
+			int table = 0;
+			size_t length = 0;
+			int pending = 0;
+
+			skipWhitespace();
+
+			if (current < end && *current == ']') {
+				current++;
+			} else {
+				for (;;) {
+					if (pending == LUWRA_JSON_BATCH_SIZE || !lua_checkstack(state, 4)) {
+						flushArray(table, base, length, pending);
+
+						// Nothing may have been pending
+						if (!lua_checkstack(state, 4))
+							fail("nesting is too deep");
+					}
+
+					decodeValue();
+					pending++;
+
+					skipWhitespace();
+
+					if (current == end)
+						fail("unexpected end of input");
+
+					if (*current == ']') {
+						current++;
+						break;
+					}
+
+					if (*current != ',')
+						fail("expected ',' or ']'");
+
+					current++;
+				}
+			}
+
+			flushArray(table, base, length, pending);
+			depth--;
+		}
+
+		inline
+		void flushObject(int& table, int base, int& pending) {
+			if (table == 0) {
+				lua_createtable(state, 0, pending);
+				lua_insert(state, base + 1);
+				table = base + 1;
+			}
+
+			// Set the pairs in source order, so that the last of duplicate keys wins
+			for (int pair = table + 1; pair < table + 1 + 2 * pending; pair += 2) {
+				lua_pushvalue(state, pair);
+				lua_pushvalue(state, pair + 1);
+				lua_rawset(state, table);
+			}
+
+			lua_settop(state, table);
+			pending = 0;
+		}
+
+		inline
+		void decodeObject() {
+			enter();
+			current++;
+
+			int base = lua_gettop(state);
+			int table = 0;
+			int pending = 0;
+
+			skipWhitespace();
+
+			if (current < end && *current == '}') {
+				current++;
+			} else {
+				for (;;) {
+					if (pending == LUWRA_JSON_BATCH_SIZE || !lua_checkstack(state, 6)) {
+						flushObject(table, base, pending);
+
+						if (!lua_checkstack(state, 6))
+							fail("nesting is too deep");
+					}
+
+					skipWhitespace();
+
+					if (current == end || *current != '"')
+						fail("expected string key");
+
+					decodeString();
+					skipWhitespace();
+
+					if (current == end || *current != ':')
+						fail("expected ':'");
+
+					current++;
+
+					decodeValue();
+					pending++;
+
+					skipWhitespace();
+
+					if (current == end)
+						fail("unexpected end of input");
+
+					if (*current == '}') {
+						current++;
+						break;
+					}
+
+					if (*current != ',')
+						fail("expected ',' or '}'");
+
+					current++;
+				}
+			}
+
+			flushObject(table, base, pending);
+			depth--;
+		}
+
+		static inline
+		int hexValue(char c) {
+			if (c >= '0' && c <= '9')
+				return c - '0';
+			else if (c >= 'a' && c <= 'f')
+				return c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				return c - 'A' + 10;
+			else
+				return -1;
+		}
+
+		inline
+		unsigned readCodeUnit() {
+			if (end - current < 4)
+				fail("invalid escape sequence");
+
+			unsigned value = 0;
+			for (int i = 0; i < 4; i++) {
+				int digit = hexValue(current[i]);
+				if (digit < 0)
+					fail("invalid escape sequence");
+
+				value = (value << 4) | unsigned(digit);
+			}
+
+			current += 4;
+			return value;
+		}
+
+		inline
+		void addCodePoint(luaL_Buffer& buffer, unsigned code) {
+			char bytes[4];
+			size_t length;
+
+			if (code < 0x80) {
+				bytes[0] = char(code);
+				length = 1;
+			} else if (code < 0x800) {
+				bytes[0] = char(0xC0 | (code >> 6));
+				bytes[1] = char(0x80 | (code & 0x3F));
+				length = 2;
+			} else if (code < 0x10000) {
+				bytes[0] = char(0xE0 | (code >> 12));
+				bytes[1] = char(0x80 | ((code >> 6) & 0x3F));
+				bytes[2] = char(0x80 | (code & 0x3F));
+				length = 3;
+			} else {
+				bytes[0] = char(0xF0 | (code >> 18));
+				bytes[1] = char(0x80 | ((code >> 12) & 0x3F));
+				bytes[2] = char(0x80 | ((code >> 6) & 0x3F));
+				bytes[3] = char(0x80 | (code & 0x3F));
+				length = 4;
+			}
+
+			luaL_addlstring(&buffer, bytes, length);
+		}
+
+		inline
+		void decodeString() {
+			current++;
+			const char* start = current;
+
+			// Strings without escape sequences are pushed straight from the input.
+			while (current < end && *current != '"' && *current != '\\') {
+				if (static_cast<unsigned char>(*current) < 0x20)
+					fail("control character in string");
+
+				current++;
+			}
+
+			if (current == end)
+				fail("unterminated string");
+
+			if (*current == '"') {
+				lua_pushlstring(state, start, size_t(current - start));
+				current++;
+				return;
+			}
+
+			luaL_Buffer buffer;
+			luaL_buffinit(state, &buffer);
+			luaL_addlstring(&buffer, start, size_t(current - start));
+
+			while (current < end && *current != '"') {
+				if (*current != '\\') {
+					start = current;
+
+					while (current < end && *current != '"' && *current != '\\') {
+						if (static_cast<unsigned char>(*current) < 0x20)
+							fail("control character in string");
+
+						current++;
+					}
+
+					luaL_addlstring(&buffer, start, size_t(current - start));
+					continue;
+				}
+
+				current++;
+				if (current == end)
+					break;
+
+				char escaped = *current++;
+
+				switch (escaped) {
+					case '"':  luaL_addchar(&buffer, '"');  break;
+					case '\\': luaL_addchar(&buffer, '\\'); break;
+					case '/':  luaL_addchar(&buffer, '/');  break;
+					case 'b':  luaL_addchar(&buffer, '\b'); break;
+					case 'f':  luaL_addchar(&buffer, '\f'); break;
+					case 'n':  luaL_addchar(&buffer, '\n'); break;
+					case 'r':  luaL_addchar(&buffer, '\r'); break;
+					case 't':  luaL_addchar(&buffer, '\t'); break;
+
+					case 'u': {
+						unsigned code = readCodeUnit();
+
+						// Surrogate pairs
+						if (code >= 0xD800 && code <= 0xDBFF) {
+							if (end - current < 6 || current[0] != '\\' || current[1] != 'u')
+								fail("invalid surrogate pair");
+
+							current += 2;
+							unsigned low = readCodeUnit();
+
+							if (low < 0xDC00 || low > 0xDFFF)
+								fail("invalid surrogate pair");
+
+							code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+						} else if (code >= 0xDC00 && code <= 0xDFFF) {
+							fail("invalid surrogate pair");
+						}
+
+						addCodePoint(buffer, code);
+						break;
+					}
+
+					default:
+						fail("invalid escape sequence");
+				}
+			}
+
+			if (current == end)
+				fail("unterminated string");
+
+			current++;
+			luaL_pushresult(&buffer);
+		}
+
+		inline
+		void decodeNumber() {
+			const char* start = current;
+
+			bool negative = false;
+			if (current < end && *current == '-') {
+				negative = true;
+				current++;
+			}
+
+			if (current == end || *current < '0' || *current > '9')
+				fail("unexpected character");
+
+			// Collect up to 19 significant digits
+			uint64_t mantissa = 0;
+			int digits = 0;
+			int exponent = 0;
+
+			if (*current == '0') {
+				current++;
+			} else {
+				while (current < end && *current >= '0' && *current <= '9') {
+					if (digits < 19) {
+						mantissa = mantissa * 10 + uint64_t(*current - '0');
+						digits++;
+					} else {
+						exponent++;
+					}
+
+					current++;
+				}
+			}
+
+			bool integral = true;
+
+			if (current < end && *current == '.') {
+				integral = false;
+				current++;
+
+				if (current == end || *current < '0' || *current > '9')
+					fail("invalid number");
+
+				while (current < end && *current >= '0' && *current <= '9') {
+					// Leading zeros are not significant
+					if (digits < 19) {
+						mantissa = mantissa * 10 + uint64_t(*current - '0');
+						exponent--;
+
+						if (mantissa != 0)
+							digits++;
+					}
+
+					current++;
+				}
+			}
+
+			if (current < end && (*current == 'e' || *current == 'E')) {
+				integral = false;
+				current++;
+
+				bool negative_exponent = false;
+				if (current < end && (*current == '+' || *current == '-')) {
+					negative_exponent = *current == '-';
+					current++;
+				}
+
+				if (current == end || *current < '0' || *current > '9')
+					fail("invalid number");
+
+				int value = 0;
+				while (current < end && *current >= '0' && *current <= '9') {
+					if (value < 100000)
+						value = value * 10 + (*current - '0');
+
+					current++;
+				}
+
+				exponent += negative_exponent ? -value : value;
+			}
+
+#if LUA_VERSION_NUM >= 503
+			if (integral && exponent == 0) {
+				if (!negative && mantissa <= uint64_t(INT64_MAX)) {
+					lua_pushinteger(state, static_cast<lua_Integer>(mantissa));
+					return;
+				} else if (negative && mantissa <= uint64_t(INT64_MAX) + 1) {
+					lua_pushinteger(state, static_cast<lua_Integer>(0 - mantissa));
+					return;
+				}
+			}
+#else
+			(void) integral;
+#endif
+
+			// Exact for up to 15 digits and small exponents, because both operands are
+			// representable as double.
+			static const double powers[] = {
+				1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+				1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+			};
+
+			if (digits <= 15 && exponent >= -22 && exponent <= 22) {
+				double value = static_cast<double>(mantissa);
+				value = exponent < 0 ? value / powers[-exponent] : value * powers[exponent];
+
+				lua_pushnumber(state, static_cast<lua_Number>(negative ? -value : value));
+				return;
+			}
+
+			// Let Lua convert everything else
+			lua_pushlstring(state, start, size_t(current - start));
+			lua_Number value = lua_tonumber(state, -1);
+			lua_pop(state, 1);
+
+			lua_pushnumber(state, value);
+		}
+	};
+
+	// Writes values as JSON. Errors (unsupported values, cycles) are raised as Lua errors.
+	struct JSONEncoder {
+		State* state;
+		std::string& output;
+		size_t depth = 0;
+
+		inline
+		JSONEncoder(State* state, std::string& output):
+			state(state),
+			output(output)
+		{}
+
+		inline
+		void encodeInteger(long long value) {
+			char buffer[24];
+			char* position = buffer + sizeof(buffer);
+
+			unsigned long long magnitude =
+				value < 0 ? 0ull - static_cast<unsigned long long>(value) : value;
+
+			do {
+				*--position = char('0' + magnitude % 10);
+				magnitude /= 10;
+			} while (magnitude != 0);
+
+			if (value < 0)
+				*--position = '-';
+
+			output.append(position, size_t(buffer + sizeof(buffer) - position));
+		}
+
+		inline
+		void encodeNumber(int index) {
+#if LUA_VERSION_NUM >= 503
+			if (lua_isinteger(state, index)) {
+				encodeInteger(static_cast<long long>(lua_tointeger(state, index)));
+				return;
+			}
+#endif
+
+			double value = static_cast<double>(lua_tonumber(state, index));
+
+			if (std::isnan(value) || std::isinf(value))
+				luaL_error(state, "cannot encode JSON: %f is not a valid number", lua_tonumber(state, index));
+
+			if (value == std::floor(value) && std::fabs(value) < 1e15) {
+				encodeInteger(static_cast<long long>(value));
+				return;
+			}
+
+			char buffer[32];
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+			// Shortest representation which reads back as the same value
+			std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			output.append(buffer, size_t(result.ptr - buffer));
+#else
+			int length = std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+
+			if (std::strtod(buffer, nullptr) != value)
+				length = std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+
+			// Guard against locales which use a different decimal separator
+			for (int i = 0; i < length; i++) {
+				if (buffer[i] == ',')
+					buffer[i] = '.';
+			}
+
+			output.append(buffer, size_t(length));
+#endif
+		}
+
+		inline
+		void encodeString(int index) {
+			static const char hex[] = "0123456789abcdef";
+
+			size_t length;
+			const char* data = lua_tolstring(state, index, &length);
+			const char* end = data + length;
+
+			output.push_back('"');
+
+			while (data < end) {
+				// Copy runs of characters which need no escaping at once.
+				const char* start = data;
+				while (
+					data < end
+					&& static_cast<unsigned char>(*data) >= 0x20
+					&& *data != '"'
+					&& *data != '\\'
+				)
+					data++;
+
+				output.append(start, size_t(data - start));
+
+				if (data == end)
+					break;
+
+				char c = *data++;
+
+				switch (c) {
+					case '"':  output.append("\\\"", 2); break;
+					case '\\': output.append("\\\\", 2); break;
+					case '\b': output.append("\\b", 2);  break;
+					case '\f': output.append("\\f", 2);  break;
+					case '\n': output.append("\\n", 2);  break;
+					case '\r': output.append("\\r", 2);  break;
+					case '\t': output.append("\\t", 2);  break;
+
+					default: {
+						char escaped[6] = {
+							'\\', 'u', '0', '0',
+							hex[(static_cast<unsigned char>(c) >> 4) & 0xF],
+							hex[static_cast<unsigned char>(c) & 0xF]
+						};
+
+						output.append(escaped, 6);
+						break;
+					}
+				}
+			}
+
+			output.push_back('"');
+		}
+
+		// Determine whether the table at the given index is a sequence, and its length.
+		inline
+		bool isArray(int index, size_t& length) {
+			size_t count = 0;
+			lua_Number max = 0;
+
+			lua_pushnil(state);
+			while (lua_next(state, index) != 0) {
+				lua_pop(state, 1);
+
+				if (lua_type(state, -1) != LUA_TNUMBER) {
+					lua_pop(state, 1);
+					return false;
+				}
+
+				lua_Number key = lua_tonumber(state, -1);
+				if (key < 1 || key != std::floor(key)) {
+					lua_pop(state, 1);
+					return false;
+				}
+
+				if (key > max)
+					max = key;
+
+				count++;
+			}
+
+			length = count;
+			return count > 0 && max == static_cast<lua_Number>(count);
+		}
+
+		inline
+		void encodeTable(int index) {
+			if (++depth > LUWRA_JSON_MAX_DEPTH)
+				luaL_error(state, "cannot encode JSON: nesting is too deep or table is cyclic");
+
+			luaL_checkstack(state, 4, "cannot encode JSON: nesting is too deep");
+
+			size_t length;
+
+			if (isArray(index, length)) {
+				output.push_back('[');
+
+				for (size_t i = 1; i <= length; i++) {
+					if (i > 1)
+						output.push_back(',');
+
+					lua_rawgeti(state, index, static_cast<int>(i));
+					encode(lua_gettop(state));
+					lua_pop(state, 1);
+				}
+
+				output.push_back(']');
+			} else {
+				output.push_back('{');
+				bool first = true;
+
+				lua_pushnil(state);
+				while (lua_next(state, index) != 0) {
+					int top = lua_gettop(state);
+
+					if (!first)
+						output.push_back(',');
+
+					first = false;
+
+					switch (lua_type(state, top - 1)) {
+						case LUA_TSTRING:
+							encodeString(top - 1);
+							break;
+
+						case LUA_TNUMBER:
+							// Convert a copy, because converting the key itself confuses 'lua_next'
+							lua_pushvalue(state, top - 1);
+							lua_tostring(state, -1);
+							encodeString(lua_gettop(state));
+							lua_pop(state, 1);
+							break;
+
+						default:
+							luaL_error(
+								state,
+								"cannot encode JSON: %s keys are not supported",
+								luaL_typename(state, top - 1)
+							);
+					}
+
+					output.push_back(':');
+					encode(top);
+
+					lua_pop(state, 1);
+				}
+
+				output.push_back('}');
+			}
+
+			depth--;
+		}
+
+		// Write the value at the given (absolute) index.
+		inline
+		void encode(int index) {
+			switch (lua_type(state, index)) {
+				case LUA_TNIL:
+					output.append("null", 4);
+					break;
+
+				case LUA_TBOOLEAN:
+					if (lua_toboolean(state, index))
+						output.append("true", 4);
+					else
+						output.append("false", 5);
+
+					break;
+
+				case LUA_TNUMBER:
+					encodeNumber(index);
+					break;
+
+				case LUA_TSTRING:
+					encodeString(index);
+					break;
+
+				case LUA_TTABLE:
+					encodeTable(index);
+					break;
+
+				case LUA_TLIGHTUSERDATA:
+					if (lua_touserdata(state, index) == nullptr) {
+						output.append("null", 4);
+						break;
+					}
+
+					// Fall through
+
+				default:
+					luaL_error(state, "cannot encode JSON: %s is not supported", luaL_typename(state, index));
+			}
+		}
+	};
+
+	// Protected part of 'decodeJSON'
+	inline
+	int decodeJSONProtected(State* state) {
+		static_cast<JSONDecoder*>(lua_touserdata(state, 1))->decodeDocument();
+		return 1;
+	}
+
+	// Protected part of 'encodeJSON'
+	inline
+	int encodeJSONProtected(State* state) {
+		static_cast<JSONEncoder*>(lua_touserdata(state, 1))->encode(2);
+		return 0;
+	}
+
+	// 'json.decode(text)'
+	inline
+	int jsonDecode(State* state) {
+		size_t length;
+		const char* data = luaL_checklstring(state, 1, &length);
+
+		JSONDecoder decoder(state, data, length);
+		decoder.decodeDocument();
+
+		return 1;
+	}
+
+	// 'json.encode(value)'. The output buffer is kept in the first upvalue and reused.
+	inline
+	int jsonEncode(State* state) {
+		luaL_checkany(state, 1);
+		lua_settop(state, 1);
+
+		std::string& buffer = *static_cast<std::string*>(lua_touserdata(state, lua_upvalueindex(1)));
+		buffer.clear();
+
+		JSONEncoder encoder(state, buffer);
+		encoder.encode(1);
+
+		lua_pushlstring(state, buffer.data(), buffer.size());
+
+		// Do not hold on to exceptionally large buffers
+		if (buffer.capacity() > 1024 * 1024)
+			std::string().swap(buffer);
+
+		return 1;
+	}
+
+	inline
+	int destroyJSONBuffer(State* state) {
+		using String = std::string;
+		static_cast<String*>(lua_touserdata(state, 1))->~String();
+		return 0;
+	}
+}
+
+/// Decode JSON and push the resulting value. Arrays and objects become tables, `null` becomes
+/// @ref jsonNull so that it can be stored in tables. Integers are pushed as Lua integers if the
+/// Lua version has them.
+///
+/// \param state  Lua state
+/// \param data   JSON text
+/// \param length Length of the JSON text
+/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+///          stack
+inline
+int decodeJSON(State* state, const char* data, size_t length) {
+	internal::JSONDecoder decoder(state, data, length);
+
+	lua_pushcfunction(state, &internal::decodeJSONProtected);
+	lua_pushlightuserdata(state, &decoder);
+
+	return lua_pcall(state, 1, 1, 0);
+}
+
+/// Encode the value at the given index as JSON. Tables whose keys form the sequence `1..n` become
+/// arrays, all other tables become objects. `nil` and @ref jsonNull become `null`.
+///
+/// \param state  Lua state
+/// \param index  Index of the value
+/// \param output Receives the JSON text; it is appended to
+/// \returns `LUA_OK` on success, otherwise a status code with the error message on top of the
+///          stack
+inline
+int encodeJSON(State* state, int index, std::string& output) {
+	if (index < 0 && index > LUA_REGISTRYINDEX)
+		index = lua_gettop(state) + index + 1;
+
+	internal::JSONEncoder encoder(state, output);
+
+	lua_pushcfunction(state, &internal::encodeJSONProtected);
+	lua_pushlightuserdata(state, &encoder);
+	lua_pushvalue(state, index);
+
+	return lua_pcall(state, 2, 0, 0);
+}
+
+/// Representation of JSON's `null`, a light userdata which holds a null pointer
+static
+void* const jsonNull = nullptr;
+
+/// Push the JSON module, a table with the functions `decode` and `encode` and the value `null`.
+/// This has the signature of a `lua_CFunction`, therefore it can be used with `luaL_requiref` or
+/// as an entry in `package.preload`.
+///
+/// Example:
+///
+/// ```
+///   registerJSON(state);
+/// ```
+///
+/// in Lua
+///
+/// ```
+///   local json = require('json')
+///   local data = json.decode('{"list": [1, 2, null]}')
+///   print(data.list[3] == json.null, json.encode(data))
+/// ```
+inline
+int openJSON(State* state) {
+	lua_createtable(state, 0, 3);
+
+	lua_pushcfunction(state, &internal::jsonDecode);
+	lua_setfield(state, -2, "decode");
+
+	// Encoding buffer which is shared by all calls to 'encode'
+	void* memory = lua_newuserdata(state, sizeof(std::string));
+	new (memory) std::string();
+
+	lua_createtable(state, 0, 1);
+	lua_pushcfunction(state, &internal::destroyJSONBuffer);
+	lua_setfield(state, -2, "__gc");
+	lua_setmetatable(state, -2);
+
+	lua_pushcclosure(state, &internal::jsonEncode, 1);
+	lua_setfield(state, -2, "encode");
+
+	lua_pushlightuserdata(state, jsonNull);
+	lua_setfield(state, -2, "null");
+
+	return 1;
+}
+
+/// Make the JSON module available to `require` by adding it to `package.preload`.
+///
+/// \param state Lua state
+/// \param name  Module name
+/// \returns `false` if the package library has not been loaded
+inline
+bool registerJSON(State* state, const char* name = "json") {
+	lua_getglobal(state, "package");
+	if (!lua_istable(state, -1)) {
+		lua_pop(state, 1);
+		return false;
+	}
+
+	lua_getfield(state, -1, "preload");
+	if (!lua_istable(state, -1)) {
+		lua_pop(state, 2);
+		return false;
+	}
+
+	lua_pushcfunction(state, &openJSON);
+	lua_setfield(state, -2, name);
+
+	lua_pop(state, 2);
+	return true;
+}
+
+LUWRA_NS_END
+
+#endif
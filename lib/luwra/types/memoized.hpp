@@ -0,0 +1,242 @@
+/* Luwra
+ * Minimal-overhead Lua wrapper for C++
+ *
+ * Copyright (C) 2016, Ole Krüger <ole@vprsm.de>
+ */
+
+#ifndef LUWRA_TYPES_MEMOIZED_H_
+#define LUWRA_TYPES_MEMOIZED_H_
+
+#include "../common.hpp"
+#include "../values.hpp"
+#include "../stack.hpp"
+#include "reference.hpp"
+#include "coroutine.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+LUWRA_NS_BEGIN
+
+namespace internal {
+	// Appends the encoding of an argument to a cache key. Each encoding starts with a tag, so that
+	// different types never produce the same key.
+	template <typename Type, typename = void>
+	struct MemoizationKey {
+		static_assert(
+			sizeof(Type) == -1,
+			"Only numbers, strings and booleans can be used as arguments of memoized functions"
+		);
+	};
+
+	template <typename Type>
+	struct MemoizationKey<Type, typename std::enable_if<std::is_integral<Type>::value>::type> {
+		static inline
+		void append(std::string& key, Type value) {
+			int64_t number = static_cast<int64_t>(value);
+
+			key.push_back('i');
+			key.append(reinterpret_cast<const char*>(&number), sizeof(number));
+		}
+	};
+
+	template <typename Type>
+	struct MemoizationKey<Type, typename std::enable_if<std::is_floating_point<Type>::value>::type> {
+		static inline
+		void append(std::string& key, Type value) {
+			double number = static_cast<double>(value);
+
+			key.push_back('n');
+			key.append(reinterpret_cast<const char*>(&number), sizeof(number));
+		}
+	};
+
+	template <>
+	struct MemoizationKey<bool> {
+		static inline
+		void append(std::string& key, bool value) {
+			key.push_back(value ? 't' : 'f');
+		}
+	};
+
+	template <>
+	struct MemoizationKey<std::string> {
+		static inline
+		void append(std::string& key, const std::string& value) {
+			appendString(key, value.data(), value.size());
+		}
+
+		static inline
+		void appendString(std::string& key, const char* data, size_t length) {
+			uint64_t size = length;
+
+			key.push_back('s');
+			key.append(reinterpret_cast<const char*>(&size), sizeof(size));
+			key.append(data, length);
+		}
+	};
+
+	template <>
+	struct MemoizationKey<const char*> {
+		static inline
+		void append(std::string& key, const char* value) {
+			MemoizationKey<std::string>::appendString(key, value, std::strlen(value));
+		}
+	};
+
+	template <>
+	struct MemoizationKey<char*>: MemoizationKey<const char*> {};
+
+	inline
+	void appendMemoizationKey(std::string&) {}
+
+	template <typename First, typename... Rest> inline
+	void appendMemoizationKey(std::string& key, const First& first, const Rest&... rest) {
+		MemoizationKey<typename std::decay<First>::type>::append(key, first);
+		appendMemoizationKey(key, rest...);
+	}
+}
+
+/// Statistics of a @ref MemoizedFunction
+struct MemoizedStats {
+	/// Calls which have been answered from the cache
+	size_t hits = 0;
+
+	/// Calls which have invoked the Lua function
+	size_t misses = 0;
+};
+
+/// Lua function whose results are cached, so that repeated calls with the same arguments do not
+/// call into Lua. Create it using @ref Function::memoized. This is only sound for functions whose
+/// result depends on nothing but their arguments.
+///
+/// Arguments must be numbers, strings or booleans. Results are kept for the least recently used
+/// arguments, up to a fixed number of entries.
+///
+/// Example:
+///
+/// ```
+///   MemoizedFunction<double> price = state.get<Function<double>>("price").memoized(1024);
+///
+///   for (const Order& order: orders)
+///       total += price(order.product, order.quantity);
+/// ```
+///
+/// \tparam Ret Type of the result
+template <typename Ret>
+struct MemoizedFunction {
+	static_assert(
+		!std::is_same<Ret, StackRange>::value,
+		"Results which remain on the stack cannot be cached"
+	);
+
+	static_assert(
+		!std::is_pointer<Ret>::value,
+		"Results which point into the Lua state cannot be cached, use std::string instead"
+	);
+
+	/// Lua function which computes the results
+	Reference ref;
+
+	/// Statistics
+	MemoizedStats stats;
+
+	/// Create using a reference to a callable.
+	///
+	/// \param ref      Callable
+	/// \param capacity Maximum number of cached results, at least 1
+	inline
+	MemoizedFunction(const Reference& ref, size_t capacity):
+		ref(ref),
+		capacity(std::max<size_t>(capacity, 1))
+	{}
+
+	/// Retrieve the result for the given arguments from the cache, or invoke the callable and
+	/// cache its result. Errors are raised like @ref Function::operator() does.
+	template <typename... Args> inline
+	Ret operator ()(Args&&... args) {
+		key.clear();
+		internal::appendMemoizationKey(key, args...);
+
+		auto it = index.find(key);
+		if (it != index.end()) {
+			stats.hits++;
+
+			// Most recently used entries are at the front
+			entries.splice(entries.begin(), entries, it->second);
+			return it->second->second;
+		}
+
+		stats.misses++;
+
+		const RefLifecycle& life = *ref.life;
+		int base = lua_gettop(life.state);
+
+		life.push();
+		internal::pushArguments(life.state, std::forward<Args>(args)...);
+
+		lua_call(life.state, sizeof...(Args), internal::CallResults<Ret>::count);
+		Ret returnValue = internal::CallResults<Ret>::take(life.state, base);
+
+		if (entries.size() >= capacity) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+
+		entries.emplace_front(key, returnValue);
+		index.emplace(key, entries.begin());
+
+		return returnValue;
+	}
+
+	/// Forget the cached result for the given arguments.
+	///
+	/// \returns `true` if a result has been cached
+	template <typename... Args> inline
+	bool invalidate(const Args&... args) {
+		key.clear();
+		internal::appendMemoizationKey(key, args...);
+
+		auto it = index.find(key);
+		if (it == index.end())
+			return false;
+
+		entries.erase(it->second);
+		index.erase(it);
+		return true;
+	}
+
+	/// Forget all cached results.
+	inline
+	void invalidate() {
+		entries.clear();
+		index.clear();
+	}
+
+	/// Number of cached results
+	inline
+	size_t size() const {
+		return entries.size();
+	}
+
+private:
+	using Entry = std::pair<std::string, Ret>;
+
+	size_t capacity;
+
+	std::list<Entry> entries;
+	std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+
+	// Reused for every lookup, so that hits do not allocate
+	std::string key;
+};
+
+LUWRA_NS_END
+
+#endif
@@ -0,0 +1,126 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace luwra;
+
+static
+std::atomic<int> sideEffects {0};
+
+static
+std::string repeatText(const char* text, int count) {
+	std::string result;
+
+	for (int i = 0; i < count; i++)
+		result += text;
+
+	return result;
+}
+
+static
+int slowSquare(int value) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	return value * value;
+}
+
+static
+void touch() {
+	sideEffects++;
+}
+
+static
+int failing(int) {
+	throw std::runtime_error("failure");
+}
+
+TEST_CASE("WorkerPool") {
+	WorkerPool pool(2);
+	REQUIRE(pool.size() == 2);
+
+	std::atomic<int> counter {0};
+
+	{
+		WorkerPool other(3);
+
+		for (int i = 0; i < 100; i++)
+			other.submit([&counter]() { counter++; });
+	}
+
+	// Queued jobs are finished before the pool stops
+	REQUIRE(counter == 100);
+}
+
+TEST_CASE("LUWRA_WRAP_ASYNC") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	Scheduler scheduler(state);
+
+	state["repeatText"] = LUWRA_WRAP_ASYNC(repeatText);
+	state["slowSquare"] = LUWRA_WRAP_ASYNC(slowSquare);
+	state["touch"] = LUWRA_WRAP_ASYNC(touch);
+	state["failing"] = LUWRA_WRAP_ASYNC(failing);
+
+	SECTION("results") {
+		REQUIRE(state.runString(
+			"results = {}\n"
+			"function worker(i)\n"
+			"  local square = slowSquare(i)\n"
+			"  local text = repeatText('ab', i)\n"
+			"  touch()\n"
+			"  results[i] = square + #text\n"
+			"end"
+		) == LUA_OK);
+
+		sideEffects = 0;
+
+		for (int i = 1; i <= 8; i++) {
+			lua_getglobal(state, "worker");
+			state.push(i);
+			scheduler.spawn(1);
+		}
+
+		while (scheduler.run() > 0)
+			scheduler.wait(std::chrono::milliseconds(100));
+
+		REQUIRE(sideEffects == 8);
+
+		REQUIRE(state.runString(
+			"local sum = 0\n"
+			"for i = 1, 8 do sum = sum + results[i] end\n"
+			"return sum"
+		) == LUA_OK);
+
+		// Sum of squares plus twice the sum of 1..8
+		REQUIRE(state.read<int>(-1) == 204 + 72);
+	}
+
+	SECTION("exceptions") {
+#if LUA_VERSION_NUM >= 502
+		REQUIRE(state.runString(
+			"function worker() local ok, message = pcall(failing, 1); status = tostring(ok) .. message end"
+		) == LUA_OK);
+#else
+		REQUIRE(state.runString(
+			"function worker() local _, message = failing(1); status = 'false' .. message end"
+		) == LUA_OK);
+#endif
+
+		lua_getglobal(state, "worker");
+		scheduler.spawn(0);
+
+		while (scheduler.run() > 0)
+			scheduler.wait(std::chrono::milliseconds(100));
+
+		REQUIRE(state.get<std::string>("status") == "falsefailure");
+	}
+
+	SECTION("outside of a coroutine") {
+		REQUIRE(state.runString("slowSquare(2)") == LUA_ERRRUN);
+	}
+}
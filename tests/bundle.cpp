@@ -0,0 +1,80 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <cstdio>
+#include <string>
+
+using namespace luwra;
+
+TEST_CASE("BundleWriter") {
+	BundleWriter writer;
+
+	REQUIRE(writer.addString("a", "return 1") == LUA_OK);
+	REQUIRE(writer.addString("b", "return +") == LUA_ERRSYNTAX);
+	REQUIRE(!writer.error.empty());
+	REQUIRE(writer.addFile("c", "/tmp/luwra-bundle-missing.lua") == LUA_ERRFILE);
+
+	REQUIRE(writer.size() == 1);
+}
+
+TEST_CASE("mountBundle") {
+	const char* path = "/tmp/luwra-bundle-test.luwra";
+
+	BundleWriter writer;
+	REQUIRE(writer.addString("app", "local config = require('app.config') return {name = config.name}") == LUA_OK);
+	REQUIRE(writer.addString("app.config", "return {name = 'bundled', args = {...}}") == LUA_OK);
+	REQUIRE(writer.addString("failing", "error('oops')") == LUA_OK);
+	REQUIRE(writer.write(path));
+
+	StateWrapper state;
+
+	SECTION("without package library") {
+		REQUIRE(!state.mountBundle(path));
+	}
+
+	state.loadStandardLibrary();
+
+	SECTION("invalid bundles") {
+		REQUIRE(!state.mountBundle("/tmp/luwra-bundle-missing.luwra"));
+	}
+
+	SECTION("require") {
+		lua_pushinteger(state, 1337);
+		REQUIRE(state.mountBundle(path));
+
+		// The stack is left untouched
+		REQUIRE(lua_gettop(state) == 1);
+		lua_settop(state, 0);
+
+		REQUIRE(state.runString("return require('app').name") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "bundled");
+
+		REQUIRE(state.runString("return require('app.config').args[1]") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "app.config");
+
+#if LUA_VERSION_NUM > 501
+		// The second argument to the loader is the path of the bundle
+		REQUIRE(state.runString("return require('app.config').args[2]") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == path);
+#endif
+
+		// Unknown modules fall through to the remaining searchers
+		REQUIRE(state.runString("return require('unknown')") == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1).find("\n\tno module 'unknown' in bundle") != std::string::npos);
+
+		// Every searcher contributes one line
+		REQUIRE(state.read<std::string>(-1).find("\n\t\n\t") == std::string::npos);
+
+		REQUIRE(state.runString("return require('failing')") == LUA_ERRRUN);
+	}
+
+	SECTION("precedence") {
+		REQUIRE(state.runString("package.preload['app.config'] = function () return {name = 'preloaded'} end") == LUA_OK);
+		REQUIRE(state.mountBundle(path));
+
+		REQUIRE(state.runString("return require('app').name") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "preloaded");
+	}
+
+	std::remove(path);
+}
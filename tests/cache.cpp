@@ -0,0 +1,163 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <stdlib.h>
+
+using namespace luwra;
+
+static
+void writeFile(const std::string& path, const char* contents) {
+	std::FILE* file = std::fopen(path.c_str(), "w");
+	REQUIRE(file != nullptr);
+	std::fputs(contents, file);
+	std::fclose(file);
+}
+
+static
+std::string makeTempDir() {
+	char path[] = "/tmp/luwra-cache-XXXXXX";
+	REQUIRE(mkdtemp(path) != nullptr);
+	return path;
+}
+
+TEST_CASE("hashBytes") {
+	REQUIRE(internal::hashBytes("", 0) == 14695981039346656037ull);
+	REQUIRE(internal::hashBytes("a", 1) == 0xaf63dc4c8601ec8cull);
+	REQUIRE(internal::hashBytes("ab", 2) != internal::hashBytes("ba", 2));
+}
+
+TEST_CASE("ChunkCache") {
+	const char* code = "counter = (counter or 0) + 1 return counter";
+
+	SECTION("in memory") {
+		StateWrapper state;
+		ChunkCache& cache = state.enableChunkCache();
+
+		REQUIRE(state.runString(code) == LUA_OK);
+		REQUIRE(state.read<int>(-1) == 1);
+
+		REQUIRE(state.runString(code) == LUA_OK);
+		REQUIRE(state.read<int>(-1) == 2);
+
+		REQUIRE(cache.stats.misses == 1);
+		REQUIRE(cache.stats.hits == 1);
+
+		// Syntax errors are reported as usual and are not cached
+		REQUIRE(state.runString("return +") == LUA_ERRSYNTAX);
+		REQUIRE(state.runString("return +") == LUA_ERRSYNTAX);
+		REQUIRE(cache.stats.misses == 3);
+	}
+
+	SECTION("on disk") {
+		std::string dir = makeTempDir();
+
+		{
+			StateWrapper state;
+			state.enableChunkCache(dir);
+
+			REQUIRE(state.runString(code) == LUA_OK);
+			REQUIRE(state.cache->stats.misses == 1);
+		}
+
+		{
+			StateWrapper state;
+			state.enableChunkCache(dir);
+
+			REQUIRE(state.runString(code) == LUA_OK);
+			REQUIRE(state.read<int>(-1) == 1);
+			REQUIRE(state.cache->stats.diskHits == 1);
+			REQUIRE(state.cache->stats.misses == 0);
+		}
+
+		std::string path = dir + "/init.lua";
+		writeFile(path, "return 13");
+
+		{
+			StateWrapper state;
+			state.enableChunkCache(dir);
+
+			REQUIRE(state.runFile(path.c_str()) == LUA_OK);
+			REQUIRE(state.read<int>(-1) == 13);
+
+			REQUIRE(state.runFile(path.c_str()) == LUA_OK);
+			REQUIRE(state.read<int>(-1) == 13);
+
+			REQUIRE(state.cache->stats.misses == 1);
+			REQUIRE(state.cache->stats.hits == 1);
+
+			// Modifications invalidate the cached chunk
+			writeFile(path, "return 1337");
+
+			REQUIRE(state.runFile(path.c_str()) == LUA_OK);
+			REQUIRE(state.read<int>(-1) == 1337);
+			REQUIRE(state.cache->stats.misses == 2);
+		}
+
+		{
+			StateWrapper state;
+			state.enableChunkCache(dir);
+
+			REQUIRE(state.runFile(path.c_str()) == LUA_OK);
+			REQUIRE(state.read<int>(-1) == 1337);
+			REQUIRE(state.cache->stats.diskHits == 1);
+		}
+
+		std::system(("rm -rf " + dir).c_str());
+	}
+
+	SECTION("hash collisions on disk") {
+		std::string dir = makeTempDir();
+		const char* other = "counter = (counter or 0) - 1 return counter";
+
+		{
+			StateWrapper state;
+			state.enableChunkCache(dir);
+			REQUIRE(state.runString(code) == LUA_OK);
+		}
+
+		// Pretend that the other code has the same hash by relabelling the cached file
+		char path[64];
+		char otherPath[64];
+		uint64_t otherHash = internal::hashBytes(other, std::strlen(other));
+
+		std::snprintf(
+			path, sizeof(path), "/s%016llx.luac",
+			static_cast<unsigned long long>(internal::hashBytes(code, std::strlen(code)))
+		);
+		std::snprintf(
+			otherPath, sizeof(otherPath), "/s%016llx.luac",
+			static_cast<unsigned long long>(otherHash)
+		);
+
+		std::FILE* file = std::fopen((dir + path).c_str(), "r+b");
+		REQUIRE(file != nullptr);
+
+		internal::ChunkFileHeader header;
+		REQUIRE(std::fread(&header, sizeof(header), 1, file) == 1);
+		header.hash = otherHash;
+		std::rewind(file);
+		REQUIRE(std::fwrite(&header, sizeof(header), 1, file) == 1);
+		std::fclose(file);
+
+		REQUIRE(std::rename((dir + path).c_str(), (dir + otherPath).c_str()) == 0);
+
+		{
+			StateWrapper state;
+			state.enableChunkCache(dir);
+
+			REQUIRE(state.runString(other) == LUA_OK);
+			REQUIRE(state.read<int>(-1) == -1);
+			REQUIRE(state.cache->stats.diskHits == 0);
+		}
+
+		// No temporary files are left behind
+		REQUIRE(std::system(("test -z \"$(ls " + dir + " | grep -v '\\.luac$')\"").c_str()) == 0);
+
+		std::system(("rm -rf " + dir).c_str());
+	}
+}
@@ -0,0 +1,194 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#ifdef LUWRA_HAS_MMAP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace luwra;
+
+TEST_CASE("channel") {
+	StateWrapper from;
+	from.loadStandardLibrary();
+
+	StateWrapper to;
+	to.loadStandardLibrary();
+
+	Channel channel(4096);
+	REQUIRE(channel.isValid());
+	REQUIRE(channel.capacity() == 4096);
+
+	SECTION("values") {
+		REQUIRE(!channel.poll());
+
+		REQUIRE(from.runString("return {1, 2, x = 'y'}, 'Hello', 13.37") == LUA_OK);
+		REQUIRE(channel.send(from, -3) == LUA_OK);
+		REQUIRE(channel.send(from, -2) == LUA_OK);
+		REQUIRE(channel.send(from, -1) == LUA_OK);
+
+		REQUIRE(channel.poll());
+
+		REQUIRE(channel.receive(to) == LUA_OK);
+		lua_setglobal(to, "t");
+		REQUIRE(to.runString("return t[1] + t[2], t.x") == LUA_OK);
+		REQUIRE(to.read<int>(-2) == 3);
+		REQUIRE(to.read<std::string>(-1) == "y");
+
+		REQUIRE(channel.receive(to) == LUA_OK);
+		REQUIRE(to.read<std::string>(-1) == "Hello");
+
+		REQUIRE(channel.receive(to) == LUA_OK);
+		REQUIRE(to.read<double>(-1) == 13.37);
+
+		REQUIRE(!channel.poll());
+		REQUIRE(!channel.wait(10));
+	}
+
+	SECTION("wrapping around") {
+		for (int i = 0; i < 100; i++) {
+			from.push(std::string(1000 + i % 7, 'x'));
+			REQUIRE(channel.send(from, -1) == LUA_OK);
+			lua_pop(from, 1);
+
+			REQUIRE(channel.receive(to) == LUA_OK);
+			REQUIRE(to.read<std::string>(-1).size() == size_t(1000 + i % 7));
+			lua_pop(to, 1);
+		}
+	}
+
+	SECTION("attaching") {
+		Channel other = Channel::attach(channel.fileDescriptor());
+		REQUIRE(other.isValid());
+		REQUIRE(other.capacity() == channel.capacity());
+
+		REQUIRE(from.runString("return 'attached'") == LUA_OK);
+		REQUIRE(channel.send(from, -1) == LUA_OK);
+
+		REQUIRE(other.receive(to) == LUA_OK);
+		REQUIRE(to.read<std::string>(-1) == "attached");
+	}
+
+	SECTION("oversized values") {
+		REQUIRE(from.runString("return string.rep('x', 5000)") == LUA_OK);
+		REQUIRE(channel.send(from, -1) == LUA_ERRRUN);
+		REQUIRE(!channel.poll());
+	}
+
+	SECTION("malformed messages") {
+		REQUIRE(from.runString("return 'intact'") == LUA_OK);
+		REQUIRE(channel.send(from, -1) == LUA_OK);
+
+		// Overwrite the length prefix, which is at the start of the ring buffer
+		size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		void* mapping = mmap(
+			nullptr,
+			page + channel.capacity(),
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED,
+			channel.fileDescriptor(),
+			0
+		);
+		REQUIRE(mapping != MAP_FAILED);
+
+		uint32_t length = 1000;
+		std::memcpy(static_cast<char*>(mapping) + page, &length, sizeof(length));
+		munmap(mapping, page + channel.capacity());
+
+		REQUIRE(channel.receive(to) == LUA_ERRRUN);
+		REQUIRE(to.read<std::string>(-1) == "received a malformed message");
+		REQUIRE(!channel.poll());
+
+		REQUIRE(channel.send(from, -1) == LUA_OK);
+		REQUIRE(channel.receive(to) == LUA_OK);
+		REQUIRE(to.read<std::string>(-1) == "intact");
+	}
+
+	SECTION("processes") {
+		pid_t pid = fork();
+		REQUIRE(pid >= 0);
+
+		if (pid == 0) {
+			// The ring buffer is much smaller than the sum of all messages
+			StateWrapper child;
+			child.loadStandardLibrary();
+
+			for (int i = 1; i <= 1000; i++) {
+				lua_createtable(child, 0, 2);
+				setFields(child, -1, "index", i, "padding", std::string(100, 'x'));
+
+				if (channel.send(child, -1) != LUA_OK)
+					_exit(1);
+
+				lua_pop(child, 1);
+			}
+
+			_exit(0);
+		}
+
+		int sum = 0;
+		for (int i = 1; i <= 1000; i++) {
+			REQUIRE(channel.receive(to) == LUA_OK);
+
+			lua_getfield(to, -1, "index");
+			sum += to.read<int>(-1);
+			lua_pop(to, 2);
+		}
+
+		REQUIRE(sum == 500500);
+
+		int status;
+		REQUIRE(waitpid(pid, &status, 0) == pid);
+		REQUIRE(WIFEXITED(status));
+		REQUIRE(WEXITSTATUS(status) == 0);
+	}
+}
+
+TEST_CASE("named channel") {
+	const char* name = "/luwra-channel-test";
+	Channel::remove(name);
+
+	Channel first(name, 8192);
+	Channel second(name, 0);
+
+	REQUIRE(first.isValid());
+	REQUIRE(second.isValid());
+	REQUIRE(second.capacity() == 8192);
+
+	StateWrapper state;
+	REQUIRE(state.runString("return 42") == LUA_OK);
+	REQUIRE(first.send(state, -1) == LUA_OK);
+	REQUIRE(second.receive(state) == LUA_OK);
+	REQUIRE(state.read<int>(-1) == 42);
+
+	Channel::remove(name);
+
+	SECTION("opened while it is being created") {
+		for (int i = 0; i < 50; i++) {
+			Channel::remove(name);
+
+			bool valid = false;
+			std::thread other([&]() {
+				Channel channel(name, 8192);
+				valid = channel.isValid() && channel.capacity() == 8192;
+			});
+
+			Channel channel(name, 8192);
+			other.join();
+
+			REQUIRE(valid);
+			REQUIRE(channel.isValid());
+			REQUIRE(channel.capacity() == 8192);
+		}
+
+		Channel::remove(name);
+	}
+}
+
+#endif
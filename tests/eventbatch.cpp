@@ -0,0 +1,113 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <string>
+
+using namespace luwra;
+
+TEST_CASE("EventBatch") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	REQUIRE(state.runString(
+		"calls = 0\n"
+		"trace = {}\n"
+		"function onTable(count, names, values)\n"
+		"  calls = calls + 1\n"
+		"  for i = 1, count do trace[#trace + 1] = names[i] .. '=' .. values[i] end\n"
+		"end\n"
+		"function onIterator(events, count)\n"
+		"  calls = calls + 1\n"
+		"  for i, name, value in events do trace[#trace + 1] = i .. ':' .. name .. '=' .. value end\n"
+		"  assert(#trace == count)\n"
+		"end"
+	) == LUA_OK);
+
+	SECTION("tables") {
+		EventBatch<std::string, int> batch(state.get<Function<void>>("onTable"));
+
+		batch.add("a", 1);
+		batch.add("b", 2);
+		batch.add(std::string("c"), 3);
+
+		REQUIRE(batch.size() == 3);
+		REQUIRE(batch.flush() == LUA_OK);
+		REQUIRE(batch.size() == 0);
+
+		// Empty batches are not delivered
+		REQUIRE(batch.flush() == LUA_OK);
+
+		REQUIRE(state.get<int>("calls") == 1);
+		REQUIRE(state.runString("return table.concat(trace, ' ')") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "a=1 b=2 c=3");
+	}
+
+	SECTION("iterator") {
+		EventBatch<const char*, double> batch(state.get<Function<void>>("onIterator"), DeliverIterator);
+
+		batch.add("x", 0.5);
+		batch.add("y", 1.5);
+
+		int top = lua_gettop(state);
+		REQUIRE(batch.flush() == LUA_OK);
+		REQUIRE(lua_gettop(state) == top);
+
+		REQUIRE(state.runString("return table.concat(trace, ' ')") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "1:x=0.5 2:y=1.5");
+	}
+
+	SECTION("escaped iterator") {
+		REQUIRE(state.runString("function keep(events) kept = events end") == LUA_OK);
+
+		EventBatch<int> batch(state.get<Function<void>>("keep"), DeliverIterator);
+		batch.add(1);
+		REQUIRE(batch.flush() == LUA_OK);
+
+		REQUIRE(state.runString("return kept()") == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1).find("after the handler has returned") != std::string::npos);
+	}
+
+	SECTION("limit") {
+		REQUIRE(state.runString(
+			"total = 0\n"
+			"function onCount(count) calls = calls + 1; total = total + count end"
+		) == LUA_OK);
+
+		EventBatch<int> batch(state.get<Function<void>>("onCount"), DeliverTable, 100);
+
+		int failures = 0;
+		for (int i = 0; i < 1050; i++)
+			failures += batch.add(i) != LUA_OK;
+
+		REQUIRE(failures == 0);
+
+		REQUIRE(state.get<int>("calls") == 10);
+		REQUIRE(batch.size() == 50);
+
+		REQUIRE(batch.flush() == LUA_OK);
+		REQUIRE(state.get<int>("calls") == 11);
+		REQUIRE(state.get<int>("total") == 1050);
+	}
+
+	SECTION("errors") {
+		REQUIRE(state.runString("function fail(events) error('failed', 0) end") == LUA_OK);
+
+		EventBatch<int> tables(state.get<Function<void>>("fail"));
+		EventBatch<int> iterator(state.get<Function<void>>("fail"), DeliverIterator);
+
+		tables.add(1);
+		iterator.add(1);
+
+		int top = lua_gettop(state);
+
+		REQUIRE(tables.flush() == LUA_ERRRUN);
+		REQUIRE(lua_gettop(state) == top + 1);
+		REQUIRE(state.read<std::string>(-1) == "failed");
+		REQUIRE(tables.size() == 0);
+
+		REQUIRE(iterator.flush() == LUA_ERRRUN);
+		REQUIRE(lua_gettop(state) == top + 2);
+		REQUIRE(state.read<std::string>(-1) == "failed");
+		REQUIRE(iterator.size() == 0);
+	}
+}
@@ -0,0 +1,130 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#ifdef LUWRA_HAS_EPOLL
+
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace luwra;
+
+TEST_CASE("EventLoop") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	EventLoop loop(state);
+	REQUIRE(loop.isValid());
+
+	loop.pushModule();
+	lua_setglobal(state, "events");
+
+	SECTION("pipes") {
+		int fds[2];
+		REQUIRE(pipe(fds) == 0);
+
+		state["readEnd"] = fds[0];
+		REQUIRE(state.runString(
+			"calls = 0\n"
+			"events.watch(readEnd, 'r', function (fd, readable, writable)\n"
+			"  assert(fd == readEnd and readable and not writable)\n"
+			"  calls = calls + 1\n"
+			"end)"
+		) == LUA_OK);
+
+		REQUIRE(loop.size() == 1);
+
+		// Nothing to read yet
+		REQUIRE(loop.runOnce(0) == LUA_OK);
+		REQUIRE(state.get<int>("calls") == 0);
+
+		REQUIRE(write(fds[1], "x", 1) == 1);
+		REQUIRE(loop.runOnce(1000) == LUA_OK);
+		REQUIRE(state.get<int>("calls") == 1);
+
+		char buffer;
+		REQUIRE(read(fds[0], &buffer, 1) == 1);
+
+		REQUIRE(state.runString("assert(events.unwatch(readEnd))") == LUA_OK);
+		REQUIRE(loop.size() == 0);
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	SECTION("sockets") {
+		int fds[2];
+		REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+		state["first"] = fds[0];
+		state["second"] = fds[1];
+		REQUIRE(state.runString(
+			"ready = {}\n"
+			"local function record(fd, readable, writable)\n"
+			"  ready[#ready + 1] = (fd == first and 'first' or 'second') ..\n"
+			"    (readable and 'r' or '') .. (writable and 'w' or '')\n"
+			"  events.unwatch(fd)\n"
+			"end\n"
+			"events.watch(first, 'w', record)\n"
+			"events.watch(second, 'r', record)"
+		) == LUA_OK);
+
+		REQUIRE(write(fds[0], "ping", 4) == 4);
+
+		// Both events are part of the same batch
+		REQUIRE(loop.runOnce(1000) == LUA_OK);
+		REQUIRE(loop.size() == 0);
+
+		REQUIRE(state.runString("table.sort(ready); return table.concat(ready, ' ')") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "firstw secondr");
+
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	SECTION("timers") {
+		REQUIRE(state.runString(
+			"ticks = 0\n"
+			"local timer\n"
+			"timer = events.every(2, function ()\n"
+			"  ticks = ticks + 1\n"
+			"  if ticks == 3 then events.cancel(timer) end\n"
+			"end)\n"
+			"events.after(1, function () fired = true end)\n"
+			"local cancelled = events.after(1, function () error('cancelled timer fired') end)\n"
+			"assert(events.cancel(cancelled))"
+		) == LUA_OK);
+
+		REQUIRE(loop.size() == 2);
+		REQUIRE(loop.run() == LUA_OK);
+		REQUIRE(loop.size() == 0);
+
+		REQUIRE(state.get<int>("ticks") == 3);
+		REQUIRE(state.get<bool>("fired"));
+	}
+
+	SECTION("errors") {
+		REQUIRE(state.runString("events.after(1, function () error('failure', 0) end)") == LUA_OK);
+		REQUIRE(loop.run() == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1) == "failure");
+	}
+
+	SECTION("waking up") {
+		REQUIRE(state.runString("events.every(60000, function () end)") == LUA_OK);
+
+		std::thread stopper([&loop]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			loop.stop();
+		});
+
+		// Returns long before the timer expires
+		REQUIRE(loop.run() == LUA_OK);
+		stopper.join();
+
+		REQUIRE(loop.size() == 1);
+	}
+}
+
+#endif
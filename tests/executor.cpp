@@ -0,0 +1,156 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace luwra;
+
+// Statistics are updated after the futures have become ready, hence wait for them to settle.
+// Counters which may legitimately exceed the expected value only have to reach it.
+static
+bool waitForStats(
+	const ExecutorPool& pool,
+	size_t WorkerStats::* field,
+	size_t expected,
+	bool atLeast = false
+) {
+	for (int attempt = 0; attempt < 1000; attempt++) {
+		size_t total = 0;
+		for (size_t i = 0; i < pool.size(); i++)
+			total += pool.stats(i).*field;
+
+		if (atLeast ? total >= expected : total == expected)
+			return true;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	return false;
+}
+
+TEST_CASE("ExecutorPool") {
+	std::atomic<int> initialisations {0};
+
+	ExecutorPool pool(4, [&initialisations](StateWrapper& state) {
+		initialisations++;
+
+		state.loadStandardLibrary();
+		state.runString("function square(x) return x * x end");
+	});
+
+	REQUIRE(pool.size() == 4);
+
+	SECTION("jobs") {
+		std::vector<std::future<int>> results;
+
+		for (int i = 0; i < 1000; i++) {
+			results.push_back(pool.submit([i](StateWrapper& state) {
+				lua_getglobal(state, "square");
+				return state.read<Function<int>>(-1)(i);
+			}));
+		}
+
+		long long sum = 0;
+		for (std::future<int>& result: results)
+			sum += result.get();
+
+		REQUIRE(sum == 332833500);
+		REQUIRE(initialisations == 4);
+
+		REQUIRE(waitForStats(pool, &WorkerStats::executed, 1000));
+	}
+
+	SECTION("exceptions") {
+		std::future<void> result = pool.submit([](StateWrapper&) {
+			throw std::runtime_error("failure");
+		});
+
+		REQUIRE_THROWS_AS(result.get(), std::runtime_error);
+	}
+
+	SECTION("work stealing") {
+		// Jobs submitted from within a job go to the same worker, which is busy waiting for them.
+		std::future<int> outer = pool.submit([&pool](StateWrapper&) {
+			std::vector<std::future<int>> inner;
+
+			for (int i = 1; i <= 10; i++)
+				inner.push_back(pool.submit([i](StateWrapper&) { return i; }));
+
+			int sum = 0;
+			for (std::future<int>& result: inner)
+				sum += result.get();
+
+			return sum;
+		});
+
+		REQUIRE(outer.get() == 55);
+
+		// Another worker may also have stolen the outer job
+		REQUIRE(waitForStats(pool, &WorkerStats::stolen, 10, true));
+	}
+}
+
+TEST_CASE("StateExecutor") {
+	StateExecutor executor([](StateWrapper& state) {
+		state.loadStandardLibrary();
+		state.runString("counter = 0");
+	});
+
+	SECTION("concurrent submissions") {
+		std::vector<std::thread> threads;
+
+		for (int t = 0; t < 4; t++) {
+			threads.emplace_back([&executor]() {
+				std::vector<std::future<int>> results;
+
+				for (int i = 0; i < 250; i++) {
+					results.push_back(executor.submit([](StateWrapper& state) {
+						return state.runString("counter = counter + 1");
+					}));
+				}
+
+				for (std::future<int>& result: results)
+					result.get();
+			});
+		}
+
+		for (std::thread& thread: threads)
+			thread.join();
+
+		std::future<int> counter = executor.submit([](StateWrapper& state) {
+			lua_getglobal(state, "counter");
+			return state.read<int>(-1);
+		});
+
+		REQUIRE(counter.get() == 1000);
+		REQUIRE(executor.queued() == 0);
+	}
+
+	SECTION("exceptions") {
+		std::future<void> result = executor.submit([](StateWrapper&) {
+			throw std::runtime_error("failure");
+		});
+
+		REQUIRE_THROWS_AS(result.get(), std::runtime_error);
+	}
+
+	SECTION("nested submissions") {
+		std::future<std::future<int>> outer = executor.submit([&executor](StateWrapper&) {
+			return executor.submit([](StateWrapper& state) {
+				return state.runString("counter = 42");
+			});
+		});
+
+		REQUIRE(outer.get().get() == LUA_OK);
+
+		std::future<int> counter = executor.submit([](StateWrapper& state) {
+			lua_getglobal(state, "counter");
+			return state.read<int>(-1);
+		});
+
+		REQUIRE(counter.get() == 42);
+	}
+}
@@ -1,6 +1,10 @@
 #include <catch.hpp>
 #include <luwra.hpp>
 
+#include <string>
+#include <tuple>
+#include <utility>
+
 TEST_CASE("Function<R>") {
 	luwra::StateWrapper state;
 
@@ -60,3 +64,75 @@ TEST_CASE("function<void(A...)>") {
 	int returnValue = state.get<int>("returnValue");
 	REQUIRE(returnValue == 50);
 }
+
+TEST_CASE("Function::pcall") {
+	luwra::StateWrapper state;
+
+	REQUIRE(state.runString("return function (x) if x then return x * 2 end error('no x') end") == LUA_OK);
+
+	SECTION("Function<R>") {
+		auto fun = state.read<luwra::Function<int>>(-1);
+
+		int result = 0;
+		REQUIRE(fun.pcall(result, 21) == LUA_OK);
+		REQUIRE(result == 42);
+
+		REQUIRE(fun.pcall(result) == LUA_ERRRUN);
+		REQUIRE(result == 42);
+		REQUIRE(lua_isstring(state, -1));
+	}
+
+	SECTION("Function<void>") {
+		auto fun = state.read<luwra::Function<void>>(-1);
+
+		REQUIRE(fun.pcall(21) == LUA_OK);
+		REQUIRE(fun.pcall() == LUA_ERRRUN);
+		REQUIRE(lua_isstring(state, -1));
+	}
+}
+
+TEST_CASE("Function with multiple results") {
+	luwra::StateWrapper state;
+
+	REQUIRE(state.runString("function divide(x, y) return (x - x % y) / y, x % y, 'done' end") == LUA_OK);
+
+	int top = lua_gettop(state);
+
+	SECTION("std::tuple") {
+		auto divide = state.get<luwra::Function<std::tuple<int, int, std::string>>>("divide");
+
+		std::tuple<int, int, std::string> result = divide(17, 5);
+		REQUIRE(std::get<0>(result) == 3);
+		REQUIRE(std::get<1>(result) == 2);
+		REQUIRE(std::get<2>(result) == "done");
+		REQUIRE(lua_gettop(state) == top);
+
+		REQUIRE(divide.pcall(result, 9, 2) == LUA_OK);
+		REQUIRE(std::get<0>(result) == 4);
+		REQUIRE(lua_gettop(state) == top);
+	}
+
+	SECTION("std::pair") {
+		auto divide = state.get<luwra::Function<std::pair<int, int>>>("divide");
+
+		std::pair<int, int> result = divide(17, 5);
+		REQUIRE(result.first == 3);
+		REQUIRE(result.second == 2);
+		REQUIRE(lua_gettop(state) == top);
+	}
+
+	SECTION("StackRange") {
+		auto divide = state.get<luwra::Function<luwra::StackRange>>("divide");
+
+		luwra::StackRange results = divide(17, 5);
+		REQUIRE(results.size() == 3);
+		REQUIRE(results.first == top + 1);
+		REQUIRE(results.read<int>(1) == 3);
+		REQUIRE(results.read<int>(2) == 2);
+		REQUIRE(results.read<std::string>(3) == "done");
+		REQUIRE(lua_gettop(state) == top + 3);
+
+		results.pop();
+		REQUIRE(lua_gettop(state) == top);
+	}
+}
@@ -0,0 +1,79 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <chrono>
+#include <cstdlib>
+
+using namespace luwra;
+
+TEST_CASE("GCStats") {
+	GCStats stats;
+
+	stats.record(std::chrono::nanoseconds(500));
+	stats.record(std::chrono::microseconds(3));
+	stats.record(std::chrono::seconds(10));
+
+	REQUIRE(stats.pauses == 3);
+	REQUIRE(stats.maxPause == std::chrono::seconds(10));
+	REQUIRE(stats.histogram[0] == 1);
+	REQUIRE(stats.histogram[2] == 1);
+	REQUIRE(stats.histogram[GCStats::HistogramSize - 1] == 1);
+}
+
+TEST_CASE("GarbageCollector") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	GarbageCollector& gc = state.gc();
+
+	SECTION("is shared between copies") {
+		StateWrapper copy = state;
+		REQUIRE(&copy.gc() == &gc);
+	}
+
+	SECTION("collect") {
+		REQUIRE(state.runString("garbage = {} for i = 1, 10000 do garbage[i] = {} end garbage = nil") == LUA_OK);
+
+		size_t before = gc.count();
+		gc.collect();
+
+		REQUIRE(gc.count() < before);
+		REQUIRE(gc.stats.cycles == 1);
+		REQUIRE(gc.stats.pauses == 1);
+	}
+
+	SECTION("step") {
+		gc.stop();
+		REQUIRE(state.runString("for i = 1, 10000 do local garbage = {} end") == LUA_OK);
+
+		size_t steps = 0;
+		while (!gc.step(std::chrono::microseconds(50)))
+			steps++;
+
+		REQUIRE(gc.stats.cycles == 1);
+		REQUIRE(gc.stats.pauses == steps + 1);
+		REQUIRE(gc.stats.totalPause >= gc.stats.maxPause);
+
+		gc.restart();
+	}
+
+	SECTION("parameters") {
+		// Lua 5.4 stores these values in a compressed form, hence the tolerance
+		gc.setPause(150);
+		REQUIRE(std::abs(gc.setPause(200) - 150) <= 4);
+
+		gc.setStepMultiplier(300);
+		REQUIRE(std::abs(gc.setStepMultiplier(200) - 300) <= 4);
+	}
+
+	SECTION("setMode") {
+		REQUIRE(gc.setMode(GCMode::Incremental));
+
+#if LUA_VERSION_NUM >= 504
+		REQUIRE(gc.setMode(GCMode::Generational));
+		REQUIRE(state.runString("for i = 1, 10000 do local garbage = {} end") == LUA_OK);
+		gc.step(std::chrono::microseconds(50));
+		REQUIRE(gc.setMode(GCMode::Incremental));
+#endif
+	}
+}
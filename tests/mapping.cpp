@@ -0,0 +1,108 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <cstdio>
+#include <string>
+
+using namespace luwra;
+
+static
+void writeFile(const char* path, const std::string& contents) {
+	std::FILE* file = std::fopen(path, "wb");
+	REQUIRE(file != nullptr);
+	std::fwrite(contents.data(), 1, contents.size(), file);
+	std::fclose(file);
+}
+
+TEST_CASE("MappedFile") {
+	const char* path = "/tmp/luwra-mapping-test.lua";
+	writeFile(path, "return 1");
+
+	MappedFile file(path);
+	REQUIRE(file.isValid());
+	REQUIRE(file.size() == 8);
+	REQUIRE(std::string(file.data(), file.size()) == "return 1");
+
+	MappedFile moved(std::move(file));
+	REQUIRE(moved.isValid());
+	REQUIRE(!file.isValid());
+
+	std::remove(path);
+
+	REQUIRE(!MappedFile("/tmp/luwra-mapping-missing.lua").isValid());
+}
+
+TEST_CASE("loadMappedFile") {
+	StateWrapper state;
+	const char* path = "/tmp/luwra-mapping-test.lua";
+
+	SECTION("plain") {
+		writeFile(path, "return 13, 37");
+		REQUIRE(loadMappedFile(state, path) == LUA_OK);
+		lua_call(state, 0, 2);
+		REQUIRE(state.read<int>(-2) == 13);
+		REQUIRE(state.read<int>(-1) == 37);
+	}
+
+	SECTION("byte order mark and shebang") {
+		writeFile(path, "\xEF\xBB\xBF#!/usr/bin/lua\nreturn 1337");
+		REQUIRE(state.runFile(path) == LUA_OK);
+		REQUIRE(state.read<int>(-1) == 1337);
+	}
+
+	SECTION("line numbers") {
+		state.loadStandardLibrary();
+
+		writeFile(path, "#!/usr/bin/lua\n\nerror('x')");
+		REQUIRE(state.runFile(path) == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1) == std::string(path) + ":3: x");
+	}
+
+	SECTION("syntax errors") {
+		writeFile(path, "return +");
+		REQUIRE(loadMappedFile(state, path) == LUA_ERRSYNTAX);
+	}
+
+	SECTION("missing files") {
+		REQUIRE(loadMappedFile(state, "/tmp/luwra-mapping-missing.lua") == LUA_ERRFILE);
+	}
+
+	std::remove(path);
+}
+
+TEST_CASE("MappedArchive") {
+	const char* path = "/tmp/luwra-mapping-test.luwra";
+
+	ArchiveWriter writer;
+	writer.add("b", "return 'b'");
+	writer.add("a", "return 'a'");
+	writer.add("a.b", "return 'a.b'");
+	writer.add("broken", "return +");
+	writer.add("empty", "");
+	REQUIRE(writer.size() == 5);
+	REQUIRE(writer.write(path));
+
+	MappedArchive archive(path);
+	REQUIRE(archive.isValid());
+	REQUIRE(archive.size() == 5);
+
+	StateWrapper state;
+
+	for (const char* name: {"a", "b", "a.b"}) {
+		REQUIRE(archive.load(state, name) == LUA_OK);
+		lua_call(state, 0, 1);
+		REQUIRE(state.read<std::string>(-1) == name);
+		lua_pop(state, 1);
+	}
+
+	REQUIRE(archive.load(state, "empty") == LUA_OK);
+	REQUIRE(archive.load(state, "broken") == LUA_ERRSYNTAX);
+	REQUIRE(archive.load(state, "c") == LUA_ERRFILE);
+	REQUIRE(archive.load(state, "") == LUA_ERRFILE);
+
+	// Anything but an archive is rejected
+	writeFile(path, "return 1");
+	REQUIRE(!MappedArchive(path).isValid());
+
+	std::remove(path);
+}
@@ -0,0 +1,193 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <memory>
+
+using namespace luwra;
+
+static
+void exerciseState(StateWrapper& state) {
+	state.loadStandardLibrary();
+
+	REQUIRE(state.runString(
+		"local t = {}\n"
+		"for i = 1, 1000 do t[i] = {i, tostring(i) .. 'abcdefghijklmnopqrstuvwxyz'} end\n"
+		"t = nil\n"
+		"collectgarbage()\n"
+		"return 1337"
+	) == LUA_OK);
+
+	REQUIRE(state.read<int>(-1) == 1337);
+}
+
+TEST_CASE("sizeClassOf") {
+	REQUIRE(internal::sizeClassOf(1) == 0);
+	REQUIRE(internal::sizeClassOf(16) == 0);
+	REQUIRE(internal::sizeClassOf(17) == 1);
+	REQUIRE(internal::sizeClassOf(32) == 1);
+	REQUIRE(internal::sizeClassOf(33) == 2);
+	REQUIRE(internal::sizeClassOf(size_t(1) << 40) == MemoryStats::HistogramSize - 1);
+}
+
+TEST_CASE("MallocAllocator") {
+	auto allocator = std::make_shared<MallocAllocator>();
+
+	{
+		StateWrapper state(allocator);
+		exerciseState(state);
+
+		MemoryStats stats = state.memoryStats();
+		REQUIRE(stats.live > 0);
+		REQUIRE(stats.peak >= stats.live);
+		REQUIRE(stats.allocations > 1000);
+
+		size_t histogramSum = 0;
+		for (size_t count: stats.histogram)
+			histogramSum += count;
+
+		REQUIRE(histogramSum == stats.allocations);
+	}
+
+	// Closing the state releases everything
+	REQUIRE(allocator->stats.live == 0);
+}
+
+TEST_CASE("PoolAllocator") {
+	auto allocator = std::make_shared<PoolAllocator>(4096);
+
+	{
+		StateWrapper state(allocator);
+		exerciseState(state);
+
+		REQUIRE(state.memoryStats().live > 0);
+		REQUIRE(state.memoryStats().peak > state.memoryStats().live);
+	}
+
+	REQUIRE(allocator->stats.live == 0);
+
+	SECTION("reuses blocks") {
+		PoolAllocator pool;
+
+		void* a = pool.allocate(20);
+		pool.deallocate(a, 20);
+
+		void* b = pool.allocate(30);
+		REQUIRE(a == b);
+
+		// Same size class, resizing keeps the block
+		REQUIRE(pool.reallocate(b, 30, 25) == b);
+
+		void* c = pool.reallocate(b, 30, 1000);
+		REQUIRE(c != nullptr);
+		pool.deallocate(c, 1000);
+	}
+}
+
+TEST_CASE("ArenaAllocator") {
+	auto allocator = std::make_shared<ArenaAllocator>(16 * 1024);
+
+	{
+		StateWrapper state(allocator);
+		exerciseState(state);
+
+		REQUIRE(state.memoryStats().live > 0);
+	}
+
+	REQUIRE(allocator->stats.live == 0);
+
+	SECTION("resizes the most recent block in place") {
+		ArenaAllocator arena;
+
+		arena.allocate(8);
+		void* block = arena.allocate(10);
+
+		REQUIRE(arena.reallocate(block, 10, 100) == block);
+		REQUIRE(arena.reallocate(block, 100, 40) == block);
+
+		arena.deallocate(block, 40);
+		REQUIRE(arena.allocate(64) == block);
+	}
+}
+
+TEST_CASE("StateWrapper::memoryStats without allocator") {
+	StateWrapper state;
+	REQUIRE(state.memoryStats().live > 0);
+	REQUIRE(state.memoryStats().allocations == 0);
+}
+
+TEST_CASE("memory limits") {
+	StateWrapper state(std::make_shared<MallocAllocator>());
+	state.loadStandardLibrary();
+
+	size_t baseline = state.memoryStats().live;
+
+	SECTION("hard limit") {
+		REQUIRE(state.setMemoryLimit(baseline + 64 * 1024));
+
+		REQUIRE(state.runString(
+			"local t = {}\n"
+			"for i = 1, 100000 do t[i] = tostring(i) end"
+		) == LUA_ERRMEM);
+
+		REQUIRE(state.memoryStats().failures > 0);
+		lua_pop(state, 1);
+
+		// The state remains usable once the limit is lifted
+		REQUIRE(state.setMemoryLimit(0));
+		REQUIRE(state.runString("local t = {} for i = 1, 100000 do t[i] = i end return #t") == LUA_OK);
+		REQUIRE(state.read<int>(-1) == 100000);
+	}
+
+	SECTION("hard limit in function calls") {
+		REQUIRE(state.runString(
+			"return function (n) local t = {} for i = 1, n do t[i] = tostring(i) end return #t end"
+		) == LUA_OK);
+
+		auto fun = state.read<Function<int>>(-1);
+		lua_pop(state, 1);
+
+		REQUIRE(state.setMemoryLimit(state.memoryStats().live + 64 * 1024));
+
+		int result = 0;
+		REQUIRE(fun.pcall(result, 10) == LUA_OK);
+		REQUIRE(result == 10);
+
+		REQUIRE(fun.pcall(result, 100000) == LUA_ERRMEM);
+	}
+
+	SECTION("soft limit") {
+		REQUIRE(state.setMemoryLimit(baseline + 1024 * 1024, baseline + 64 * 1024));
+
+		// Lua cannot collect garbage on its own while the collector is stopped
+		REQUIRE(state.runString(
+			"collectgarbage('stop')\n"
+			"for i = 1, 2000 do local garbage = {tostring(i)} end"
+		) == LUA_OK);
+
+		MemoryStats stats = state.memoryStats();
+		REQUIRE(stats.emergencyCollections == 1);
+		REQUIRE(stats.failures == 0);
+		REQUIRE(stats.live > baseline + 64 * 1024);
+
+		// The collection happens at the next safe point
+		REQUIRE(collectRequestedGarbage(state));
+		REQUIRE(!collectRequestedGarbage(state));
+		REQUIRE(state.memoryStats().live < baseline + 64 * 1024);
+
+		// Lua 5.1 restarts the collector after a full collection
+		REQUIRE(state.runString(
+			"collectgarbage('stop')\n"
+			"for i = 1, 2000 do local garbage = {tostring(i)} end"
+		) == LUA_OK);
+		REQUIRE(state.memoryStats().emergencyCollections == 2);
+
+		REQUIRE(state.runString("return 1") == LUA_OK);
+		REQUIRE(state.memoryStats().live < baseline + 64 * 1024);
+		REQUIRE(state.memoryStats().failures == 0);
+	}
+}
+
+TEST_CASE("StateWrapper::setMemoryLimit without allocator") {
+	StateWrapper state;
+	REQUIRE(!state.setMemoryLimit(1024));
+}
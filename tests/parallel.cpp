@@ -0,0 +1,111 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <chrono>
+#include <future>
+#include <string>
+#include <vector>
+
+using namespace luwra;
+
+TEST_CASE("parallelMap") {
+	ExecutorPool pool(4, [](StateWrapper& state) {
+		state.loadStandardLibrary();
+	});
+
+	SECTION("numbers") {
+		std::vector<double> input(100000);
+		for (size_t i = 0; i < input.size(); i++)
+			input[i] = static_cast<double>(i);
+
+		std::vector<double> output;
+
+		REQUIRE(parallelMap(pool, "return function (x) return x * 2 + 1 end", input, output) == LUA_OK);
+		REQUIRE(output.size() == input.size());
+
+		size_t mismatches = 0;
+		for (size_t i = 0; i < input.size(); i++)
+			mismatches += output[i] != input[i] * 2 + 1;
+
+		REQUIRE(mismatches == 0);
+
+		// The compiled function is cached by its source
+		REQUIRE(parallelMap(pool, "return function (x) return x * 2 + 1 end", input, output) == LUA_OK);
+		REQUIRE(output[1234] == 2469);
+	}
+
+	SECTION("conversion") {
+		std::vector<int> input {1, 22, 333};
+		std::string output[3];
+
+		REQUIRE(parallelMap(
+			pool,
+			"return function (x) return 'n' .. x end",
+			input.data(),
+			input.size(),
+			output
+		) == LUA_OK);
+
+		REQUIRE(output[0] == "n1");
+		REQUIRE(output[1] == "n22");
+		REQUIRE(output[2] == "n333");
+	}
+
+	SECTION("empty input") {
+		std::vector<int> input;
+		std::vector<int> output;
+
+		REQUIRE(parallelMap(pool, "return function (x) return x end", input, output) == LUA_OK);
+		REQUIRE(output.empty());
+	}
+
+	SECTION("errors") {
+		std::vector<int> input(5000, 1);
+		std::vector<int> output;
+		std::string message;
+
+		REQUIRE(parallelMap(pool, "return function (", input, output, &message) == LUA_ERRSYNTAX);
+		REQUIRE(!message.empty());
+
+		message.clear();
+		REQUIRE(parallelMap(pool, "return 42", input, output, &message) == LUA_ERRRUN);
+		REQUIRE(message == "mapping chunk does not return a function");
+
+		message.clear();
+		REQUIRE(parallelMap(pool, "return function (x) error('failure', 0) end", input, output, &message) == LUA_ERRRUN);
+		REQUIRE(message == "failure");
+
+		// Results which cannot be converted
+		message.clear();
+		REQUIRE(parallelMap(pool, "return function (x) return {} end", input, output, &message) == LUA_ERRRUN);
+		REQUIRE(!message.empty());
+
+		// The states are still usable
+		REQUIRE(parallelMap(pool, "return function (x) return x + 1 end", input, output) == LUA_OK);
+		REQUIRE(output[4999] == 2);
+	}
+
+	SECTION("from within a job") {
+		// A single worker cannot steal the chunks from its own queue
+		ExecutorPool single(1, [](StateWrapper& state) {
+			state.loadStandardLibrary();
+		});
+
+		std::vector<int> input(5000, 1);
+		std::vector<int> output;
+
+		bool ownState = false;
+
+		std::future<int> status = single.submit([&](StateWrapper& state) {
+			ownState = single.currentState() == &state;
+			return parallelMap(single, "return function (x) return x * 3 end", input, output);
+		});
+
+		REQUIRE(status.wait_for(std::chrono::seconds(10)) == std::future_status::ready);
+		REQUIRE(status.get() == LUA_OK);
+		REQUIRE(ownState);
+		REQUIRE(output[4999] == 3);
+
+		REQUIRE(single.currentState() == nullptr);
+	}
+}
@@ -0,0 +1,131 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+using namespace luwra;
+
+namespace {
+	struct Counter {
+		int value;
+
+		Counter(int value): value(value) {}
+
+		int next() {
+			return ++value;
+		}
+	};
+}
+
+TEST_CASE("TableSnapshot") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	REQUIRE(state.runString("t = {a = 1, b = 2, c = {}} return t") == LUA_OK);
+
+	TableSnapshot snapshot(state, -1);
+	REQUIRE(lua_gettop(state) == 1);
+
+	REQUIRE(state.runString(
+		"saved = t.c\n"
+		"t.a = 'changed'\n"
+		"t.b = nil\n"
+		"t.d = 4\n"
+		"setmetatable(t, {})"
+	) == LUA_OK);
+
+	REQUIRE(snapshot.restore() == LUA_OK);
+	REQUIRE(lua_gettop(state) == 1);
+
+	REQUIRE(state.runString(
+		"return t.a == 1 and t.b == 2 and t.c == saved and t.d == nil and getmetatable(t) == nil"
+	) == LUA_OK);
+	REQUIRE(state.read<bool>(-1));
+}
+
+TEST_CASE("TableSnapshot under a memory limit") {
+	StateWrapper state(std::make_shared<MallocAllocator>());
+	state.loadStandardLibrary();
+
+	REQUIRE(state.runString(
+		"t = {}\n"
+		"for i = 1, 1000 do t['key' .. i] = i end\n"
+		"return t"
+	) == LUA_OK);
+
+	TableSnapshot snapshot(state, -1);
+	lua_pop(state, 1);
+
+	// Shrink the hash part, so that restoring the keys has to grow it again
+	REQUIRE(state.runString(
+		"for i = 1, 1000 do t['key' .. i] = nil end\n"
+		"for i = 1, 2000 do t[i] = i end\n"
+		"for i = 1, 2000 do t[i] = nil end\n"
+		"collectgarbage()"
+	) == LUA_OK);
+
+	REQUIRE(state.setMemoryLimit(state.memoryStats().live + 1024));
+
+	REQUIRE(snapshot.restore() == LUA_ERRMEM);
+	lua_pop(state, 1);
+
+	REQUIRE(state.setMemoryLimit(0));
+
+	REQUIRE(snapshot.restore() == LUA_OK);
+	REQUIRE(state.runString("return t.key1 + t.key1000") == LUA_OK);
+	REQUIRE(state.read<int>(-1) == 1001);
+}
+
+TEST_CASE("StatePool") {
+	int initialisations = 0;
+
+	StatePool pool(2, [&initialisations](StateWrapper& state) {
+		initialisations++;
+
+		state.loadStandardLibrary();
+		state.registerUserType<Counter(int)>("Counter", {LUWRA_MEMBER(Counter, next)});
+		state.runString("base = 'pristine'; package.loaded.config = {mode = 'pristine'}");
+	});
+
+	REQUIRE(initialisations == 2);
+	REQUIRE(pool.available() == 2);
+
+	{
+		StatePool::Lease lease = pool.acquire();
+		REQUIRE(pool.available() == 1);
+
+		REQUIRE(lease->runString(
+			"leaked = Counter(1)\n"
+			"base = 'modified'\n"
+			"package.loaded.mymodule = {}\n"
+			"print = nil\n"
+			"string.leaked = true\n"
+			"math.pi = 0\n"
+			"require('config').mode = 'modified'\n"
+			"return leaked:next()"
+		) == LUA_OK);
+		REQUIRE(lease->read<int>(-1) == 2);
+	}
+
+	REQUIRE(pool.available() == 2);
+
+	StatePool::Lease first = pool.acquire();
+	StatePool::Lease second = pool.acquire();
+
+	for (StateWrapper* state: {&*first, &*second}) {
+		REQUIRE(lua_gettop(*state) == 0);
+
+		REQUIRE(state->runString(
+			"return leaked == nil and base == 'pristine' and package.loaded.mymodule == nil"
+			" and print ~= nil and Counter(5):next() == 6"
+			" and string.leaked == nil and math.pi > 3 and require('config').mode == 'pristine'"
+		) == LUA_OK);
+		REQUIRE(state->read<bool>(-1));
+	}
+
+	// Exhausted pools initialise additional states
+	StatePool::Lease third = pool.acquire();
+	REQUIRE(initialisations == 3);
+
+	StatePool::Lease moved = std::move(third);
+	REQUIRE(moved->runString("return base") == LUA_OK);
+	REQUIRE(moved->read<std::string>(-1) == "pristine");
+}
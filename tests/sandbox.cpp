@@ -0,0 +1,84 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace luwra;
+
+TEST_CASE("Sandbox") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	REQUIRE(state.runString("shared = 'base'") == LUA_OK);
+
+	Sandbox a = state.spawnSandbox();
+	Sandbox b = state.spawnSandbox();
+
+	REQUIRE(lua_gettop(state) == 0);
+	REQUIRE(static_cast<State*>(a) != static_cast<State*>(state));
+
+	SECTION("globals are local to the sandbox") {
+		REQUIRE(a.runString("x = 'a' shared = 'overwritten'") == LUA_OK);
+		REQUIRE(b.runString("x = 'b'") == LUA_OK);
+
+		REQUIRE(a.env.get<std::string>("x") == "a");
+		REQUIRE(b.env.get<std::string>("x") == "b");
+
+		REQUIRE(!state.has("x"));
+		REQUIRE(state.get<std::string>("shared") == "base");
+
+		REQUIRE(b.runString("return shared") == LUA_OK);
+		REQUIRE(read<std::string>(b, -1) == "base");
+	}
+
+	SECTION("reads fall through to the base globals") {
+		REQUIRE(a.runString("return string.upper('abc'), type(print)") == LUA_OK);
+		REQUIRE(read<std::string>(a, -2) == "ABC");
+		REQUIRE(read<std::string>(a, -1) == "function");
+	}
+
+	SECTION("_G refers to the sandbox") {
+		REQUIRE(a.runString("_G.y = 1 return y") == LUA_OK);
+		REQUIRE(read<int>(a, -1) == 1);
+		REQUIRE(!state.has("y"));
+	}
+
+	SECTION("the shared globals cannot be reached through the metatable") {
+		REQUIRE(a.runString("getmetatable(_G).__index.print = function () end") == LUA_ERRRUN);
+		REQUIRE(a.runString("getmetatable(_G).__index = {}") == LUA_ERRRUN);
+		REQUIRE(a.runString("setmetatable(_G, nil)") == LUA_ERRRUN);
+
+		REQUIRE(b.runString("return type(assert)") == LUA_OK);
+		REQUIRE(read<std::string>(b, -1) == "function");
+
+		lua_getglobal(state, "print");
+		REQUIRE(lua_iscfunction(state, -1));
+	}
+
+	SECTION("errors stay on the sandbox's stack") {
+		REQUIRE(a.runString("error('failed')") == LUA_ERRRUN);
+		REQUIRE(lua_isstring(a, -1));
+		REQUIRE(lua_gettop(state) == 0);
+
+		REQUIRE(a.runString("syntax error") == LUA_ERRSYNTAX);
+	}
+
+	SECTION("many sandboxes") {
+		std::vector<Sandbox> sandboxes;
+
+		for (int i = 0; i < 1000; i++) {
+			sandboxes.push_back(state.spawnSandbox());
+			sandboxes.back().env.set("id", i);
+		}
+
+		for (int i = 0; i < 1000; i++) {
+			REQUIRE(sandboxes[i].runString("return id") == LUA_OK);
+			REQUIRE(read<int>(sandboxes[i], -1) == i);
+		}
+
+		sandboxes.clear();
+		lua_gc(state, LUA_GCCOLLECT, 0);
+		REQUIRE(lua_gettop(state) == 0);
+	}
+}
@@ -0,0 +1,230 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace luwra;
+
+static
+int waitFor(State* state) {
+	int value = read<int>(state, 1);
+
+	return Scheduler::current(state)->await(state, [value](Wakeup wakeup) {
+		std::thread([value, wakeup]() {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			wakeup.resumeWith(value * 2);
+		}).detach();
+	});
+}
+
+static
+int failNow(State* state) {
+	return Scheduler::current(state)->await(state, [](Wakeup wakeup) {
+		wakeup.fail("failure");
+	});
+}
+
+TEST_CASE("Scheduler") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	Scheduler scheduler(state);
+	REQUIRE(Scheduler::current(state) == &scheduler);
+
+	state["waitFor"] = &waitFor;
+	state["failNow"] = &failNow;
+
+	SECTION("round-robin") {
+		REQUIRE(state.runString(
+			"trace = {}\n"
+			"function worker(name, count)\n"
+			"  for i = 1, count do\n"
+			"    trace[#trace + 1] = name .. i\n"
+			"    coroutine.yield()\n"
+			"  end\n"
+			"  return name\n"
+			"end"
+		) == LUA_OK);
+
+		std::vector<std::string> finished;
+		Scheduler::Completion done = [&finished](State* thread, int status) {
+			REQUIRE(status == LUA_OK);
+			finished.push_back(read<std::string>(thread, -1));
+		};
+
+		lua_getglobal(state, "worker");
+		state.push("a", 2);
+		scheduler.spawn(2, done);
+
+		lua_getglobal(state, "worker");
+		state.push("b", 3);
+		scheduler.spawn(2, done);
+
+		REQUIRE(lua_gettop(state) == 0);
+		REQUIRE(scheduler.size() == 2);
+
+		REQUIRE(scheduler.runOnce() == 2);
+		REQUIRE(scheduler.run() == 0);
+
+		REQUIRE(state.runString("return table.concat(trace, ' ')") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "a1 b1 a2 b2 b3");
+		REQUIRE(finished == std::vector<std::string>({"a", "b"}));
+	}
+
+	SECTION("waiting") {
+		REQUIRE(state.runString(
+			"results = {}\n"
+			"function worker(value)\n"
+			"  local result = waitFor(value)\n"
+			"  results[#results + 1] = result\n"
+			"end"
+		) == LUA_OK);
+
+		for (int i = 1; i <= 10; i++) {
+			lua_getglobal(state, "worker");
+			state.push(i);
+			scheduler.spawn(1);
+		}
+
+		while (scheduler.run() > 0)
+			scheduler.wait(std::chrono::milliseconds(100));
+
+		REQUIRE(state.runString(
+			"local sum = 0\n"
+			"for _, value in ipairs(results) do sum = sum + value end\n"
+			"return #results, sum"
+		) == LUA_OK);
+		REQUIRE(state.read<int>(-2) == 10);
+		REQUIRE(state.read<int>(-1) == 110);
+	}
+
+	SECTION("failing") {
+#if LUA_VERSION_NUM >= 502
+		REQUIRE(state.runString("function worker() failNow() end") == LUA_OK);
+#else
+		REQUIRE(state.runString(
+			"function worker() local _, message = failNow(); error(message, 0) end"
+		) == LUA_OK);
+#endif
+
+		int result = LUA_OK;
+		std::string message;
+
+		lua_getglobal(state, "worker");
+		scheduler.spawn(0, [&](State* thread, int status) {
+			result = status;
+			message = read<std::string>(thread, -1);
+		});
+
+		REQUIRE(scheduler.run() == 0);
+		REQUIRE(result == LUA_ERRRUN);
+		REQUIRE(message == "failure");
+	}
+
+	SECTION("waiting outside of a coroutine") {
+		REQUIRE(state.runString("failNow()") == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1).find("outside of a scheduled coroutine") != std::string::npos);
+	}
+
+#if LUA_VERSION_NUM >= 503
+	SECTION("preemption") {
+		REQUIRE(state.runString(
+			"finished = {}\n"
+			"function spin() while true do end end\n"
+			"function count(n) local x = 0; for i = 1, n do x = x + i end; finished[#finished + 1] = x end"
+		) == LUA_OK);
+
+		scheduler.setBudget(1000);
+		REQUIRE(scheduler.getBudget() == 1000);
+
+		lua_getglobal(state, "spin");
+		State* spinner = scheduler.spawn(0);
+
+		lua_getglobal(state, "count");
+		state.push(100000);
+		State* counter = scheduler.spawn(1, [&](State* thread, int status) {
+			REQUIRE(status == LUA_OK);
+
+			Scheduler::Stats stats = scheduler.stats(thread);
+			REQUIRE(stats.slices > 1);
+			REQUIRE(stats.preemptions == stats.slices - 1);
+		});
+
+		// The busy loop cannot keep the other coroutine from finishing
+		for (int i = 0; i < 10000 && scheduler.owns(counter); i++)
+			scheduler.runOnce();
+
+		REQUIRE(!scheduler.owns(counter));
+		REQUIRE(scheduler.size() == 1);
+
+		REQUIRE(state.runString("return finished[1]") == LUA_OK);
+		REQUIRE(state.read<double>(-1) == 5000050000.0);
+
+		Scheduler::Stats stats = scheduler.stats(spinner);
+		REQUIRE(stats.slices == stats.preemptions);
+		REQUIRE(stats.cpu.count() > 0);
+	}
+
+	SECTION("preemption of nested coroutines") {
+		REQUIRE(state.runString(
+			"finished = false\n"
+			"function spin() coroutine.wrap(function () while true do end end)() end\n"
+			"function count() local x = 0; for i = 1, 100000 do x = x + i end; finished = true end"
+		) == LUA_OK);
+
+		scheduler.setBudget(1000);
+
+		std::string message;
+
+		lua_getglobal(state, "spin");
+		scheduler.spawn(0, [&](State* thread, int status) {
+			REQUIRE(status == LUA_ERRRUN);
+			message = read<std::string>(thread, -1);
+		});
+
+		lua_getglobal(state, "count");
+		scheduler.spawn(0);
+
+		// The nested coroutine cannot be yielded, hence it is stopped
+		REQUIRE(scheduler.run() == 0);
+		REQUIRE(message.find("instruction budget has been exceeded") != std::string::npos);
+		REQUIRE(state.get<bool>("finished"));
+	}
+
+	SECTION("preemption around generators") {
+		REQUIRE(state.runString(
+			"function consume()\n"
+			"  local numbers = coroutine.wrap(function ()\n"
+			"    for i = 1, 100000 do coroutine.yield(i) end\n"
+			"  end)\n"
+			"  local sum = 0\n"
+			"  for i = 1, 100000 do sum = sum + numbers() end\n"
+			"  return sum\n"
+			"end"
+		) == LUA_OK);
+
+		scheduler.setBudget(1000);
+
+		double sum = 0;
+		lua_getglobal(state, "consume");
+		State* consumer = scheduler.spawn(0, [&](State* thread, int status) {
+			REQUIRE(status == LUA_OK);
+			sum = read<double>(thread, -1);
+
+			Scheduler::Stats stats = scheduler.stats(thread);
+			REQUIRE(stats.preemptions > 0);
+		});
+
+		REQUIRE(scheduler.run() == 0);
+		REQUIRE(!scheduler.owns(consumer));
+		REQUIRE(sum == 5000050000.0);
+	}
+#endif
+
+	SECTION("timeout") {
+		REQUIRE(!scheduler.wait(std::chrono::milliseconds(1)));
+	}
+}
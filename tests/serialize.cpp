@@ -0,0 +1,225 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <string>
+#include <vector>
+
+using namespace luwra;
+
+// Copies values from one state to another through 'serialize' and 'deserialize'.
+static
+std::string roundTrip(State* from, State* to, const char* code, bool allowFunctions = false) {
+	REQUIRE(luaL_dostring(from, code) == LUA_OK);
+
+	std::string buffer;
+	REQUIRE(serialize(from, -1, buffer) == LUA_OK);
+	lua_pop(from, 1);
+
+	REQUIRE(deserialize(to, buffer.data(), buffer.size(), allowFunctions) == LUA_OK);
+	return buffer;
+}
+
+// Sink which records the size of each write
+struct CountingSink {
+	std::string output;
+	size_t writes = 0;
+
+	void write(const char* data, size_t length) {
+		output.append(data, length);
+		writes++;
+	}
+};
+
+// Source which hands out copies through a small buffer
+struct CopyingSource {
+	const std::string& input;
+	size_t position = 0;
+	std::vector<char> buffer;
+
+	CopyingSource(const std::string& input):
+		input(input)
+	{}
+
+	const char* read(size_t length) {
+		if (length > input.size() - position)
+			return nullptr;
+
+		buffer.assign(input.begin() + position, input.begin() + position + length);
+		position += length;
+
+		return buffer.data();
+	}
+};
+
+TEST_CASE("serialize") {
+	StateWrapper from;
+	from.loadStandardLibrary();
+
+	StateWrapper to;
+	to.loadStandardLibrary();
+
+	SECTION("scalars") {
+		roundTrip(from, to, "return nil");
+		REQUIRE(lua_isnil(to, -1));
+
+		roundTrip(from, to, "return true");
+		REQUIRE(to.read<bool>(-1) == true);
+
+		roundTrip(from, to, "return -1337");
+		REQUIRE(to.read<int>(-1) == -1337);
+
+		roundTrip(from, to, "return 0.25");
+		REQUIRE(to.read<double>(-1) == 0.25);
+
+		roundTrip(from, to, "return 'Hello\\0World'");
+		REQUIRE(to.read<std::string>(-1) == std::string("Hello\0World", 11));
+
+#if LUA_VERSION_NUM >= 503
+		roundTrip(from, to, "return math.maxinteger");
+		REQUIRE(lua_isinteger(to, -1));
+		REQUIRE(lua_tointeger(to, -1) == LUA_MAXINTEGER);
+
+		// Floats remain floats
+		roundTrip(from, to, "return 2.0");
+		REQUIRE(!lua_isinteger(to, -1));
+#endif
+	}
+
+	SECTION("tables") {
+		roundTrip(from, to, "return {1, 2, 3, nil, 5, x = {y = 'z'}, [true] = false}");
+		lua_setglobal(to, "t");
+		REQUIRE(to.runString(
+			"return t[1] == 1 and t[2] == 2 and t[3] == 3 and t[4] == nil and t[5] == 5\n"
+			"   and t.x.y == 'z' and t[true] == false"
+		) == LUA_OK);
+		REQUIRE(to.read<bool>(-1));
+	}
+
+	SECTION("shared references and cycles") {
+		roundTrip(from, to, "local a = {} local t = {a, a} t.self = t return t");
+		lua_setglobal(to, "t");
+
+		REQUIRE(to.runString("return t[1] == t[2] and t.self == t") == LUA_OK);
+		REQUIRE(to.read<bool>(-1));
+	}
+
+	SECTION("metatables") {
+		roundTrip(from, to, "return setmetatable({}, {__index = {answer = 42}})");
+		lua_setglobal(to, "t");
+
+		REQUIRE(to.runString("return t.answer") == LUA_OK);
+		REQUIRE(to.read<int>(-1) == 42);
+	}
+
+	SECTION("functions") {
+		roundTrip(from, to, "local n = 10 return function (x) n = n + x return n end", true);
+		lua_setglobal(to, "f");
+
+		REQUIRE(to.runString("f(1) return f(2)") == LUA_OK);
+		REQUIRE(to.read<int>(-1) == 13);
+	}
+
+	SECTION("functions are rejected by default") {
+		REQUIRE(from.runString("return {function () end}") == LUA_OK);
+
+		std::string buffer;
+		REQUIRE(serialize(from, -1, buffer) == LUA_OK);
+
+		REQUIRE(deserialize(to, buffer.data(), buffer.size()) == LUA_ERRRUN);
+		REQUIRE(to.read<std::string>(-1).find("functions are not allowed") != std::string::npos);
+	}
+
+	SECTION("upvalues which the function does not have") {
+		REQUIRE(from.runString("local n = 1 return function () return n end") == LUA_OK);
+
+		std::string buffer;
+		REQUIRE(serialize(from, -1, buffer) == LUA_OK);
+
+		// Skip the tag and the bytecode, then claim a second upvalue
+		REQUIRE(static_cast<unsigned char>(buffer[0]) == internal::SerialFunction);
+
+		size_t length = 0;
+		size_t position = 1;
+		unsigned shift = 0;
+		unsigned char byte;
+
+		do {
+			byte = static_cast<unsigned char>(buffer[position++]);
+			length |= static_cast<size_t>(byte & 0x7F) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+
+		position += length;
+		REQUIRE(buffer[position] == 1);
+
+		buffer[position] = 2;
+		buffer.push_back(static_cast<char>(internal::SerialNil));
+
+		REQUIRE(deserialize(to, buffer.data(), buffer.size(), true) == LUA_ERRRUN);
+		REQUIRE(to.read<std::string>(-1).find("invalid upvalue") != std::string::npos);
+	}
+
+	SECTION("compact encoding") {
+		// Sequences do not carry their keys
+		std::string array = roundTrip(from, to, "return {1, 2, 3, 4, 5, 6, 7, 8}");
+		REQUIRE(array.size() == 1 + 2 + 8 * 2 + 1);
+
+		// Repeated strings are written once
+		std::string repeated = roundTrip(
+			from,
+			to,
+			"local s = string.rep('x', 100) return {s, s, s, s}"
+		);
+		REQUIRE(repeated.size() < 150);
+
+		lua_setglobal(to, "t");
+		REQUIRE(to.runString("return #t[4]") == LUA_OK);
+		REQUIRE(to.read<int>(-1) == 100);
+	}
+
+	SECTION("custom sinks and sources") {
+		REQUIRE(from.runString("return {'first', {'second', 3}, third = 4.5}") == LUA_OK);
+
+		CountingSink sink;
+		REQUIRE(serialize(from, -1, sink) == LUA_OK);
+		REQUIRE(sink.writes > 1);
+
+		CopyingSource source(sink.output);
+		REQUIRE(deserialize(to, source) == LUA_OK);
+		REQUIRE(source.position == sink.output.size());
+
+		lua_setglobal(to, "t");
+		REQUIRE(to.runString("return t[1] .. t[2][1] .. t[2][2] .. t.third") == LUA_OK);
+		REQUIRE(to.read<std::string>(-1) == "firstsecond34.5");
+	}
+
+	SECTION("unsupported values") {
+		REQUIRE(from.runString("return {print}") == LUA_OK);
+
+		std::string buffer;
+		REQUIRE(serialize(from, -1, buffer) == LUA_ERRRUN);
+		REQUIRE(from.read<std::string>(-1) == "cannot serialize a C function");
+	}
+
+	SECTION("malformed input") {
+		std::string buffer = roundTrip(from, to, "return {1, 2, 3, 'some string'}");
+
+		REQUIRE(deserialize(to, buffer.data(), buffer.size() - 1) == LUA_ERRRUN);
+		REQUIRE(deserialize(to, "\xFF", 1) == LUA_ERRRUN);
+		REQUIRE(deserialize(to, "", 0) == LUA_ERRRUN);
+	}
+}
+
+TEST_CASE("deserialize with oversized tables") {
+	StateWrapper state(std::make_shared<MallocAllocator>());
+	REQUIRE(state.setMemoryLimit(state.memoryStats().live + 4 * 1024 * 1024));
+
+	// Nested tables which claim 2^20 array and hash entries each, but have no fields
+	std::string buffer;
+	for (int i = 0; i < 4; i++)
+		buffer.append({char(internal::SerialTable), '\x80', '\x80', '\x40', '\x80', '\x80', '\x40'});
+
+	REQUIRE(deserialize(state, buffer.data(), buffer.size()) == LUA_ERRRUN);
+	REQUIRE(state.read<std::string>(-1).find("unexpected end of data") != std::string::npos);
+	REQUIRE(state.memoryStats().failures == 0);
+}
@@ -0,0 +1,198 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace luwra;
+
+struct SnapshotPoint {
+	double x, y;
+
+	SnapshotPoint(double x, double y):
+		x(x), y(y)
+	{}
+};
+
+static
+int saveSnapshotPoint(State* state) {
+	SnapshotPoint& point = read<SnapshotPoint&>(state, 1);
+
+	lua_createtable(state, 2, 0);
+	setFields(state, -1, 1, point.x, 2, point.y);
+
+	return 1;
+}
+
+static
+int loadSnapshotPoint(State* state) {
+	lua_rawgeti(state, 1, 1);
+	lua_rawgeti(state, 1, 2);
+	construct<SnapshotPoint>(state, read<double>(state, -2), read<double>(state, -1));
+
+	return 1;
+}
+
+static
+void prepareState(StateWrapper& state) {
+	state.loadStandardLibrary();
+	state.registerUserType<SnapshotPoint(double, double)>("Point");
+
+	registerSerializer<SnapshotPoint>(
+		state,
+		"Point",
+		&saveSnapshotPoint,
+		&loadSnapshotPoint
+	);
+}
+
+TEST_CASE("snapshot") {
+	const char* path = "/tmp/luwra-snapshot-test.bin";
+
+	{
+		StateWrapper state;
+		prepareState(state);
+
+		REQUIRE(state.runString(
+			"lookup = {}\n"
+			"for i = 1, 100 do lookup[i] = i * i end\n"
+			"lookup.name = 'squares'\n"
+			"lookup.self = lookup\n"
+			"lookup.ratio = 0.5\n"
+			"lookup.negative = -7\n"
+			"setmetatable(lookup, {__index = function (t, k) return 'missing ' .. k end})\n"
+			"alias = lookup\n"
+			"local counter = 10\n"
+			"function increment() counter = counter + 1 return counter end\n"
+			"function current() return counter end\n"
+			"format = string.format\n"
+			"libs = {string, math.floor}\n"
+			"origin = Point(3, 4)\n"
+		) == LUA_OK);
+
+		REQUIRE(state.snapshot(path) == LUA_OK);
+		REQUIRE(lua_gettop(state) == 0);
+	}
+
+	StateWrapper state;
+	prepareState(state);
+
+	REQUIRE(state.restore(path) == LUA_OK);
+	REQUIRE(lua_gettop(state) == 0);
+
+	SECTION("tables") {
+		REQUIRE(state.runString("return lookup[12], lookup.name, lookup.ratio, lookup.negative") == LUA_OK);
+		REQUIRE(state.read<int>(-4) == 144);
+		REQUIRE(state.read<std::string>(-3) == "squares");
+		REQUIRE(state.read<double>(-2) == 0.5);
+		REQUIRE(state.read<int>(-1) == -7);
+
+		REQUIRE(state.runString("return lookup.self == lookup and alias == lookup") == LUA_OK);
+		REQUIRE(state.read<bool>(-1));
+
+		// Metatables and the functions in them
+		REQUIRE(state.runString("return lookup.foo") == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "missing foo");
+	}
+
+	SECTION("functions") {
+		REQUIRE(state.runString("return increment(), increment()") == LUA_OK);
+		REQUIRE(state.read<int>(-2) == 11);
+		REQUIRE(state.read<int>(-1) == 12);
+
+#if LUA_VERSION_NUM >= 502
+		// Shared upvalues remain shared
+		REQUIRE(state.runString("return current()") == LUA_OK);
+		REQUIRE(state.read<int>(-1) == 12);
+#endif
+	}
+
+	SECTION("library functions") {
+		REQUIRE(state.runString("return format == string.format and libs[1] == string and libs[2] == math.floor") == LUA_OK);
+		REQUIRE(state.read<bool>(-1));
+	}
+
+	SECTION("user types") {
+		REQUIRE(state.runString("return origin") == LUA_OK);
+
+		SnapshotPoint& point = state.read<SnapshotPoint&>(-1);
+		REQUIRE(point.x == 3);
+		REQUIRE(point.y == 4);
+	}
+
+	std::remove(path);
+}
+
+TEST_CASE("snapshot failures") {
+	const char* path = "/tmp/luwra-snapshot-test.bin";
+
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	SECTION("threads") {
+		REQUIRE(state.runString("co = coroutine.create(function () end)") == LUA_OK);
+		REQUIRE(state.snapshot(path) == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1) == "cannot serialize a thread");
+	}
+
+	SECTION("user types without hooks") {
+		state.registerUserType<SnapshotPoint(double, double)>("Point");
+		REQUIRE(state.runString("p = Point(1, 2)") == LUA_OK);
+		REQUIRE(state.snapshot(path) == LUA_ERRRUN);
+	}
+
+	SECTION("missing files") {
+		REQUIRE(state.restore("/tmp/luwra-snapshot-missing.bin") == LUA_ERRFILE);
+	}
+
+	SECTION("missing modules") {
+		REQUIRE(state.runString("x = string.rep") == LUA_OK);
+		REQUIRE(state.snapshot(path) == LUA_OK);
+
+		StateWrapper empty;
+		REQUIRE(empty.restore(path) == LUA_ERRRUN);
+	}
+
+	std::remove(path);
+}
+
+TEST_CASE("concurrent snapshots") {
+	const char* path = "/tmp/luwra-snapshot-concurrent.bin";
+
+	// Writers which share a path must not corrupt each other's image
+	std::vector<std::thread> writers;
+	std::atomic<int> failures {0};
+
+	for (int id = 1; id <= 4; id++) {
+		writers.emplace_back([id, path, &failures]() {
+			StateWrapper state;
+			state.loadStandardLibrary();
+
+			state["id"] = id;
+			state.runString("values = {} for i = 1, 20000 do values[i] = id end");
+
+			for (int i = 0; i < 5; i++)
+				failures += state.snapshot(path) != LUA_OK;
+		});
+	}
+
+	for (std::thread& writer: writers)
+		writer.join();
+
+	REQUIRE(failures == 0);
+
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	REQUIRE(state.restore(path) == LUA_OK);
+	REQUIRE(state.runString(
+		"for i = 1, 20000 do if values[i] ~= id then return false end end\n"
+		"return true"
+	) == LUA_OK);
+	REQUIRE(state.read<bool>(-1));
+
+	std::remove(path);
+}
@@ -0,0 +1,84 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+// Built separately using 'make test-cxx20'
+#ifdef LUWRA_HAS_COROUTINES
+
+#include <chrono>
+#include <thread>
+
+using namespace luwra;
+
+// Continues the awaiting coroutine on a new thread
+struct ResumeOnThread {
+	bool await_ready() const {
+		return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> handle) const {
+		std::thread([handle]() { handle.resume(); }).detach();
+	}
+
+	void await_resume() const {}
+};
+
+static
+Task<int> doubleLater(int value) {
+	co_await ResumeOnThread {};
+	co_return value * 2;
+}
+
+static
+Task<int> doubleLaterPlusOne(int value) {
+	int result = co_await doubleLater(value);
+	co_return result + 1;
+}
+
+TEST_CASE("Task") {
+	SECTION("finishing on another thread") {
+		// The inner task races with the outer task which suspends on it
+		for (int i = 0; i < 1000; i++) {
+			Task<int> task = doubleLaterPlusOne(i);
+
+			while (!task.isReady())
+				std::this_thread::yield();
+
+			REQUIRE(task.get() == i * 2 + 1);
+		}
+	}
+
+	SECTION("awaited by Lua") {
+		StateWrapper state;
+		state.loadStandardLibrary();
+
+		Scheduler scheduler(state);
+
+		state["doublePlusOne"] = LUWRA_WRAP_TASK(doubleLaterPlusOne);
+		REQUIRE(state.runString(
+			"results = {}\n"
+			"function worker(value)\n"
+			"  local result = doublePlusOne(value)\n"
+			"  results[#results + 1] = result\n"
+			"end"
+		) == LUA_OK);
+
+		for (int i = 1; i <= 10; i++) {
+			lua_getglobal(state, "worker");
+			state.push(i);
+			scheduler.spawn(1);
+		}
+
+		while (scheduler.run() > 0)
+			scheduler.wait(std::chrono::milliseconds(100));
+
+		REQUIRE(state.runString(
+			"local sum = 0\n"
+			"for _, value in ipairs(results) do sum = sum + value end\n"
+			"return #results, sum"
+		) == LUA_OK);
+		REQUIRE(state.read<int>(-2) == 10);
+		REQUIRE(state.read<int>(-1) == 120);
+	}
+}
+
+#endif
@@ -0,0 +1,129 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <chrono>
+#include <string>
+
+using namespace luwra;
+
+using std::chrono::milliseconds;
+
+TEST_CASE("TimerWheel") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	TimerWheel wheel(state);
+
+	wheel.pushModule();
+	lua_setglobal(state, "timers");
+
+	// Advance in steps of one millisecond, exposing the elapsed time to Lua as 'now'
+	auto advanceTo = [&](int target) {
+		int failures = 0;
+
+		for (int now = state.get<int>("now") + 1; now <= target; now++) {
+			state["now"] = now;
+			failures += wheel.advance(milliseconds(1)) != LUA_OK;
+		}
+
+		REQUIRE(failures == 0);
+	};
+
+	state["now"] = 0;
+
+	SECTION("after and every") {
+		REQUIRE(state.runString(
+			"fired = {}\n"
+			"ticks = {}\n"
+			"timers.after(5, function () fired[#fired + 1] = now end)\n"
+			"local periodic\n"
+			"periodic = timers.every(3, function ()\n"
+			"  ticks[#ticks + 1] = now\n"
+			"  if #ticks == 4 then timers.cancel(periodic) end\n"
+			"end)\n"
+			"local cancelled = timers.after(2, function () error('cancelled') end)\n"
+			"assert(timers.cancel(cancelled))\n"
+			"assert(not timers.cancel(cancelled))"
+		) == LUA_OK);
+
+		REQUIRE(wheel.size() == 2);
+
+		advanceTo(20);
+		REQUIRE(wheel.size() == 0);
+
+		REQUIRE(state.runString("return table.concat(fired, ' '), table.concat(ticks, ' ')") == LUA_OK);
+		REQUIRE(state.read<std::string>(-2) == "5");
+		REQUIRE(state.read<std::string>(-1) == "3 6 9 12");
+	}
+
+	SECTION("long delays") {
+		// These end up in the higher levels of the wheel
+		REQUIRE(state.runString(
+			"fired = {}\n"
+			"for _, delay in ipairs({255, 256, 300, 65535, 65536, 70000}) do\n"
+			"  timers.after(delay, function () fired[#fired + 1] = now .. '/' .. delay end)\n"
+			"end"
+		) == LUA_OK);
+
+		advanceTo(70000);
+
+		REQUIRE(state.runString("return table.concat(fired, ' ')") == LUA_OK);
+		REQUIRE(
+			state.read<std::string>(-1)
+			== "255/255 256/256 300/300 65535/65535 65536/65536 70000/70000"
+		);
+	}
+
+	SECTION("batches") {
+		REQUIRE(state.runString(
+			"count = 0\n"
+			"local handles = {}\n"
+			"for i = 1, 100000 do\n"
+			"  handles[i] = timers.after(i % 1000, function () count = count + 1 end)\n"
+			"end\n"
+			"for i = 1, 100000, 2 do timers.cancel(handles[i]) end"
+		) == LUA_OK);
+
+		REQUIRE(wheel.size() == 50000);
+
+		// All expirations are dispatched by a single call
+		REQUIRE(wheel.advance(milliseconds(5000)) == LUA_OK);
+		REQUIRE(wheel.size() == 0);
+		REQUIRE(state.get<int>("count") == 50000);
+
+		// Slots are reused
+		REQUIRE(state.runString("timers.after(1, function () count = -1 end)") == LUA_OK);
+		REQUIRE(wheel.advance(milliseconds(1)) == LUA_OK);
+		REQUIRE(state.get<int>("count") == -1);
+	}
+
+	SECTION("coarse resolution") {
+		TimerWheel coarse(state, milliseconds(10));
+
+		REQUIRE(state.runString("return function () fired = true end") == LUA_OK);
+		coarse.add(-1, milliseconds(25));
+		lua_pop(state, 1);
+
+		// Rounded up to 3 ticks
+		REQUIRE(coarse.advance(milliseconds(29)) == LUA_OK);
+		REQUIRE(coarse.size() == 1);
+
+		REQUIRE(coarse.advance(milliseconds(1)) == LUA_OK);
+		REQUIRE(coarse.size() == 0);
+		REQUIRE(state.get<bool>("fired"));
+	}
+
+	SECTION("errors") {
+		REQUIRE(state.runString(
+			"timers.after(1, function () error('first', 0) end)\n"
+			"timers.after(1, function () error('second', 0) end)\n"
+			"timers.after(1, function () survived = true end)"
+		) == LUA_OK);
+
+		int top = lua_gettop(state);
+
+		REQUIRE(wheel.advance(milliseconds(1)) == LUA_ERRRUN);
+		REQUIRE(lua_gettop(state) == top + 1);
+		REQUIRE(state.get<bool>("survived"));
+	}
+}
@@ -0,0 +1,144 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <string>
+
+using namespace luwra;
+
+struct TransferPoint {
+	double x, y;
+	bool moved = false;
+
+	TransferPoint(double x, double y):
+		x(x), y(y)
+	{}
+
+	TransferPoint(const TransferPoint& other) = default;
+
+	TransferPoint(TransferPoint&& other):
+		x(other.x), y(other.y)
+	{
+		other.moved = true;
+	}
+};
+
+TEST_CASE("transfer") {
+	StateWrapper from;
+	from.loadStandardLibrary();
+
+	StateWrapper to;
+	to.loadStandardLibrary();
+
+	SECTION("scalars") {
+		REQUIRE(from.runString("return nil, true, -1337, 0.25, 'Hello\\0World'") == LUA_OK);
+
+		for (int i = -5; i < 0; i++)
+			REQUIRE(transfer(from, i, to) == LUA_OK);
+
+		REQUIRE(lua_gettop(from) == 5);
+		REQUIRE(lua_isnil(to, -5));
+		REQUIRE(to.read<bool>(-4) == true);
+		REQUIRE(to.read<int>(-3) == -1337);
+		REQUIRE(to.read<double>(-2) == 0.25);
+		REQUIRE(to.read<std::string>(-1) == std::string("Hello\0World", 11));
+
+#if LUA_VERSION_NUM >= 503
+		REQUIRE(from.runString("return 2.0, math.maxinteger") == LUA_OK);
+		REQUIRE(transfer(from, -2, to) == LUA_OK);
+		REQUIRE(!lua_isinteger(to, -1));
+		REQUIRE(transfer(from, -1, to) == LUA_OK);
+		REQUIRE(lua_tointeger(to, -1) == LUA_MAXINTEGER);
+#endif
+	}
+
+	SECTION("tables") {
+		REQUIRE(from.runString(
+			"local shared = {'shared'}\n"
+			"local t = {1, 2, 3, shared, shared, x = {y = 'z'}, [true] = false}\n"
+			"t.self = t\n"
+			"t[shared] = 'key'\n"
+			"return t"
+		) == LUA_OK);
+
+		int from_top = lua_gettop(from);
+		REQUIRE(transfer(from, -1, to) == LUA_OK);
+		REQUIRE(lua_gettop(from) == from_top);
+
+		lua_setglobal(to, "t");
+		REQUIRE(to.runString(
+			"return t[1] == 1 and t[3] == 3 and t.x.y == 'z' and t[true] == false\n"
+			"   and t[4] == t[5] and t[4][1] == 'shared' and t.self == t and t[t[4]] == 'key'"
+		) == LUA_OK);
+		REQUIRE(to.read<bool>(-1));
+
+		// The copy is independent
+		REQUIRE(to.runString("t.x.y = 'changed'") == LUA_OK);
+		lua_getfield(from, from_top, "x");
+		lua_getfield(from, -1, "y");
+		REQUIRE(from.read<std::string>(-1) == "z");
+	}
+
+	SECTION("user types") {
+		from.registerUserType<TransferPoint(double, double)>("Point");
+		to.registerUserType<TransferPoint(double, double)>("Point");
+
+		REQUIRE(from.runString("p = Point(3, 4) return {p, p}") == LUA_OK);
+
+		// Without a hook
+		REQUIRE(transfer(from, -1, to) == LUA_ERRRUN);
+		lua_pop(to, 1);
+
+		registerTransfer<TransferPoint>(from);
+		REQUIRE(transfer(from, -1, to) == LUA_OK);
+
+		lua_setglobal(to, "t");
+		REQUIRE(to.runString("return t[1] == t[2], t[1]") == LUA_OK);
+		REQUIRE(to.read<bool>(-2));
+
+		TransferPoint& copy = to.read<TransferPoint&>(-1);
+		REQUIRE(copy.x == 3);
+		REQUIRE(copy.y == 4);
+
+		lua_getglobal(from, "p");
+		REQUIRE(!from.read<TransferPoint&>(-1).moved);
+
+		registerTransfer<TransferPoint, TransferMove>(from);
+		REQUIRE(transfer(from, -1, to) == LUA_OK);
+		REQUIRE(from.read<TransferPoint&>(-1).moved);
+		REQUIRE(to.read<TransferPoint&>(-1).x == 3);
+	}
+
+	SECTION("unregistered target") {
+		from.registerUserType<TransferPoint(double, double)>("Point");
+		registerTransfer<TransferPoint>(from);
+
+		REQUIRE(from.runString("return Point(1, 2)") == LUA_OK);
+		REQUIRE(transfer(from, -1, to) == LUA_ERRRUN);
+	}
+
+	SECTION("unsupported values") {
+		REQUIRE(from.runString("return {print}") == LUA_OK);
+		REQUIRE(transfer(from, -1, to) == LUA_ERRRUN);
+		REQUIRE(to.read<std::string>(-1) == "cannot transfer a function");
+		REQUIRE(lua_gettop(from) == 1);
+	}
+}
+
+TEST_CASE("transfer under a memory limit") {
+	StateWrapper from;
+	from.loadStandardLibrary();
+
+	StateWrapper to(std::make_shared<MallocAllocator>());
+
+	REQUIRE(from.runString("return string.rep('x', 65536)") == LUA_OK);
+	REQUIRE(to.setMemoryLimit(to.memoryStats().live + 1024));
+
+	REQUIRE(transfer(from, -1, to) == LUA_ERRMEM);
+	REQUIRE(lua_gettop(to) == 1);
+	lua_pop(to, 1);
+
+	REQUIRE(to.setMemoryLimit(0));
+
+	REQUIRE(transfer(from, -1, to) == LUA_OK);
+	REQUIRE(to.read<std::string>(-1).size() == 65536);
+}
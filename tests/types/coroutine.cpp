@@ -0,0 +1,92 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <string>
+
+using namespace luwra;
+
+TEST_CASE("Coroutine") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	SECTION("generator") {
+		REQUIRE(state.runString(
+			"return function (from, to)\n"
+			"  for i = from, to do coroutine.yield(i, i * i) end\n"
+			"  return 'done'\n"
+			"end"
+		) == LUA_OK);
+
+		Function<int> generator = state.read<Function<int>>(-1);
+		Coroutine<int> coroutine = generator.startCoroutine(1);
+
+		REQUIRE(coroutine.isSuspended());
+		REQUIRE(coroutine.size() == 0);
+
+		// The remaining argument is passed with the first resume
+		int sum = 0;
+		int squares = 0;
+
+		REQUIRE(coroutine.resume(4) == LUA_YIELD);
+
+		do {
+			REQUIRE(coroutine.size() == 2);
+			sum += coroutine.value();
+			squares += coroutine.value(2);
+		} while (coroutine.resume() == LUA_YIELD);
+
+		REQUIRE(sum == 10);
+		REQUIRE(squares == 30);
+
+		REQUIRE(coroutine.status() == LUA_OK);
+		REQUIRE(!coroutine.isSuspended());
+		REQUIRE(coroutine.value<std::string>() == "done");
+
+		// Finished coroutines keep their status
+		REQUIRE(coroutine.resume() == LUA_OK);
+	}
+
+	SECTION("passing values") {
+		REQUIRE(state.runString(
+			"return function (total)\n"
+			"  while true do\n"
+			"    local value = coroutine.yield(total)\n"
+			"    if not value then return total end\n"
+			"    total = total + value\n"
+			"  end\n"
+			"end"
+		) == LUA_OK);
+
+		Coroutine<int> coroutine = state.read<Function<int>>(-1).startCoroutine(5);
+		lua_pop(state, 1);
+
+		REQUIRE(coroutine.resume() == LUA_YIELD);
+		REQUIRE(coroutine.value() == 5);
+
+		REQUIRE(coroutine.resume(10) == LUA_YIELD);
+		REQUIRE(coroutine.resume(20) == LUA_YIELD);
+		REQUIRE(coroutine.value() == 35);
+
+		REQUIRE(coroutine.resume() == LUA_OK);
+		REQUIRE(coroutine.value() == 35);
+
+		REQUIRE(lua_gettop(state) == 0);
+	}
+
+	SECTION("errors") {
+		REQUIRE(state.runString(
+			"return function () coroutine.yield(); error('failure', 0) end"
+		) == LUA_OK);
+
+		Coroutine<void> coroutine = state.read<Function<void>>(-1).startCoroutine();
+
+		REQUIRE(coroutine.resume() == LUA_YIELD);
+		REQUIRE(coroutine.size() == 0);
+
+		REQUIRE(coroutine.resume() == LUA_ERRRUN);
+		REQUIRE(coroutine.size() == 0);
+		REQUIRE(read<std::string>(coroutine.thread, -1) == "failure");
+
+		REQUIRE(coroutine.resume() == LUA_ERRRUN);
+	}
+}
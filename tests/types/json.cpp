@@ -0,0 +1,191 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <cstring>
+#include <string>
+
+using namespace luwra;
+
+// Decode the given JSON and encode the result again
+static
+std::string reencode(State* state, const char* json) {
+	REQUIRE(decodeJSON(state, json, std::strlen(json)) == LUA_OK);
+
+	std::string output;
+	REQUIRE(encodeJSON(state, -1, output) == LUA_OK);
+	lua_pop(state, 1);
+
+	return output;
+}
+
+TEST_CASE("json") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	SECTION("decode scalars") {
+		REQUIRE(decodeJSON(state, "  true ", 7) == LUA_OK);
+		REQUIRE(state.read<bool>(-1) == true);
+
+		REQUIRE(decodeJSON(state, "-1337", 5) == LUA_OK);
+		REQUIRE(state.read<int>(-1) == -1337);
+
+		REQUIRE(decodeJSON(state, "0.25e1", 6) == LUA_OK);
+		REQUIRE(state.read<double>(-1) == 2.5);
+
+		REQUIRE(decodeJSON(state, "1.7976931348623157e308", 22) == LUA_OK);
+		REQUIRE(state.read<double>(-1) == 1.7976931348623157e308);
+
+		REQUIRE(decodeJSON(state, "null", 4) == LUA_OK);
+		REQUIRE(lua_islightuserdata(state, -1));
+		REQUIRE(lua_touserdata(state, -1) == jsonNull);
+
+#if LUA_VERSION_NUM >= 503
+		REQUIRE(decodeJSON(state, "9223372036854775807", 19) == LUA_OK);
+		REQUIRE(lua_isinteger(state, -1));
+		REQUIRE(lua_tointeger(state, -1) == LUA_MAXINTEGER);
+
+		REQUIRE(decodeJSON(state, "1.0", 3) == LUA_OK);
+		REQUIRE(!lua_isinteger(state, -1));
+#endif
+	}
+
+	SECTION("decode strings") {
+		const char* json = "\"a\\\"b\\\\c\\n\\u00e4\\u20ac\\ud83d\\ude00\"";
+		REQUIRE(decodeJSON(state, json, std::strlen(json)) == LUA_OK);
+		REQUIRE(state.read<std::string>(-1) == "a\"b\\c\n\xC3\xA4\xE2\x82\xAC\xF0\x9F\x98\x80");
+	}
+
+	SECTION("decode tables") {
+		const char* json = "{\"list\": [1, 2, null, {\"x\": []}], \"name\": \"test\", \"empty\": {}}";
+		REQUIRE(decodeJSON(state, json, std::strlen(json)) == LUA_OK);
+		lua_setglobal(state, "t");
+
+		REQUIRE(state.runString(
+			"return #t.list == 4 and t.list[1] == 1 and t.list[4].x[1] == nil\n"
+			"   and t.name == 'test' and next(t.empty) == nil"
+		) == LUA_OK);
+		REQUIRE(state.read<bool>(-1));
+	}
+
+	SECTION("decode duplicate keys") {
+		REQUIRE(decodeJSON(state, "{\"a\": 1, \"a\": 2}", 16) == LUA_OK);
+		lua_getfield(state, -1, "a");
+		REQUIRE(state.read<int>(-1) == 2);
+
+		// Duplicates which are set in different batches
+		std::string json = "{\"a\": 0";
+		for (int i = 1; i <= 1000; i++)
+			json += ", \"k" + std::to_string(i) + "\": " + std::to_string(i);
+		json += ", \"a\": 1001, \"k1\": -1}";
+
+		REQUIRE(decodeJSON(state, json.data(), json.size()) == LUA_OK);
+		lua_setglobal(state, "t");
+
+		REQUIRE(state.runString("return t.a, t.k1, t.k1000") == LUA_OK);
+		REQUIRE(state.read<int>(-3) == 1001);
+		REQUIRE(state.read<int>(-2) == -1);
+		REQUIRE(state.read<int>(-1) == 1000);
+	}
+
+	SECTION("decode large arrays") {
+		std::string json = "[";
+		for (int i = 1; i <= 1000; i++) {
+			if (i > 1)
+				json += ',';
+
+			json += std::to_string(i);
+		}
+		json += ']';
+
+		REQUIRE(decodeJSON(state, json.data(), json.size()) == LUA_OK);
+		lua_setglobal(state, "t");
+
+		REQUIRE(state.runString("return #t, t[1], t[500], t[1000]") == LUA_OK);
+		REQUIRE(state.read<int>(-4) == 1000);
+		REQUIRE(state.read<int>(-3) == 1);
+		REQUIRE(state.read<int>(-2) == 500);
+		REQUIRE(state.read<int>(-1) == 1000);
+	}
+
+	SECTION("decode wide and deep documents") {
+		// Every level keeps almost a full batch on the stack while the next one is decoded
+		std::string json;
+		for (int i = 0; i < 499; i++) {
+			json += '[';
+
+			for (int j = 0; j < 63; j++)
+				json += "0,";
+		}
+		json += "[0]" + std::string(499, ']');
+
+#if LUA_VERSION_NUM <= 501
+		// Exceeds the limit of 8000 stack slots per C function
+		REQUIRE(decodeJSON(state, json.data(), json.size()) == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1).find("nesting is too deep") != std::string::npos);
+#else
+		REQUIRE(decodeJSON(state, json.data(), json.size()) == LUA_OK);
+		lua_setglobal(state, "t");
+
+		REQUIRE(state.runString(
+			"local depth = 0\n"
+			"while type(t) == 'table' do depth = depth + 1; t = t[64] end\n"
+			"return depth"
+		) == LUA_OK);
+		REQUIRE(state.read<int>(-1) == 500);
+#endif
+	}
+
+	SECTION("encode") {
+		REQUIRE(reencode(state, "[1,2.5,\"x\",true,false,null]") == "[1,2.5,\"x\",true,false,null]");
+		REQUIRE(reencode(state, "{\"key\":[{}]}") == "{\"key\":[{}]}");
+		REQUIRE(reencode(state, "\"tab\\tquote\\\"\\u0001\"") == "\"tab\\tquote\\\"\\u0001\"");
+		REQUIRE(reencode(state, "0.1") == "0.1");
+
+		// Non-sequential numeric keys are written as strings
+		REQUIRE(state.runString("return {[2] = 'b'}") == LUA_OK);
+
+		std::string output;
+		REQUIRE(encodeJSON(state, -1, output) == LUA_OK);
+		REQUIRE(output == "{\"2\":\"b\"}");
+	}
+
+	SECTION("errors") {
+		REQUIRE(decodeJSON(state, "[1, 2", 5) == LUA_ERRRUN);
+		REQUIRE(decodeJSON(state, "{\"a\" 1}", 7) == LUA_ERRRUN);
+		REQUIRE(decodeJSON(state, "01", 2) == LUA_ERRRUN);
+		REQUIRE(decodeJSON(state, "\"\\x\"", 4) == LUA_ERRRUN);
+		REQUIRE(decodeJSON(state, "", 0) == LUA_ERRRUN);
+
+		std::string deep(2000, '[');
+		REQUIRE(decodeJSON(state, deep.data(), deep.size()) == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1).find("nesting is too deep") != std::string::npos);
+
+		std::string output;
+
+		REQUIRE(state.runString("local t = {} t.self = t return t") == LUA_OK);
+		REQUIRE(encodeJSON(state, -1, output) == LUA_ERRRUN);
+
+		REQUIRE(state.runString("return {print}") == LUA_OK);
+		REQUIRE(encodeJSON(state, -1, output) == LUA_ERRRUN);
+		REQUIRE(state.read<std::string>(-1) == "cannot encode JSON: function is not supported");
+
+		REQUIRE(state.runString("return 0/0") == LUA_OK);
+		REQUIRE(encodeJSON(state, -1, output) == LUA_ERRRUN);
+	}
+
+	SECTION("module") {
+		REQUIRE(registerJSON(state));
+
+		REQUIRE(state.runString(
+			"local json = require('json')\n"
+			"local data = json.decode('{\"list\": [1, 2, null]}')\n"
+			"assert(data.list[3] == json.null)\n"
+			"return json.encode(data), json.encode({'a', 'b'})"
+		) == LUA_OK);
+		REQUIRE(state.read<std::string>(-2) == "{\"list\":[1,2,null]}");
+		REQUIRE(state.read<std::string>(-1) == "[\"a\",\"b\"]");
+
+		REQUIRE(state.runString("return pcall(require('json').decode, '[')") == LUA_OK);
+		REQUIRE(state.read<bool>(-2) == false);
+	}
+}
@@ -0,0 +1,81 @@
+#include <catch.hpp>
+#include <luwra.hpp>
+
+#include <string>
+
+using namespace luwra;
+
+TEST_CASE("MemoizedFunction") {
+	StateWrapper state;
+	state.loadStandardLibrary();
+
+	REQUIRE(state.runString(
+		"calls = 0\n"
+		"function price(product, quantity, discounted)\n"
+		"  calls = calls + 1\n"
+		"  local total = #product * quantity\n"
+		"  if discounted then total = total / 2 end\n"
+		"  return total\n"
+		"end"
+	) == LUA_OK);
+
+	MemoizedFunction<double> price = state.get<Function<double>>("price").memoized(2);
+
+	SECTION("hits and misses") {
+		REQUIRE(price("apple", 2, false) == 10);
+		REQUIRE(price(std::string("apple"), 2, false) == 10);
+		REQUIRE(price("apple", 2, true) == 5);
+		REQUIRE(price("pear", 2.5, false) == 10);
+
+		REQUIRE(state.get<int>("calls") == 3);
+		REQUIRE(price.stats.hits == 1);
+		REQUIRE(price.stats.misses == 3);
+		REQUIRE(price.size() == 2);
+	}
+
+	SECTION("least recently used entries are evicted") {
+		price("a", 1, false);
+		price("b", 1, false);
+
+		// Refresh "a", so that "b" is evicted
+		price("a", 1, false);
+		price("c", 1, false);
+
+		REQUIRE(state.get<int>("calls") == 3);
+
+		price("a", 1, false);
+		REQUIRE(state.get<int>("calls") == 3);
+
+		price("b", 1, false);
+		REQUIRE(state.get<int>("calls") == 4);
+	}
+
+	SECTION("keys distinguish types") {
+		REQUIRE(state.runString("function describe(value) return type(value) end") == LUA_OK);
+
+		MemoizedFunction<std::string> describe = state.get<Function<std::string>>("describe").memoized(8);
+
+		REQUIRE(describe(1) == "number");
+		REQUIRE(describe("1") == "string");
+		REQUIRE(describe(true) == "boolean");
+		REQUIRE(describe.stats.misses == 3);
+	}
+
+	SECTION("invalidation") {
+		price("apple", 1, false);
+		price("pear", 1, false);
+
+		REQUIRE(price.invalidate("apple", 1, false));
+		REQUIRE(!price.invalidate("apple", 1, false));
+		REQUIRE(price.size() == 1);
+
+		price("apple", 1, false);
+		REQUIRE(state.get<int>("calls") == 3);
+
+		price.invalidate();
+		REQUIRE(price.size() == 0);
+
+		price("pear", 1, false);
+		REQUIRE(state.get<int>("calls") == 4);
+	}
+}
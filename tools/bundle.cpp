@@ -0,0 +1,62 @@
+#include <luwra.hpp>
+
+#include <cstring>
+#include <string>
+#include <iostream>
+
+using namespace luwra;
+
+// Derive a module name from a file path, e.g. 'app/config.lua' becomes 'app.config' and
+// 'app/init.lua' becomes 'app'.
+static
+std::string moduleName(std::string path) {
+	if (path.size() > 4 && path.compare(path.size() - 4, 4, ".lua") == 0)
+		path.erase(path.size() - 4);
+
+	if (path.size() > 5 && path.compare(path.size() - 5, 5, "/init") == 0)
+		path.erase(path.size() - 5);
+
+	while (path.compare(0, 2, "./") == 0)
+		path.erase(0, 2);
+
+	for (char& c: path) {
+		if (c == '/')
+			c = '.';
+	}
+
+	return path;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		std::cerr << "Usage: " << argv[0] << " OUTPUT [MODULE=]FILE..." << std::endl;
+		return 1;
+	}
+
+	BundleWriter writer;
+
+	for (int i = 2; i < argc; i++) {
+		std::string name;
+		const char* path = argv[i];
+
+		if (const char* separator = std::strchr(argv[i], '=')) {
+			name.assign(argv[i], separator - argv[i]);
+			path = separator + 1;
+		} else {
+			name = moduleName(path);
+		}
+
+		if (writer.addFile(name, path) != LUA_OK) {
+			std::cerr << writer.error << std::endl;
+			return 1;
+		}
+	}
+
+	if (!writer.write(argv[1])) {
+		std::cerr << "Failed to write '" << argv[1] << "'" << std::endl;
+		return 1;
+	}
+
+	std::cout << "Bundled " << writer.size() << " modules into '" << argv[1] << "'" << std::endl;
+	return 0;
+}